@@ -0,0 +1,623 @@
+/*
+ * One driver for the detection benchmarks. It runs the line size, cache size,
+ * associativity and core count tests as stages of a single process, on a
+ * single benchmark arena:
+ *
+ *   cha2sm linesize    line size from false sharing between two threads
+ *   cha2sm cachesize   every cache level's size and latency from one
+ *                      hierarchy sweep
+ *   cha2sm assoc       the ways of every level below the last level cache
+ *   cha2sm cores       virtual core count from thread scaling
+ *   cha2sm all         all four, in that order
+ *
+ * Each stage puts what it finds into one results sink, see common/results.h,
+ * and the later stages read their inputs from there: the sweep uses the
+ * measured line size, and the associativity test the measured level sizes
+ * and latencies. A stage whose inputs were not measured falls back to sysfs
+ * and records that. The results go to stdout in csv format at the end; the
+ * progress of each stage goes to stderr.
+ *
+ * The stages are compact versions of the standalone benchmarks, which keep
+ * the finer options and full csv output.
+ *
+ * The results are also kept as a hardware profile of the host, see
+ * common/hostprofile.h, under a key made of the CPUID signature, microcode
+ * and topology. A later run on a host with the same key takes the profile's
+ * results after a quick probe: a pointer chase in half of every cache level,
+ * which must still take the level's recorded latency to within
+ * kProbeTolerance. Otherwise, or with --fresh, the stages run again.
+ *
+ * Copyright (c) 2024 Christ Lin
+ *
+ * Modifications were made by the Laboratory for Physical Science (LPS) team
+ * from the Applied Methods and Research Experience (AMRE) program, 2024.
+ *
+ * Note that due to the sensitivity of how caches work, it's better to close all other background programs to run the test.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "basetypes.h"
+#include "cacheinfo.h"
+#include "hostprofile.h"
+#include "measureenv.h"
+#include "pagealloc.h"
+#include "pairlist.h"
+#include "physaddr.h"
+#include "plateaus.h"
+#include "results.h"
+#include "sampling.h"
+#include "threadscaling.h"
+#include "timecounters.h"
+
+// Every timed reading is repeated until the median of the readings is known
+// to within kCiTarget, see sampling.h, at most kMaxSamples times or for
+// kReadingBudgetMs
+static const int kMaxSamples = 9;
+static const double kCiTarget = 0.05;
+static const double kReadingBudgetMs = 100.0;
+
+// Line size stage: each thread's increments per run, fewest runs per offset,
+// and the drop in run time that marks the two counters leaving a shared line,
+// as in the standalone line size benchmark
+static const int kFalseSharingIterations = 2000000;
+static const int kFalseSharingMinSamples = 5;
+static const double kFalseSharingDrop = 1.7;
+static const int kMaxLineProbe = 1024;
+
+// Cache size stage: sweep points per doubling of the working set, fewest
+// loads per timed walk, and fewest timed walks per point
+static const int kSweepPointsPerOctave = 8;
+static const int kSweepMinLoads = 1 << 19;
+static const int kSweepMinSamples = 3;
+// Default largest working set, as a multiple of the sysfs LLC size. The last
+// plateau is taken as memory, so this must be well beyond the LLC.
+static const int kSweepPerLlc = 4;
+
+// Associativity stage: the most lines tried in one set, loads per timed walk
+// and fewest timed walks per line count
+static const int kMaxWays = 48;
+static const int kAssocLoads = 1 << 16;
+static const int kAssocMinSamples = 5;
+// Without measured latencies, a line count whose latency is this much above
+// the last one's marks a level running out of ways
+static const double kKneeRatio = 1.3;
+
+// Core count stage: how long each thread count of each workload runs, and
+// the bounds of each worker's dram cycle, as in the Virtual Core
+// Identification Benchmark: twice the worker's share of the LLC, at least
+// kMinDramBytes so a small share still misses, at most kMaxDramBytes so many
+// workers still fit in memory
+static const int kCoreRunMillis = 200;
+static const int64 kMinDramBytes = 16ll << 20;
+static const int64 kMaxDramBytes = 256ll << 20;
+
+// A cached profile is used if a chase in half of each cache level is within
+// this fraction of the level's recorded latency
+static const double kProbeTolerance = 0.25;
+
+// Defaults when sysfs does not describe the caches
+static const int kDefaultLineSize = 64;
+static const int64 kDefaultLlcBytes = 32ll << 20;
+static const int64 kDefaultL2Bytes = 2ll << 20;
+
+// The shared arena, measurement environment, sampling and results of every
+// stage
+static Arena gArena;
+static MeasureEnv gEnv;
+static SamplingPolicy gSampling;
+static ResultSet gResults;
+static CacheInfo gCaches[CACHE_MAX_LEVELS];
+static int gCacheCount = 0;
+
+// Keeps the end of every pointer chase live
+static volatile uintptr_t gSink = 0;
+
+// Returns the smallest power of two not below x
+static int64 CeilPowerOfTwo(int64 x) {
+  int64 p = 1;
+  while (p < x) {p *= 2;}
+  return p;
+}
+
+// Starts sampling a reading that is taken at least min_samples times
+static void StartReadings(Sampler* sampler, int min_samples) {
+  SamplingPolicy policy = gSampling;
+  InitSamplingPolicy(&policy, min_samples, gSampling.max_samples, gSampling.target, gSampling.budget_ms);
+  StartSampler(sampler, &policy);
+}
+
+// Result keys of a cache level, "l1_size", "l2_latency", ...
+static std::string LevelKey(int level, const char* what) {
+  char key[32];
+  snprintf(key, sizeof(key), "l%d_%s", level, what);
+  return key;
+}
+
+// The line size from the results, else from sysfs, else the default
+static int LineSize() {
+  const Result* result = FindResult(&gResults, "line_size");
+  if (result != NULL) {return static_cast<int>(result->value);}
+  if (gCacheCount > 0 && gCaches[0].line_size > 0) {
+    SetResult(&gResults, "linesize", "line_size", gCaches[0].line_size, "bytes", "sysfs", 0.0);
+    return gCaches[0].line_size;
+  }
+  SetResult(&gResults, "linesize", "line_size", kDefaultLineSize, "bytes", "default");
+  return kDefaultLineSize;
+}
+
+// Walk a cycle for loads loads from *start and leave *start where the walk
+// stopped. Returns the elapsed cycles.
+static int64 ChaseCycle(const Pair** start, int64 loads) {
+  const Pair* pairptr = *start;
+  int64 startcy = GetCycles();
+  for (int64 i = 0; i < loads; ++i) {
+    pairptr = pairptr->next;
+  }
+  int64 elapsed = GetCycles() - startcy;
+  *start = pairptr;
+  gSink = reinterpret_cast<uintptr_t>(pairptr);
+  return elapsed;
+}
+
+// Cycles per load of a cycle, walked once to warm the caches and then at
+// least min_samples times for at least min_loads loads, median of the timed
+// walks
+static double CyclesPerLoad(const Pair* first, int64 count, int64 min_loads, int min_samples) {
+  const Pair* pairptr = first;
+  int64 loads = std::max(count, min_loads);
+  ChaseCycle(&pairptr, count);
+  Sampler readings;
+  StartReadings(&readings, min_samples);
+  while (!SamplerDone(&readings)) {
+    AddSample(&readings, static_cast<double>(ChaseCycle(&pairptr, loads)) / loads);
+  }
+  return SamplerMedian(&readings);
+}
+
+// The 95% confidence interval of a plateau's median latency, over the median
+static double PlateauCi(const std::vector<double>& latency, const Plateau& plateau) {
+  Sampler points;
+  StartSampler(&points, &gSampling);
+  for (int i = plateau.first; i <= plateau.last; ++i) {AddSample(&points, latency[i]);}
+  if (points.count < 2) {return -1.0;}
+  return SamplerCiWidth(&points) / SamplerMedian(&points);
+}
+
+// Line size stage.
+//
+// Two threads increment two counters offset bytes apart, for offsets from 8
+// to kMaxLineProbe bytes. While both counters share a line, it bounces
+// between the cores and the run is slow. The line size is the first offset
+// whose run is kFalseSharingDrop times faster than the one before. Needs at
+// least two CPUs; otherwise the sysfs line size is recorded.
+static void RunLineSize() {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus < 2) {
+    fprintf(stderr, "linesize: one CPU, the threads cannot share a line at the same time\n");
+    LineSize();
+    return;
+  }
+
+  std::vector<int> offsets;
+  std::vector<double> times;
+  for (int offset = 8; offset <= kMaxLineProbe; offset *= 2) {
+    uint64* first = reinterpret_cast<uint64*>(gArena.ptr);
+    uint64* second = reinterpret_cast<uint64*>(gArena.ptr + offset);
+    Sampler readings;
+    StartReadings(&readings, kFalseSharingMinSamples);
+    while (!SamplerDone(&readings)) {
+      // Both threads spin until the other one is ready, so the whole run is
+      // contended. They yield rather than pause, so two SCHED_FIFO threads
+      // pinned to one CPU still get there.
+      std::atomic<int> ready(0);
+      auto worker = [&ready](uint64* counter, int k) {
+        PinMeasuringThread(&gEnv, k);
+        ready.fetch_add(1);
+        while (ready.load() < 2) {std::this_thread::yield();}
+        for (int i = 0; i < kFalseSharingIterations; ++i) {
+          __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+        }
+      };
+      auto start = std::chrono::steady_clock::now();
+      std::thread a(worker, first, 0);
+      std::thread b(worker, second, 1);
+      a.join();
+      b.join();
+      std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+      AddSample(&readings, elapsed.count());
+    }
+    offsets.push_back(offset);
+    times.push_back(SamplerMedian(&readings));
+    fprintf(stderr, "linesize: %d bytes apart, %.1f ms\n", offset, times.back());
+  }
+
+  for (size_t i = 0; i + 1 < times.size(); ++i) {
+    if (times[i] >= kFalseSharingDrop * times[i + 1]) {
+      SetResult(&gResults, "linesize", "line_size", offsets[i + 1], "bytes", "measured");
+      return;
+    }
+  }
+  fprintf(stderr, "linesize: no drop in run time, using the sysfs line size\n");
+  LineSize();
+}
+
+// Cache size stage.
+//
+// Sweeps the working set logarithmically from 1KB to max_bytes, as the
+// hierarchy sweep of cachesize_estimated does: a cycle over exactly that many
+// bytes, walked until the caches are warm, then timed. The plateaus of the
+// latency curve are the cache levels and finally memory, see plateaus.h.
+// Records each level's size and latency, the memory latency and the number
+// of levels.
+static void RunCacheSize(int64 max_bytes) {
+  int linesize = LineSize();
+  int64 max_count = max_bytes / linesize;
+  int64 min_count = std::max(4, 1024 / linesize);
+
+  std::vector<int64> counts;
+  double step = pow(2.0, 1.0 / kSweepPointsPerOctave);
+  for (double count = min_count; count < max_count; count *= step) {
+    int64 rounded = static_cast<int64>(count + 0.5);
+    if (counts.empty() || counts.back() != rounded) {counts.push_back(rounded);}
+  }
+  counts.push_back(max_count);
+
+  std::vector<double> latency;
+  std::vector<double> sizes;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    const Pair* first = MakeCyclicList(gArena.ptr, counts[i] * linesize, linesize);
+    latency.push_back(CyclesPerLoad(first, counts[i], kSweepMinLoads, kSweepMinSamples));
+    sizes.push_back(static_cast<double>(counts[i]) * linesize);
+    fprintf(stderr, "cachesize: %.0f KB, %.1f cycles per load\n", sizes.back() / 1024, latency.back());
+  }
+
+  // A capacity is known to within one sweep step, a latency to within the
+  // interval of the median over its plateau's points
+  std::vector<Plateau> plateaus = FindPlateaus(latency, kSweepPointsPerOctave);
+  int levels = static_cast<int>(plateaus.size()) - 1;
+  for (int p = 0; p < levels; ++p) {
+    double capacity = round(PlateauCapacity(latency, sizes, plateaus, p));
+    SetResult(&gResults, "cachesize", LevelKey(p + 1, "size").c_str(), capacity, "bytes", "measured", step - 1.0);
+    SetResult(&gResults, "cachesize", LevelKey(p + 1, "latency").c_str(), plateaus[p].latency, "cycles", "measured",
+              PlateauCi(latency, plateaus[p]));
+  }
+  SetResult(&gResults, "cachesize", "memory_latency", plateaus.back().latency, "cycles", "measured",
+            PlateauCi(latency, plateaus.back()));
+  SetResult(&gResults, "cachesize", "cache_levels", levels, "", "measured");
+}
+
+// The size of a cache level from the results, else from sysfs. Returns 0 if
+// neither knows it.
+static int64 LevelSize(int level) {
+  std::string key = LevelKey(level, "size");
+  const Result* result = FindResult(&gResults, key.c_str());
+  if (result != NULL) {return static_cast<int64>(result->value);}
+  for (int i = 0; i < gCacheCount; ++i) {
+    if (gCaches[i].level != level) {continue;}
+    SetResult(&gResults, "assoc", key.c_str(), gCaches[i].bytesize, "bytes", "sysfs", 0.0);
+    return gCaches[i].bytesize;
+  }
+  return 0;
+}
+
+// Offsets into the arena of up to kMaxWays lines whose physical addresses
+// agree modulo stride, so they all map to one set of any cache with at most
+// stride / line size sets. Level 1 is virtually indexed and takes virtual
+// multiples of stride. The others need a huge page arena with stride at most
+// the page size, or /proc/self/pagemap (root) to pick 4KB pages whose frames
+// agree modulo stride. Returns fewer offsets, or none, when the arena cannot
+// supply them.
+static std::vector<int64> SameSetLines(int level, int64 stride) {
+  std::vector<int64> offsets;
+  int64 hugepage = 0;
+  if (gArena.mode == PAGE_MODE_2M) {hugepage = 1ll << 21;}
+  if (gArena.mode == PAGE_MODE_1G) {hugepage = 1ll << 30;}
+  if (level == 1 || stride <= hugepage) {
+    for (int64 offset = 0; offset + 8 <= static_cast<int64>(gArena.bytesize) && offsets.size() < kMaxWays; offset += stride) {
+      offsets.push_back(offset);
+    }
+    return offsets;
+  }
+
+  int fd = PagemapOpen();
+  uint64 residue = 0;
+  for (int64 offset = 0; offset < static_cast<int64>(gArena.bytesize) && offsets.size() < kMaxWays; offset += 4096) {
+    // Writing, not reading, so the page gets a frame of its own instead of
+    // the shared zero page
+    gArena.ptr[offset] = 1;
+    uint64 address = PhysicalAddress(fd, gArena.ptr + offset);
+    if (address == 0) {break;}
+    if (offsets.empty()) {residue = address % stride;}
+    if (address % stride == residue) {offsets.push_back(offset);}
+  }
+  PagemapClose(fd);
+  return offsets;
+}
+
+// Associativity stage.
+//
+// For every level below the last level cache, takes lines that all map to
+// one set of that level and of every level above it, and times a pointer
+// chase through 1, 2, ... of them. The chase stays in level 1 until its set
+// overflows, then in level 2 until that set overflows too, and so on. The
+// ways of level k are the most lines whose latency stays below the midpoint
+// of the level k and level k + 1 latencies from the cache size stage; without
+// those, the line count just before the k-th jump of kKneeRatio.
+//
+// The last level cache is split into slices by a hash of the physical
+// address, so its lines have to be chosen by the slice hash benchmark and the
+// standalone L3 associativity test.
+static void RunAssoc() {
+  // Records where the line size came from, with the ways
+  LineSize();
+  int levels = static_cast<int>(GetResult(&gResults, "cache_levels", gCacheCount));
+  if (levels < 2) {levels = 2;}
+
+  for (int level = 1; level < levels; ++level) {
+    int64 size = LevelSize(level);
+    if (size <= 0) {
+      fprintf(stderr, "assoc: L%d size unknown, run cachesize first\n", level);
+      continue;
+    }
+    // Any power of two at least the level size is a multiple of its set
+    // stride, whatever the ways, so the size need not be exact. Level 1 is
+    // indexed by the page offset alone, so a page is enough; further apart,
+    // the lines would also conflict in one set of the dTLB.
+    int64 stride = CeilPowerOfTwo(size);
+    if (level == 1) {stride = std::min(stride, static_cast<int64>(kPageSize));}
+    std::vector<int64> offsets = SameSetLines(level, stride);
+    if (offsets.size() < 2) {
+      fprintf(stderr, "assoc: cannot place L%d lines %lld KB apart physically, run as root or with --page_mode=2m\n",
+              level, static_cast<long long>(stride >> 10));
+      continue;
+    }
+
+    std::vector<double> latency(1, 0.0);
+    for (size_t n = 1; n <= offsets.size(); ++n) {
+      for (size_t i = 0; i < n; ++i) {
+        Pair* pairptr = reinterpret_cast<Pair*>(gArena.ptr + offsets[i]);
+        pairptr->next = reinterpret_cast<Pair*>(gArena.ptr + offsets[(i + 1) % n]);
+      }
+      latency.push_back(CyclesPerLoad(reinterpret_cast<Pair*>(gArena.ptr + offsets[0]), n, kAssocLoads, kAssocMinSamples));
+      fprintf(stderr, "assoc: L%d, %d lines in one set, %.1f cycles per load\n", level, static_cast<int>(n), latency.back());
+    }
+
+    double hit = GetResult(&gResults, LevelKey(level, "latency").c_str(), 0.0);
+    double next = GetResult(&gResults, LevelKey(level + 1, "latency").c_str(), 0.0);
+    int ways = 0;
+    if (hit > 0.0 && next > hit) {
+      double midpoint = (hit + next) / 2.0;
+      while (ways + 1 < static_cast<int>(latency.size()) && latency[ways + 1] < midpoint) {++ways;}
+    } else {
+      int jumps = 0;
+      for (size_t n = 2; n < latency.size() && jumps < level; ++n) {
+        if (latency[n] > kKneeRatio * latency[n - 1]) {
+          ++jumps;
+          if (jumps == level) {ways = n - 1;}
+        }
+      }
+    }
+    if (ways == 0 || ways == static_cast<int>(offsets.size())) {
+      fprintf(stderr, "assoc: no knee for L%d within %d lines\n", level, static_cast<int>(offsets.size()));
+      continue;
+    }
+    SetResult(&gResults, "assoc", LevelKey(level, "ways").c_str(), ways, "", "measured");
+  }
+}
+
+// Core count stage.
+//
+// Runs every workload of common/threadscaling.h on one pool of pinned
+// threads, at thread counts up to max_threads, and fits each throughput curve
+// with two lines, as the Virtual Core Identification Benchmark does: the
+// throughput climbs while every thread gets a CPU of its own and levels off
+// beyond. The break of the integer curve is the virtual core count; every
+// workload also records its SMT yield. The dram workload chases a cycle per
+// worker in an arena of its own, each well beyond the LLC.
+static void RunCores(int max_threads) {
+  // Normal priority even with --fifo: more threads than CPUs is the point
+  // here, and FIFO threads would not share
+  SetThreadFifo(0);
+  std::vector<int> cpus(gEnv.cpus, gEnv.cpus + gEnv.cpu_count);
+  if (cpus.empty()) {
+    for (int cpu = 0; cpu < sysconf(_SC_NPROCESSORS_ONLN); ++cpu) {cpus.push_back(cpu);}
+  }
+  int cpu_count = cpus.size();
+  std::vector<int> by_core = cpus;
+  int core_count = OrderCpusByCore(&by_core);
+  if (gEnv.cpu_count == 0) {cpus = by_core;}
+  SetResult(&gResults, "cores", "online_cpus", sysconf(_SC_NPROCESSORS_ONLN), "", "sysfs", 0.0);
+  SetResult(&gResults, "cores", "physical_cores", core_count, "", "sysfs", 0.0);
+
+  std::vector<int> counts = DefaultThreadCounts(cpu_count);
+  while (counts.size() > 1 && counts.back() > max_threads) {counts.pop_back();}
+  int64 llc_bytes = (gCacheCount > 0) ? gCaches[gCacheCount - 1].bytesize : kDefaultLlcBytes;
+  int64 slice = RoundUp(std::min(std::max(2 * llc_bytes / cpu_count, kMinDramBytes), kMaxDramBytes), kPageSize);
+  // Only the pages the workers touch are backed
+  Arena arena;
+  if (AllocArena(&arena, slice * counts.back(), gArena.mode) != 0) {
+    fprintf(stderr, "cores: could not allocate %lld MB for the dram workload\n",
+            static_cast<long long>((slice * counts.back()) >> 20));
+    return;
+  }
+  ScalingPool pool;
+  StartScalingPool(&pool, counts.back(), cpus, arena.ptr, slice, LineSize());
+
+  std::vector<double> threads(counts.begin(), counts.end());
+  for (int w = 0; w < kWorkloadCount; ++w) {
+    std::vector<double> throughput;
+    for (size_t i = 0; i < counts.size(); ++i) {
+      throughput.push_back(RunScalingPoint(&pool, w, counts[i], kCoreRunMillis));
+      fprintf(stderr, "cores: %s, %d threads, %.0f M ops per second\n", kWorkloadNames[w], counts[i], throughput.back());
+    }
+    if (w == kWorkloadInt) {
+      SetResult(&gResults, "cores", "virtual_cores", FindScalingBreak(threads, throughput), "", "measured");
+    }
+    double yield = SmtYield(threads, throughput, core_count, cpu_count);
+    if (yield > 0.0) {
+      SetResult(&gResults, "cores", (std::string(kWorkloadNames[w]) + "_smt_yield").c_str(), yield, "", "measured");
+    }
+  }
+  StopScalingPool(&pool);
+  FreeArena(&arena);
+  SetThreadFifo(gEnv.fifo);
+}
+
+// Whether the profile results in gResults cover every stage of command
+static bool ProfileCovers(const std::string& command) {
+  const char* const kStages[] = {"linesize", "cachesize", "assoc", "cores"};
+  for (int i = 0; i < 4; ++i) {
+    if (command != "all" && command != kStages[i]) {continue;}
+    bool found = false;
+    for (size_t r = 0; r < gResults.results.size(); ++r) {found = found || gResults.results[r].stage == kStages[i];}
+    if (!found) {return false;}
+  }
+  return true;
+}
+
+// Quick check that the host still looks like its profile: a pointer chase in
+// half of each cache level, which should take the level's latency. Returns
+// the chase's cycles over the recorded latency furthest from 1, or 1 when the
+// profile has no latencies.
+static double ProbeProfile() {
+  int linesize = LineSize();
+  double worst = 1.0;
+  int levels = static_cast<int>(GetResult(&gResults, "cache_levels", 0));
+  for (int level = 1; level <= levels; ++level) {
+    int64 count = std::max<int64>(4, static_cast<int64>(GetResult(&gResults, LevelKey(level, "size").c_str(), 0)) / 2 / linesize);
+    double recorded = GetResult(&gResults, LevelKey(level, "latency").c_str(), 0.0);
+    if (recorded <= 0.0 || count * linesize > static_cast<int64>(gArena.bytesize)) {continue;}
+    const Pair* first = MakeCyclicList(gArena.ptr, count * linesize, linesize);
+    double ratio = CyclesPerLoad(first, count, kSweepMinLoads, kSweepMinSamples) / recorded;
+    fprintf(stderr, "profile: L%d probe at %lld KB, %.2f times the recorded latency\n", level,
+            static_cast<long long>(count * linesize >> 10), ratio);
+    if (fabs(log(ratio)) > fabs(log(worst))) {worst = ratio;}
+  }
+  return worst;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: cha2sm linesize|cachesize|assoc|cores|all [--page_mode=4k|thp|2m|1g] [--max_size=<MB>] [--max_threads=<n>] "
+            "[--profile_dir=<dir>] [--fresh] [--pin_cpu=<cpulist>] [--fifo] [--mlock]\n");
+    return 1;
+  }
+  std::string command = argv[1];
+  bool all = (command == "all");
+  if (!all && command != "linesize" && command != "cachesize" && command != "assoc" && command != "cores") {
+    fprintf(stderr, "Unknown subcommand %s, use linesize, cachesize, assoc, cores or all\n", command.c_str());
+    return 1;
+  }
+
+  InitMeasureEnv(&gEnv);
+  InitSamplingPolicy(&gSampling, 1, kMaxSamples, kCiTarget, kReadingBudgetMs);
+  int page_mode = PAGE_MODE_4K;
+  double max_size_mb = 0.0;       // 0 means kSweepPerLlc times the LLC size
+  int max_threads = 0;            // 0 means up to twice the online CPUs
+  const char* profile_dir = NULL; // NULL means under $XDG_CACHE_HOME or $HOME
+  bool fresh = false;
+  for (int i = 2; i < argc; ++i) {
+    if (std::strncmp(argv[i], "--page_mode=", 12) == 0) {
+      page_mode = ParsePageMode(argv[i] + 12);
+      if (page_mode < 0) {
+        fprintf(stderr, "Unknown --page_mode, use 4k, thp, 2m or 1g\n");
+        return 1;
+      }
+    } else if (std::strncmp(argv[i], "--max_size=", 11) == 0) {
+      max_size_mb = std::atof(argv[i] + 11);
+    } else if (std::strncmp(argv[i], "--max_threads=", 14) == 0) {
+      max_threads = std::atoi(argv[i] + 14);
+    } else if (std::strncmp(argv[i], "--profile_dir=", 14) == 0) {
+      profile_dir = argv[i] + 14;
+    } else if (std::strcmp(argv[i], "--fresh") == 0) {
+      fresh = true;
+    } else if (!ParseSamplingFlag(&gSampling, argv[i])) {
+      ParseMeasureEnvFlag(&gEnv, argv[i]);
+    }
+  }
+
+  // Recorded with the results, since they say how far to trust them
+  SetupMeasureEnv(&gEnv);
+  SetResult(&gResults, "env", "pinned_cpu", (gEnv.cpu_count > 0) ? gEnv.cpus[0] : -1, "", "flags");
+  SetResult(&gResults, "env", "sched_fifo", gEnv.fifo, "", "flags");
+  SetResult(&gResults, "env", "memory_locked", gEnv.mlock, "", "flags");
+  SetResult(&gResults, "env", "governor_performance",
+            (strcmp(gEnv.governor, "-") == 0) ? -1 : (strcmp(gEnv.governor, "performance") == 0), "", "sysfs");
+  SetResult(&gResults, "env", "turbo", gEnv.turbo, "", "sysfs");
+
+  gCacheCount = ReadCacheInfo(gCaches, CACHE_MAX_LEVELS);
+  int64 llc_bytes = (gCacheCount > 0) ? gCaches[gCacheCount - 1].bytesize : kDefaultLlcBytes;
+  int64 max_bytes = (max_size_mb > 0.0) ? static_cast<int64>(max_size_mb * 1024 * 1024) : kSweepPerLlc * llc_bytes;
+  if (max_threads <= 0) {max_threads = 2 * sysconf(_SC_NPROCESSORS_ONLN);}
+
+  // One arena for every stage: big enough for the sweep, and for kMaxWays
+  // same-set lines of the level below the LLC, twice over since pagemap
+  // finds them at random
+  int64 l2_bytes = (gCacheCount > 1) ? gCaches[gCacheCount - 2].bytesize : kDefaultL2Bytes;
+  int64 assoc_bytes = 2 * kMaxWays * CeilPowerOfTwo(l2_bytes);
+  int64 arena_bytes = std::max(max_bytes, assoc_bytes);
+  if (AllocArena(&gArena, arena_bytes, page_mode) != 0) {
+    fprintf(stderr, "Could not allocate %lld MB\n", static_cast<long long>(arena_bytes >> 20));
+    return 1;
+  }
+  fprintf(stderr, "arena: %lld MB of %s pages\n", static_cast<long long>(arena_bytes >> 20), PageModeName(gArena.mode));
+
+  // A profile of this host from an earlier run, if it covers the stages and
+  // passes the probe. Profiles hold no env rows, so those stay this run's.
+  HostIdentity host = ReadHostIdentity();
+  std::string dir = ProfileDir(profile_dir);
+  std::string path = dir.empty() ? "" : ProfilePath(dir, host);
+  ResultSet env = gResults;
+  bool cached = false;
+  if (!fresh && !path.empty() && ReadProfile(path, host, &gResults) > 0) {
+    double ratio = ProfileCovers(command) ? ProbeProfile() : 0.0;
+    cached = (ratio > 0.0 && fabs(log(ratio)) <= log(1.0 + kProbeTolerance));
+    if (cached) {
+      fprintf(stderr, "profile: using %s\n", path.c_str());
+      SetResult(&gResults, "profile", "probe_ratio", ratio, "", "measured");
+    } else {
+      fprintf(stderr, "profile: %s %s, measuring again\n", path.c_str(),
+              (ratio > 0.0) ? "no longer matches" : "does not cover the stages");
+      gResults = env;
+    }
+  }
+
+  if (!cached) {
+    if (all || command == "linesize") {RunLineSize();}
+    if (all || command == "cachesize") {RunCacheSize(max_bytes);}
+    if (all || command == "assoc") {RunAssoc();}
+    if (all || command == "cores") {RunCores(max_threads);}
+
+    // Added to what the profile already had, e.g. from other stages
+    if (!path.empty()) {
+      ResultSet profile;
+      ReadProfile(path, host, &profile);
+      for (size_t i = 0; i < gResults.results.size(); ++i) {
+        const Result& r = gResults.results[i];
+        if (r.stage == "env" || r.stage == "profile") {continue;}
+        SetResult(&profile, r.stage.c_str(), r.key.c_str(), r.value, r.unit.c_str(), r.source.c_str(), r.ci);
+      }
+      if (WriteProfile(path, host, &profile) == 0) {
+        fprintf(stderr, "profile: wrote %s\n", path.c_str());
+      } else {
+        fprintf(stderr, "profile: could not write %s\n", path.c_str());
+      }
+    }
+  }
+
+  SetResult(&gResults, "profile", "cached", cached, "", "profile", 0.0);
+  WriteResults(&gResults, stdout);
+  FreeArena(&gArena);
+  return 0;
+}
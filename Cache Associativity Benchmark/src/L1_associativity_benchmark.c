@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // for sched_setaffinity() in measureenv.h
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -5,8 +6,18 @@
 #include <inttypes.h>
 #include <string.h>
 
-#define MEM_SIZE ((size_t)1024 * 1024 * 1024 * 3) //size of the test array (in bytes)
-#define NUM_ITERATIONS 100000 // number of iterations in each test
+#include "cacheinfo.h"
+#include "latency_histogram.h"
+#include "measureenv.h"
+#include "pagealloc.h"
+#include "perfcounters.h"
+#include "sampling.h"
+
+#define MEM_SIZE ((size_t)1024 * 1024 * 1024 * 3) //size of the test array (in bytes), only reserved: just the lines a test uses get memory
+#define NUM_ITERATIONS 100000 // most iterations in each test
+#define BATCH_ITERATIONS 500 // iterations per sample: a test stops once the median of its samples' mean access times is stable, see sampling.h
+#define MIN_BATCHES 5 // samples before a test may stop
+#define CI_TARGET 0.02 // confidence interval of the median, as a fraction of it, that is stable enough
 
 // Structure with size 64 Bytes (size of cache line). Is used as the elements of the test array.
 typedef struct {
@@ -20,15 +31,21 @@ typedef struct {
     volatile int64_t h;
 } __attribute__((aligned(64))) int64byte_t;
 
-// Returns a malloc array of size mem_size with 64 Byte elements of struct int64byte_t
-int64byte_t *allocate_benchmark_memory(size_t mem_size) {
-    int64byte_t *arr = malloc(mem_size); 
+// Reserves an arena of size mem_size for 64 Byte elements of struct int64byte_t. Nothing is touched here: the pages are only faulted in
+// when written, so the arena costs address space, not memory, and populate_lines() writes just the lines a test uses. Returns NULL on failure
+int64byte_t *allocate_benchmark_memory(size_t mem_size, Arena *arena) {
+    if (AllocArena(arena, mem_size, PAGE_MODE_4K) != 0) {
+        return NULL;
+    }
+    return (int64byte_t *)arena->ptr;
+}
 
-    //initialize all the elements in arr
-    for (size_t i = 0; i < mem_size / sizeof(int64byte_t); i++) {
-        arr[i].a = i;
+// Writes the elements of arr indexed by indices, faulting in their pages. Reading a page that was never written would map the kernel's
+// shared zero page instead, putting every element on the same physical page
+void populate_lines(int64byte_t *arr, size_t *indices, int indices_arr_size) {
+    for (int i = 0; i < indices_arr_size; i++) {
+        arr[indices[i]].a = indices[i];
     }
-    return arr; 
 }
 
 // Wrapper for two CPU/compiler optimization and pre-fetching inhibitors
@@ -63,13 +80,35 @@ size_t *generate_L1_indices(int test_associativity, int *arr_size, size_t l1_siz
 }
 
 // Measures access times for L1 test and outputs results into a CSV file. mem is the test array of size MEM_SIZE.
-void run_L1_associativity_benchmark(int64byte_t *mem, size_t l1_size, size_t cache_line_size) {
+void run_L1_associativity_benchmark(int64byte_t *mem, int iterations, const SamplingPolicy *sampling, size_t l1_size, size_t cache_line_size) {
     
-    //create output csv file and print column names
-    FILE* output_file = fopen("cache_L1associativity_benchmark_data.csv", "w");
-    fprintf(output_file, "associativity,element_index,access_time\n");
+    //access times are collected in histograms and written out once the test is done, see latency_histogram.h
+    latency_histograms_t hist;
+    if (histograms_alloc(&hist) != 0) {
+        fprintf(stderr, "Could not allocate the histograms\n");
+        return;
+    }
+    uint64_t latencies[HIST_MAX_ELEMENTS];
+
+    // hardware counters per iteration of each associativity go to a second csv file, see perfcounters.h
+    PerfGroup perf;
+    char perf_columns[256];
+    if (PerfGroupOpen(&perf) == 0) {
+        fprintf(stderr, "Hardware counters not available, their columns will be -\n");
+    }
+    FILE* counters_file = fopen("cache_L1associativity_benchmark_counters.csv", "w");
+    PerfCsvHeader(",", perf_columns, sizeof(perf_columns));
+    fprintf(counters_file, "associativity,iterations%s\n", perf_columns);
 
     unsigned int aux; // Temp variable for __rdtscp()
+
+    // Samples of BATCH_ITERATIONS iterations each, at most iterations in all
+    int batch_iterations = (iterations < BATCH_ITERATIONS) ? iterations : BATCH_ITERATIONS;
+    int max_batches = iterations / batch_iterations;
+    SamplingPolicy batches;
+    InitSamplingPolicy(&batches, (sampling->min_samples < max_batches) ? sampling->min_samples : max_batches, max_batches,
+                       sampling->target, sampling->budget_ms);
+    batches.resolution = sampling->resolution;
     
     // ouput the access times for each associativity to be tested by creating an array of indices, iterating over it once it load into the target set, and once more to measure the time
     for (int i = 2; i <= 24; i += 2) { // Associativities to test
@@ -77,40 +116,75 @@ void run_L1_associativity_benchmark(int64byte_t *mem, size_t l1_size, size_t cac
         // Create array for test indices using generate_L1_indices() for each associativity
         int test_indices_arr_size;
         size_t *test_indices = generate_L1_indices(i, &test_indices_arr_size, l1_size, cache_line_size);
+        populate_lines(mem, test_indices, test_indices_arr_size);
         
-        // Run test NUM_ITERATIONS times for each test associativity
-        for (int j = 0; j < NUM_ITERATIONS; j++) {
-            // Load the elements into the target set by reading the elemnts at indices in test_indices
-            memory_barrier();
-            for (int k = 0; k < test_indices_arr_size; k++) {
+        // Run test in batches of batch_iterations iterations for each test associativity, until the mean access times of the batches agree
+        Sampler sampler;
+        StartSampler(&sampler, &batches);
+        int done_iterations = 0;
+        PerfGroupStart(&perf);
+        while (!SamplerDone(&sampler)) {
+            uint64_t batch_cycles = 0;
+            uint64_t batch_loads = 0;
+            for (int j = 0; j < batch_iterations; j++) {
+                // Load the elements into the target set by reading the elemnts at indices in test_indices
                 memory_barrier();
-                volatile int16_t temp = mem[test_indices[k]].a; 
-            }
+                for (int k = 0; k < test_indices_arr_size; k++) {
+                    memory_barrier();
+                    volatile int16_t temp = mem[test_indices[k]].a; 
+                }
 
-            // Measure access time using an x86 instruction to read time stamp counter register
-            memory_barrier();
-            for (int k = 0; k < test_indices_arr_size; k++) {
+                // Measure access time using an x86 instruction to read time stamp counter register
                 memory_barrier();
-                size_t start_t = __rdtscp(&aux); 
-                volatile int16_t temp = mem[test_indices[k]].a;
-                size_t end_t = __rdtscp(&aux);
-                fprintf(output_file, "%d,%d,%ld\n", i, k, (end_t - start_t));
-            }
+                for (int k = 0; k < test_indices_arr_size; k++) {
+                    memory_barrier();
+                    size_t start_t = __rdtscp(&aux); 
+                    volatile int16_t temp = mem[test_indices[k]].a;
+                    size_t end_t = __rdtscp(&aux);
+                    latencies[k] = end_t - start_t;
+                }
+                histograms_record(&hist, i, latencies, test_indices_arr_size);
+                batch_cycles += latencies_total(latencies, test_indices_arr_size);
+                batch_loads += test_indices_arr_size;
             
-            // Clear the cache of all accessed elements for next iteration using clear_cache()
-            memory_barrier();
-            clear_cache(mem, test_indices, test_indices_arr_size);  
+                // Clear the cache of all accessed elements for next iteration using clear_cache()
+                memory_barrier();
+                clear_cache(mem, test_indices, test_indices_arr_size);  
+            }
+            done_iterations += batch_iterations;
+            AddSample(&sampler, (double)batch_cycles / batch_loads);
         }
+        PerfGroupStop(&perf);
+        PerfCsvValues(&perf, done_iterations, ",", perf_columns, sizeof(perf_columns));
+        fprintf(counters_file, "%d,%d%s\n", i, done_iterations, perf_columns);
         free(test_indices);
     }
-    fclose(output_file);
+    PerfGroupClose(&perf);
+    fclose(counters_file);
+
+    //summary csv and full binary histograms
+    histograms_write_csv(&hist, "cache_L1associativity_benchmark_data.csv");
+    histograms_write_binary(&hist, "cache_L1associativity_benchmark_histogram.bin");
+    histograms_free(&hist);
 } __attribute__((optimize(0)))
 
 int main(int argc, char *argv[]) {
 
-    uint64_t l1_size = 288 * 1024; //default L1d size
+    uint64_t l1_size = 288 * 1024; //default L1d size, when neither sysfs nor CPUID reports one
     int cache_line_size = 64; //default cache line size (has to match the alignment of the int64byte_t structure)
+    int iterations = NUM_ITERATIONS; //default most iterations in each test
  
+    MeasureEnv env; //pinning, priority and memory locking of the run, see measureenv.h
+    InitMeasureEnv(&env);
+    SamplingPolicy sampling; //when a test has enough iterations, see sampling.h
+    InitSamplingPolicy(&sampling, MIN_BATCHES, SAMPLER_MAX_SAMPLES, CI_TARGET, 0.0);
+    //the L1d size the kernel or CPUID reports is the default, see cacheinfo.h
+    CacheInfo caches[CACHE_MAX_LEVELS];
+    int cache_count = ReadCacheHints(caches, CACHE_MAX_LEVELS);
+    const CacheInfo *l1 = FindCacheLevel(caches, cache_count, 1);
+    if (l1 != NULL) {
+        l1_size = l1->bytesize;
+    }
     //properly assigns a value to l1_size if a flag is set when running the program
     for (int i = 1; i < argc; ++i) {
         if (strncmp(argv[i], "--l1_size=", 10) == 0) {
@@ -118,17 +192,31 @@ int main(int argc, char *argv[]) {
             if (strlen(arg_value) > 0) {
                 l1_size = atoi(arg_value);
             }
-        } 
+        } else if (strncmp(argv[i], "--iterations=", 13) == 0) {
+            iterations = atoi(argv[i] + 13);
+            if (iterations <= 0) {
+                iterations = NUM_ITERATIONS;
+            }
+        } else if (!ParseSamplingFlag(&sampling, argv[i])) {
+            ParseMeasureEnvFlag(&env, argv[i]);
+        }
     }
 
-    // Allocate memory for the benchmark of size MEM_SIZE
-    int64byte_t *benchmark_memory = allocate_benchmark_memory(MEM_SIZE);
+    SetupMeasureEnv(&env);
+
+    // Reserve the memory for the benchmark of size MEM_SIZE
+    Arena arena;
+    int64byte_t *benchmark_memory = allocate_benchmark_memory(MEM_SIZE, &arena);
+    if (benchmark_memory == NULL) {
+        fprintf(stderr, "Could not reserve %zu bytes\n", (size_t)MEM_SIZE);
+        return 1;
+    }
 
-    // Run the L1 associativity benchmark with the created malloc array, l1_size (can be specified by user), and cache_line_size
-    run_L1_associativity_benchmark(benchmark_memory, l1_size, cache_line_size);
+    // Run the L1 associativity benchmark with the reserved array, the iterations and l1_size (can be specified by user), and cache_line_size
+    run_L1_associativity_benchmark(benchmark_memory, iterations, &sampling, l1_size, cache_line_size);
 
-    // Free the allocated memory
-    free(benchmark_memory);
+    // Free the reserved memory
+    FreeArena(&arena);
 
     return 0;
 }
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // for sched_setaffinity() in measureenv.h
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -5,10 +6,22 @@
 #include <inttypes.h>
 #include <string.h>
 
+#include "cacheinfo.h"
+#include "eviction_set.h"
+#include "latency_histogram.h"
+#include "measureenv.h"
+#include "pagealloc.h"
+#include "perfcounters.h"
+#include "sampling.h"
+
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
-#define MEM_SIZE ((size_t)1024 * 1024 * 1024 * 3) //size of the test array (in bytes)
-#define NUM_ITERATIONS 100000 // number of iterations in each test
+#define MAX_MEM_SIZE ((size_t)1024 * 1024 * 1024 * 256) //furthest the elements may lie in the test array (in bytes), only as much as they reach is reserved, see L3_indices_extent()
+#define NUM_ITERATIONS 100000 // most iterations in each test
+#define PHYSICAL_NUM_ITERATIONS 10000 // number of iterations in each test when the elements are chosen by physical address
+#define BATCH_ITERATIONS 500 // iterations per sample: a test stops once the median of its samples' mean access times is stable, see sampling.h
+#define MIN_BATCHES 5 // samples before a test may stop
+#define CI_TARGET 0.02 // confidence interval of the median, as a fraction of it, that is stable enough
 
 // Structure with size 64 Bytes (size of cache line). Is used as the elements of the test array.
 typedef struct {
@@ -22,15 +35,22 @@ typedef struct {
     volatile int64_t h;
 } __attribute__((aligned(64))) int64byte_t;
 
-// Returns a malloc array of size mem_size with 64 Byte elements of struct int64byte_t
-int64byte_t *allocate_benchmark_memory(size_t mem_size) {
-    int64byte_t *arr = malloc(mem_size);
-    
-    //initilizes all the elements of arr
-    for (size_t i = 0; i < mem_size / sizeof(int64byte_t); i++) {
-        arr[i].a = i;
+// Reserves an arena of size mem_size for 64 Byte elements of struct int64byte_t, backed with pages of page_mode. Nothing is touched here:
+// the pages are only faulted in when written, so the arena costs address space, not memory, and populate_lines() writes just the lines a
+// test uses. Returns NULL on failure
+int64byte_t *allocate_benchmark_memory(size_t mem_size, int page_mode, Arena *arena) {
+    if (AllocArena(arena, mem_size, page_mode) != 0) {
+        return NULL;
+    }
+    return (int64byte_t *)arena->ptr;
+}
+
+// Writes the elements of arr indexed by indices, faulting in their pages. Reading a page that was never written would map the kernel's
+// shared zero page instead, putting every element on the same physical page
+void populate_lines(int64byte_t *arr, size_t *indices, int indices_arr_size) {
+    for (int i = 0; i < indices_arr_size; i++) {
+        arr[indices[i]].a = indices[i];
     }
-    return arr;
 }
 
 // Wrapper for two CPU/compiler optimization and pre-fetching inhibitors
@@ -39,6 +59,22 @@ void memory_barrier() {
     _mm_mfence();
 } __attribute__((optimize(0)))
 
+// Returns the least common multiple of a and b
+size_t lcm(size_t a, size_t b) {
+    size_t x = a, y = b;
+    while (y != 0) {
+        size_t t = x % y;
+        x = y;
+        y = t;
+    }
+    return a / x * b;
+}
+
+// Returns whether index lies within the first MAX_MEM_SIZE bytes of the test array
+int arena_fits(size_t index, size_t cache_line_size) {
+    return index < MAX_MEM_SIZE / cache_line_size;
+}
+
 // Removes elements in arr indexed by indices from all cache levels using an x86 clflush instruction
 void clear_cache(int64byte_t *arr, size_t *indices, int indices_arr_size) {
     memory_barrier();
@@ -48,7 +84,8 @@ void clear_cache(int64byte_t *arr, size_t *indices, int indices_arr_size) {
 } __attribute__((optimize(0)))
 
 // Returns an array of indices for the L3 with size MAX(l2_assoc, l1_assoc) + test_associativity. Uses l3_size and cache_line_size to determine the stride of the indices for the first 
-// test_associativity elements. Uses l1_size, l2_size, and cache_line_size to determine the next MAX(l2_assoc, l1_assoc) elements. Assigns the size of the returned array to *arr_size
+// test_associativity elements. Uses l1_size, l2_size, and cache_line_size to determine the next MAX(l2_assoc, l1_assoc) elements. Assigns the size of the returned array to *arr_size. Returns NULL when the elements
+// do not fit in MAX_MEM_SIZE, e.g. when the L3 test sets coincide with the L2 sets
 size_t *generate_L3_indices(int test_associativity, int *arr_size, size_t l1_size, size_t l2_size, size_t l3_size, int l1_assoc, int l2_assoc, size_t cache_line_size) {
     size_t l1_cache_lines = l1_size / cache_line_size;
     size_t l2_cache_lines = l2_size / cache_line_size;
@@ -62,25 +99,31 @@ size_t *generate_L3_indices(int test_associativity, int *arr_size, size_t l1_siz
     *arr_size = MAX(l2_assoc, l1_assoc) + test_associativity;
     size_t *arr = malloc((*arr_size) * sizeof(size_t));
 
-    // Populate arr with indexes of elements that get mapped to same set in L1 & L2 & l3
+    // Populate arr with indexes of elements that get mapped to same set in L1 & L2 & l3. Only the multiples of both l3_cache_lines and
+    // l1_num_sets, i.e. of their least common multiple, can qualify, so step through those
     int index = 0;
-    for (int i = 0; i < (MEM_SIZE / cache_line_size); i++) {
-        if ((i % l3_cache_lines == 0) && (i % l1_num_sets == 0) && (i % l2_num_sets)) { //each element gets mapped to same sets in L1, L2, and L3
-            arr[index++] = i;
+    size_t same_set_stride = lcm(l3_cache_lines, l1_num_sets);
+    for (size_t i = 0; index < test_associativity; i += same_set_stride) {
+        if (!arena_fits(i, cache_line_size)) {
+            free(arr);
+            return NULL;
         }
-        if (index >= test_associativity) {
-            break;
+        if (i % l2_num_sets) { //each element gets mapped to same sets in L1, L2, and L3
+            arr[index++] = i;
         }
     }
 
-    // Populate rest of arr with indexes of elements that get mapped to the same set in L1 & l2, but a different set in L3
+    // Populate rest of arr with indexes of elements that get mapped to the same set in L1 & l2, but a different set in L3: the multiples of
+    // both l1_num_sets and l2_num_sets that are not multiples of l3_test_num_sets
     size_t index1 = test_associativity;
-    for (size_t i = 0; i < (MEM_SIZE / 64); i++) {
-        if ((i % l1_num_sets == 0) && (i % l2_num_sets == 0) && (i % l3_test_num_sets != 0)) { 
-            arr[index1++] = i;
+    size_t l1_l2_stride = lcm(l1_num_sets, l2_num_sets);
+    for (size_t i = 0; index1 < *arr_size; i += l1_l2_stride) {
+        if (!arena_fits(i, cache_line_size)) {
+            free(arr);
+            return NULL;
         }
-        if (index1 >= *arr_size) {
-             break;
+        if (i % l3_test_num_sets != 0) {
+            arr[index1++] = i;
         }
     }
 
@@ -88,61 +131,199 @@ size_t *generate_L3_indices(int test_associativity, int *arr_size, size_t l1_siz
 } __attribute__((optimize(0)))
 
 
-// Measures access times for L3 test and outputs results into a CSV file. mem is the test array of size MEM_SIZE.
-void run_L3_associativity_benchmark(int64byte_t *mem, size_t l1_size, size_t l2_size, size_t l3_size, int l1_assoc, int l2_assoc, size_t cache_line_size) {
+// Returns the size of the test array (in bytes) in virtual address mode: one element past the largest index generate_L3_indices()
+// returns for any tested associativity, so the mapping stays small enough for vm.overcommit_memory=2 or ulimit -v
+size_t L3_indices_extent(size_t l1_size, size_t l2_size, size_t l3_size, int l1_assoc, int l2_assoc, size_t cache_line_size) {
+    size_t max_index = 0;
+    for (int i = 2; i < 25; i += 2) {
+        int indices_arr_size;
+        size_t *indices = generate_L3_indices(i, &indices_arr_size, l1_size, l2_size, l3_size, l1_assoc, l2_assoc, cache_line_size);
+        if (indices == NULL) {
+            continue;
+        }
+        for (int k = 0; k < indices_arr_size; k++) {
+            max_index = MAX(max_index, indices[k]);
+        }
+        free(indices);
+    }
+    return (max_index + 1) * cache_line_size;
+}
 
-    //create output csv file and print column names
-    FILE* output_file = fopen("cache_L3associativity_benchmark_data.csv", "w");
-    fprintf(output_file, "associativity,element_index,access_time\n");
+// Like generate_L3_indices(), but chooses the elements by their physical line numbers, see eviction_set.h. The first test_associativity
+// elements are in physical set 0 of L1, L2 and L3: multiples of l1_num_sets, l2_num_sets and of the largest power of two dividing the L3
+// lines. The next MAX(l2_assoc, l1_assoc) elements are odd multiples of the least common multiple of l1_num_sets and l2_num_sets, in the
+// same L1 and L2 sets but in another L3 set whenever L3 has at least twice as many sets as L2. Returns NULL when the elements cannot be found
+size_t *generate_L3_physical_indices(physical_lines_t *map, int test_associativity, int *arr_size, size_t l1_size, size_t l2_size, size_t l3_size, int l1_assoc, int l2_assoc, size_t cache_line_size) {
+    size_t l1_num_sets = (l1_size / cache_line_size) / l1_assoc;
+    size_t l2_num_sets = (l2_size / cache_line_size) / l2_assoc;
+    size_t l1_l2_stride = lcm(l1_num_sets, l2_num_sets);
+    size_t l3_set_stride = power_of_two_part(l3_size / cache_line_size);
+
+    *arr_size = MAX(l2_assoc, l1_assoc) + test_associativity;
+    size_t *arr = malloc((*arr_size) * sizeof(size_t));
+    if (map->slice_hash != NULL) {
+        // With the slice hash the test elements all share the slice of the first one, and the evicting elements only need to be in
+        // another slice to be in another L3 set
+        map->slice = -1;
+        if (find_physical_lines(map, lcm(l1_l2_stride, l3_set_stride), 0, arr, 0, 1) == 0) {
+            map->slice = physical_slice(map, arr[0]);
+            map->in_slice = 1;
+            if (find_physical_lines(map, lcm(l1_l2_stride, l3_set_stride), 0, arr, 1, test_associativity - 1) == 0) {
+                map->in_slice = 0;
+                if (find_physical_lines(map, l1_l2_stride, 0, arr, test_associativity, MAX(l2_assoc, l1_assoc)) == 0) {
+                    return arr;
+                }
+            }
+        }
+        free(arr);
+        return NULL;
+    }
+    if (find_physical_lines(map, lcm(l1_l2_stride, l3_set_stride), 0, arr, 0, test_associativity) != 0 ||
+        find_physical_lines(map, l1_l2_stride, 2 * l1_l2_stride, arr, test_associativity, MAX(l2_assoc, l1_assoc)) != 0) {
+        free(arr);
+        return NULL;
+    }
+    return arr;
+}
+
+// Measures access times for L3 test and outputs results into a CSV file. mem is the test array, see L3_indices_extent(). The elements are chosen
+// by virtual index, or by physical address unless map->mode is ADDRESS_MODE_VIRTUAL
+void run_L3_associativity_benchmark(int64byte_t *mem, physical_lines_t *map, int iterations, const SamplingPolicy *sampling, size_t l1_size, size_t l2_size, size_t l3_size, int l1_assoc, int l2_assoc, size_t cache_line_size) {
+
+    //access times are collected in histograms and written out once the test is done, see latency_histogram.h
+    latency_histograms_t hist;
+    if (histograms_alloc(&hist) != 0) {
+        fprintf(stderr, "Could not allocate the histograms\n");
+        return;
+    }
+    uint64_t latencies[HIST_MAX_ELEMENTS];
+
+    // hardware counters per iteration of each associativity go to a second csv file, see perfcounters.h
+    PerfGroup perf;
+    char perf_columns[256];
+    if (PerfGroupOpen(&perf) == 0) {
+        fprintf(stderr, "Hardware counters not available, their columns will be -\n");
+    }
+    FILE* counters_file = fopen("cache_L3associativity_benchmark_counters.csv", "w");
+    PerfCsvHeader(",", perf_columns, sizeof(perf_columns));
+    fprintf(counters_file, "associativity,iterations%s\n", perf_columns);
 
     unsigned int aux; //temp variable for __rdtscp()
 
+    // Samples of BATCH_ITERATIONS iterations each, at most iterations in all
+    int batch_iterations = (iterations < BATCH_ITERATIONS) ? iterations : BATCH_ITERATIONS;
+    int max_batches = iterations / batch_iterations;
+    SamplingPolicy batches;
+    InitSamplingPolicy(&batches, (sampling->min_samples < max_batches) ? sampling->min_samples : max_batches, max_batches,
+                       sampling->target, sampling->budget_ms);
+    batches.resolution = sampling->resolution;
+
     // ouput the access times for each associativity to be tested by creating an array of indices, iterating over it once it load into the target set, and once more to measure the time
     for (int i = 2; i < 25; i += 2) {
 
         // Create array for test indices using generate_L3_indices() for each associativity
         int test_indices_arr_size;
-        size_t *test_indices = generate_L3_indices(i, &test_indices_arr_size, l1_size, l2_size, l3_size, l1_assoc, l2_assoc, cache_line_size);
+        size_t *test_indices;
+        if (map->mode == ADDRESS_MODE_VIRTUAL) {
+            test_indices = generate_L3_indices(i, &test_indices_arr_size, l1_size, l2_size, l3_size, l1_assoc, l2_assoc, cache_line_size);
+        } else {
+            test_indices = generate_L3_physical_indices(map, i, &test_indices_arr_size, l1_size, l2_size, l3_size, l1_assoc, l2_assoc, cache_line_size);
+        }
+        if (test_indices == NULL) {
+            fprintf(stderr, "Skipping associativity %d: its conflicting elements could not be placed in the test array\n", i);
+            continue;
+        }
+        populate_lines(mem, test_indices, test_indices_arr_size);
 
-        // Run test NUM_ITERATIONS times for each test associativity
-        for (size_t j = 0; j < NUM_ITERATIONS; j++) {
+        // Run test in batches of batch_iterations iterations for each test associativity, until the mean access times of the batches agree
+        Sampler sampler;
+        StartSampler(&sampler, &batches);
+        int done_iterations = 0;
+        PerfGroupStart(&perf);
+        while (!SamplerDone(&sampler)) {
+            uint64_t batch_cycles = 0;
+            uint64_t batch_loads = 0;
+            for (int j = 0; j < batch_iterations; j++) {
 
-            // Load the elements into the target set by reading the elemnts at indices in test_indices
-            memory_barrier();
-            for (size_t k = 0; k < test_indices_arr_size; k++) {
+                // Load the elements into the target set by reading the elemnts at indices in test_indices
                 memory_barrier();
-                volatile int16_t temp = mem[test_indices[k]].a;
-            }
+                for (size_t k = 0; k < test_indices_arr_size; k++) {
+                    memory_barrier();
+                    volatile int16_t temp = mem[test_indices[k]].a;
+                }
             
-            // Measure access time of the unique elements in L3 (first test_associativity elements in test_indices) using an x86 instruction to read time stamp counter register
-            memory_barrier();
-            for (int k = 0; k < i; k++) {
+                // Measure access time of the unique elements in L3 (first test_associativity elements in test_indices) using an x86 instruction to read time stamp counter register
                 memory_barrier();
-                size_t start_t = __rdtscp(&aux);
-                volatile int16_t temp = mem[test_indices[k]].a;
-                size_t end_t = __rdtscp(&aux);
-                fprintf(output_file, "%d,%d,%ld\n", i, k, (end_t - start_t));
-            }
+                for (int k = 0; k < i; k++) {
+                    memory_barrier();
+                    size_t start_t = __rdtscp(&aux);
+                    volatile int16_t temp = mem[test_indices[k]].a;
+                    size_t end_t = __rdtscp(&aux);
+                    latencies[k] = end_t - start_t;
+                }
+                histograms_record(&hist, i, latencies, i);
+                batch_cycles += latencies_total(latencies, i);
+                batch_loads += i;
 
-            // Clear the cache of all accessed elements for next iteration using clear_cache()
-            memory_barrier();
-            clear_cache(mem, test_indices, test_indices_arr_size);
+                // Clear the cache of all accessed elements for next iteration using clear_cache()
+                memory_barrier();
+                clear_cache(mem, test_indices, test_indices_arr_size);
+            }
+            done_iterations += batch_iterations;
+            AddSample(&sampler, (double)batch_cycles / batch_loads);
         }
+        PerfGroupStop(&perf);
+        PerfCsvValues(&perf, done_iterations, ",", perf_columns, sizeof(perf_columns));
+        fprintf(counters_file, "%d,%d%s\n", i, done_iterations, perf_columns);
         free(test_indices);
     }
-    fclose(output_file);
+    PerfGroupClose(&perf);
+    fclose(counters_file);
+
+    //summary csv and full binary histograms
+    histograms_write_csv(&hist, "cache_L3associativity_benchmark_data.csv");
+    histograms_write_binary(&hist, "cache_L3associativity_benchmark_histogram.bin");
+    histograms_free(&hist);
 } __attribute__((optimize(0)))
 
 int main(int argc, char *argv[]) {
 
     
-    size_t l1_size = 256 * 1024; //default L1d size
-    size_t l2_size = 5 * 1024 * 1024; //default L2 size
-    size_t l3_size = 10 * 1024 * 1024; //default L3 size
+    size_t l1_size = 256 * 1024; //default L1d size, when neither sysfs nor CPUID reports one
+    size_t l2_size = 5 * 1024 * 1024; //default L2 size, likewise
+    size_t l3_size = 10 * 1024 * 1024; //default L3 size, likewise
     int l1_associativity = 10; //default L1d associativity
     int l2_associativity = 12; //default L2 associativity
     size_t cache_line_size = 64; //default cache line size (must be the same as the alignment of int64byte_t structure)
+    int address_mode = ADDRESS_MODE_VIRTUAL; //default choice of conflicting elements, by virtual index
+    int iterations = 0; //default most iterations, NUM_ITERATIONS or PHYSICAL_NUM_ITERATIONS depending on the address mode
+    const char *slice_hash_file = NULL; //default no LLC slice hash
  
+    MeasureEnv env; //pinning, priority and memory locking of the run, see measureenv.h
+    InitMeasureEnv(&env);
+    SamplingPolicy sampling; //when a test has enough iterations, see sampling.h
+    InitSamplingPolicy(&sampling, MIN_BATCHES, SAMPLER_MAX_SAMPLES, CI_TARGET, 0.0);
+    //the sizes and associativities the kernel or CPUID reports are the defaults, see cacheinfo.h
+    CacheInfo caches[CACHE_MAX_LEVELS];
+    int cache_count = ReadCacheHints(caches, CACHE_MAX_LEVELS);
+    const CacheInfo *l1 = FindCacheLevel(caches, cache_count, 1);
+    const CacheInfo *l2 = FindCacheLevel(caches, cache_count, 2);
+    const CacheInfo *l3 = FindCacheLevel(caches, cache_count, 3);
+    if (l1 != NULL) {
+        l1_size = l1->bytesize;
+        if (l1->ways > 0) {
+            l1_associativity = l1->ways;
+        }
+    }
+    if (l2 != NULL) {
+        l2_size = l2->bytesize;
+        if (l2->ways > 0) {
+            l2_associativity = l2->ways;
+        }
+    }
+    if (l3 != NULL) {
+        l3_size = l3->bytesize;
+    }
     //properly assigns a value to above variables if a flag is set when running the program
      for (int i = 1; i < argc; ++i) {
         if (strncmp(argv[i], "--l1_size=", 10) == 0) {
@@ -170,17 +351,64 @@ int main(int argc, char *argv[]) {
             if (strlen(arg_value) > 0) {
                 l2_associativity = atof(arg_value);
             }
+        } else if (strncmp(argv[i], "--address_mode=", 15) == 0) {
+            address_mode = parse_address_mode(argv[i] + 15);
+            if (address_mode < 0) {
+                fprintf(stderr, "Unknown address mode %s, use virtual, pagemap, 2m or 1g\n", argv[i] + 15);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--iterations=", 13) == 0) {
+            iterations = atoi(argv[i] + 13);
+        } else if (strncmp(argv[i], "--slice_hash=", 13) == 0) {
+            slice_hash_file = argv[i] + 13;
+        } else if (!ParseSamplingFlag(&sampling, argv[i])) {
+            ParseMeasureEnvFlag(&env, argv[i]);
         }
     }
+    if (iterations <= 0) {
+        iterations = (address_mode == ADDRESS_MODE_VIRTUAL) ? NUM_ITERATIONS : PHYSICAL_NUM_ITERATIONS;
+    }
 
-    // Allocate memory for the benchmark of size MEM_SIZE
-    int64byte_t *benchmark_memory = allocate_benchmark_memory(MEM_SIZE);
+    SetupMeasureEnv(&env);
+
+    // Reserve the memory for the benchmark: as far as the elements reach, the lines pagemap mode searches, or a hugepage arena of
+    // HUGEPAGE_POOL_SIZE
+    size_t mem_size;
+    if (address_mode == ADDRESS_MODE_2M || address_mode == ADDRESS_MODE_1G) {
+        mem_size = HUGEPAGE_POOL_SIZE;
+    } else if (address_mode == ADDRESS_MODE_PAGEMAP) {
+        mem_size = PAGEMAP_POOL_SIZE;
+    } else {
+        mem_size = L3_indices_extent(l1_size, l2_size, l3_size, l1_associativity, l2_associativity, cache_line_size);
+    }
+    Arena arena;
+    int64byte_t *benchmark_memory = allocate_benchmark_memory(mem_size, address_mode_page_mode(address_mode), &arena);
+    if (benchmark_memory == NULL) {
+        fprintf(stderr, "Could not reserve %zu bytes\n", mem_size);
+        return 1;
+    }
+    physical_lines_t map;
+    if (physical_lines_open(&map, address_mode, &arena, cache_line_size) != 0) {
+        FreeArena(&arena);
+        return 1;
+    }
+    SliceHash slice_hash;
+    if (slice_hash_file != NULL) {
+        if (address_mode != ADDRESS_MODE_PAGEMAP || ReadSliceHash(slice_hash_file, &slice_hash) != 0) {
+            fprintf(stderr, "--slice_hash needs --address_mode=pagemap and a file written by the slice hash benchmark\n");
+            physical_lines_close(&map);
+            FreeArena(&arena);
+            return 1;
+        }
+        map.slice_hash = &slice_hash;
+    }
 
-    // Run the L3 associativity benchmark with the created malloc array
-    run_L3_associativity_benchmark(benchmark_memory, l1_size, l2_size, l3_size, l1_associativity, l2_associativity, cache_line_size);
+    // Run the L3 associativity benchmark with the reserved array
+    run_L3_associativity_benchmark(benchmark_memory, &map, iterations, &sampling, l1_size, l2_size, l3_size, l1_associativity, l2_associativity, cache_line_size);
 
-    // Free the allocated memory
-    free(benchmark_memory);
+    // Free the reserved memory
+    physical_lines_close(&map);
+    FreeArena(&arena);
 
     return 0;
 }
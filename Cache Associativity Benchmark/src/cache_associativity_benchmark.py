@@ -2,17 +2,68 @@ import matplotlib.pyplot as plt
 from datetime import datetime
 import subprocess
 import os
+import numpy as np
 import pandas as pd
 
+#Reads the binary histograms written by the C programs (format in latency_histogram.h)
+#Returns a pandas object with the exact median access time of each associativity, over all its timed elements and iterations
+def read_histogram_medians(filename):
+    with open(filename, 'rb') as f:
+        if f.read(8) != b'LATHIST1':
+            raise ValueError(f"{filename} is not a latency histogram file")
+        num_associativities, max_elements, buckets, _ = np.fromfile(f, dtype='<i4', count=4)
+        associativities = np.fromfile(f, dtype='<i4', count=num_associativities)
+        np.fromfile(f, dtype='<i4', count=num_associativities) #timed elements per associativity, not needed here
+        counts = np.fromfile(f, dtype='<u4', count=num_associativities * max_elements * buckets)
+    counts = counts.reshape(num_associativities, max_elements, buckets).sum(axis=1)
+
+    medians = []
+    for row in counts:
+        cumulative = np.cumsum(row)
+        medians.append(int(np.searchsorted(cumulative, (cumulative[-1] + 1) // 2)))
+    return pd.DataFrame({'associativity': associativities, 'access_time': medians}).sort_values('associativity').reset_index(drop=True)
+
+#Returns the size in bytes and the associativity sysfs reports for a cache level, or None; the C programs also ask CPUID, see common/cacheinfo.h
+def reported_cache(level):
+    base = "/sys/devices/system/cpu/cpu0/cache"
+    if not os.path.isdir(base):
+        return None
+    for index in sorted(os.listdir(base)):
+        try:
+            with open(f"{base}/{index}/level") as f:
+                if int(f.read()) != level:
+                    continue
+            with open(f"{base}/{index}/type") as f:
+                if f.read().strip() == "Instruction":
+                    continue
+            with open(f"{base}/{index}/size") as f:
+                size = f.read().strip()
+            with open(f"{base}/{index}/ways_of_associativity") as f:
+                ways = int(f.read())
+        except (OSError, ValueError):
+            continue
+        scale = {'K': 1 << 10, 'M': 1 << 20, 'G': 1 << 30}.get(size[-1], 1)
+        return int(size.rstrip('KMG')) * scale, ways
+    return None
+
+#Prints the prediction, and whether it agrees with the associativity the system reports
+def print_associativity_prediction(data, cache_lvl, level):
+    prediction = cache_associativity_output_calculation(data)
+    print(f"{cache_lvl} associativity prediction:", prediction)
+    reported = reported_cache(level)
+    if reported is not None and reported[1] > 0 and not isinstance(prediction, str) and prediction != reported[1]:
+        print(f"The system reports {cache_lvl} as {reported[1]}-way: check the graph, or rerun with the physical address modes")
+
 #Runs the compiled C program for the L1 test using subprocess, asking the user for necessary informtaion to set the flags, and reads the created csv file and renames the file with a timestamp
 #Returns a pandas object that contains the median access times for each associativity tested in the L1 test
 def cache_L1associativity_output_obtain():
     timestamp = datetime.now().strftime('%Y%m%d_%H%M%S')
 
     filename = "cache_L1associativity_benchmark_data.csv"
+    histogram_filename = "cache_L1associativity_benchmark_histogram.bin"
 
     # Prompt the user to optionally specify the --cache_linesize flag
-    l1_size = input("Enter L1 size (in Bytes)(or press Enter to skip): ").strip()
+    l1_size = input("Enter L1 size (in Bytes)(or press Enter for what the system reports): ").strip()
 
     # Build the command based on user's input
     cmd = ["./cache_L1associativity_benchmark"]
@@ -24,19 +75,13 @@ def cache_L1associativity_output_obtain():
     print("Running benchmark: ")
     process.wait()
     
-    # Read the CSV file in chunks
-    chunk_list = []
-    for chunk in pd.read_csv(filename, chunksize=10000):
-        # Calculate the median access time for each associativity in the chunk
-        chunk_median = chunk.groupby('associativity')['access_time'].median().reset_index()
-        chunk_list.append(chunk_median)
-   
-    # Concatenate all chunk results
-    median_access_times = pd.concat(chunk_list).groupby('associativity')['access_time'].median().reset_index()
+    # Read the histograms, the summary csv has the per-element statistics
+    median_access_times = read_histogram_medians(histogram_filename)
     
     #saves data as a timestamped csv file
     new_filename = f"cache_L1associativity_benchmark_data_{timestamp}.csv"
     os.rename(filename, new_filename)
+    os.rename(histogram_filename, f"cache_L1associativity_benchmark_histogram_{timestamp}.bin")
     print("L1 data saved.")
 
     return median_access_times
@@ -52,7 +97,7 @@ def cache_l1associativity_detection():
     print("L1 graph saved.")
 
     #Print out prediction
-    print("L1 associativity prediction:", cache_associativity_output_calculation(data))
+    print_associativity_prediction(data, "L1", 1)
 
 
 #Runs the compiled C program for the L2 test using subprocess, asking the user for necessary informtaion to set the flags, and reads the created csv file and renames the file with a timestamp
@@ -61,11 +106,13 @@ def cache_L2associativity_output_obtain():
 
     timestamp = datetime.now().strftime('%Y%m%d_%H%M%S')
     filename = "cache_L2associativity_benchmark_data.csv"
+    histogram_filename = "cache_L2associativity_benchmark_histogram.bin"
 
     # Prompt the user to optionally specify the --cache_linesize flag
-    l1_size = input("Enter L1 size (in Bytes)(or press Enter to skip): ").strip()
-    l2_size = input("Enter L2 size (in Bytes)(or press Enter to skip): ").strip()
-    l1_associativity = input("Enter the associativity of L1 (or press Enter to skip): ").strip()
+    l1_size = input("Enter L1 size (in Bytes)(or press Enter for what the system reports): ").strip()
+    l2_size = input("Enter L2 size (in Bytes)(or press Enter for what the system reports): ").strip()
+    l1_associativity = input("Enter the associativity of L1 (or press Enter for what the system reports): ").strip()
+    address_mode = input("Choose the elements by physical address? Enter pagemap (needs root), 2m or 1g (hugepages) (or press Enter to skip): ").strip()
 
     # Build the command based on user's input
     cmd = ["./cache_L2associativity_benchmark"]
@@ -75,25 +122,21 @@ def cache_L2associativity_output_obtain():
         cmd.append(f"--l2_size={l2_size}")
     elif l1_associativity:
         cmd.append(f"--l1_associativity={l1_associativity}")
+    if address_mode:
+        cmd.append(f"--address_mode={address_mode}")
     
     # Open a subprocess to run the C program 
     process = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
     print("Running benchmark: ")
     process.wait()
 
-    # Read the CSV file in chunks
-    chunk_list = []
-    for chunk in pd.read_csv(filename, chunksize=10000):
-        # Calculate the median access time for each associativity in the chunk
-        chunk_median = chunk.groupby('associativity')['access_time'].median().reset_index()
-        chunk_list.append(chunk_median)
-   
-    # Concatenate all chunk results
-    median_access_times = pd.concat(chunk_list).groupby('associativity')['access_time'].median().reset_index()
+    # Read the histograms, the summary csv has the per-element statistics
+    median_access_times = read_histogram_medians(histogram_filename)
     
     #saves data as a timestamped csv file
     new_filename = f"cache_L2associativity_benchmark_data_{timestamp}.csv"
     os.rename(filename, new_filename)
+    os.rename(histogram_filename, f"cache_L2associativity_benchmark_histogram_{timestamp}.bin")
     print("L2 data saved.")
     
 
@@ -110,7 +153,7 @@ def cache_l2associativity_detection():
     print("L2 graph saved.")
 
     #Print out prediction
-    print("L2 associativity prediction:", cache_associativity_output_calculation(data))
+    print_associativity_prediction(data, "L2", 2)
 
 
 #Runs the compiled C program for the L3 test using subprocess, asking the user for necessary informtaion to set the flags, and reads the created csv file and renames the file with a timestamp
@@ -119,14 +162,16 @@ def cache_L3associativity_output_obtain():
 
     timestamp = datetime.now().strftime('%Y%m%d_%H%M%S')
     filename = "cache_L3associativity_benchmark_data.csv"
+    histogram_filename = "cache_L3associativity_benchmark_histogram.bin"
 
     # Prompt the user to optionally specify the --cache_linesize flag
-    l1_size = input("Enter L1 size (in Bytes)(or press Enter to skip): ").strip()
-    l2_size = input("Enter L2 size (in Bytes)(or press Enter to skip): ").strip()
-    l3_size = input("Enter L3 size (in Bytes)(or press Enter to skip): ").strip()
+    l1_size = input("Enter L1 size (in Bytes)(or press Enter for what the system reports): ").strip()
+    l2_size = input("Enter L2 size (in Bytes)(or press Enter for what the system reports): ").strip()
+    l3_size = input("Enter L3 size (in Bytes)(or press Enter for what the system reports): ").strip()
 
-    l1_associativity = input("Enter the associativity of L1 (or press Enter to skip): ").strip()
-    l2_associativity = input("Enter the associativity of L2 (or press Enter to skip): ").strip()
+    l1_associativity = input("Enter the associativity of L1 (or press Enter for what the system reports): ").strip()
+    l2_associativity = input("Enter the associativity of L2 (or press Enter for what the system reports): ").strip()
+    address_mode = input("Choose the elements by physical address? Enter pagemap (needs root), 2m or 1g (hugepages) (or press Enter to skip): ").strip()
 
     # Build the command based on user's input
     cmd = ["./cache_L3associativity_benchmark"]
@@ -140,25 +185,21 @@ def cache_L3associativity_output_obtain():
         cmd.append(f"--l2_associativity={l2_associativity}")
     elif l3_size:
         cmd.append(f"--l3_size={l3_size}")
+    if address_mode:
+        cmd.append(f"--address_mode={address_mode}")
     
     # Open a subprocess to run the C program
     process = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
     print("Running benchmark: ")
     process.wait()
     
-    #Read the CSV file in chunks
-    chunk_list = []
-    for chunk in pd.read_csv(filename, chunksize=10000):
-        # Calculate the median access time for each associativity in the chunk
-        chunk_median = chunk.groupby('associativity')['access_time'].median().reset_index()
-        chunk_list.append(chunk_median)
-   
-    # Concatenate all chunk results
-    median_access_times = pd.concat(chunk_list).groupby('associativity')['access_time'].median().reset_index()
+    # Read the histograms, the summary csv has the per-element statistics
+    median_access_times = read_histogram_medians(histogram_filename)
    
     #saves data as a timestamped csv file
     new_filename = f"cache_L3associativity_benchmark_data_{timestamp}.csv"
     os.rename(filename, new_filename)
+    os.rename(histogram_filename, f"cache_L3associativity_benchmark_histogram_{timestamp}.bin")
     print("L3 data saved.")
 
     return median_access_times
@@ -175,7 +216,7 @@ def cache_l3associativity_detection():
     print("L3 graph saved.")
 
     #Print out prediction
-    print("L3 associativity prediction:", cache_associativity_output_calculation(data))
+    print_associativity_prediction(data, "L3", 3)
 
 
 #returns the predicted cache associativity based on the filtered data from the csv file (data)
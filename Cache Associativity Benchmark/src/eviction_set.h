@@ -0,0 +1,168 @@
+#ifndef EVICTION_SET_H
+#define EVICTION_SET_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pagealloc.h"
+#include "physaddr.h"
+#include "slicehash.h"
+
+// Choosing conflicting elements by physical address for the L2 and L3 tests. L2 and L3 are physically indexed, and with 4 KB pages only
+// the low 12 bits of an element's virtual address carry over to its physical address, so elements picked by virtual index spread over
+// random sets. Here each element's physical line number is either read from /proc/self/pagemap (needs root) or known modulo the page
+// size of a 2 MB or 1 GB hugepage arena, whose pages are physically aligned.
+
+#define ADDRESS_MODE_VIRTUAL 0 // virtual indices, the closed form of the original benchmark
+#define ADDRESS_MODE_PAGEMAP 1 // physical addresses from /proc/self/pagemap
+#define ADDRESS_MODE_2M 2 // 2 MB hugetlb pages, the low 21 bits of the physical address are known
+#define ADDRESS_MODE_1G 3 // 1 GB hugetlb pages, the low 30 bits of the physical address are known
+
+#define PAGEMAP_POOL_SIZE ((size_t)1024 * 1024 * 1024 * 2) // at most this many bytes are faulted in while searching for elements in pagemap mode
+#define HUGEPAGE_POOL_SIZE ((size_t)1024 * 1024 * 128) // size of the hugepage arena, rounded up to one page in 1g mode
+
+static const char *const address_mode_names[] = {"virtual", "pagemap", "2m", "1g"};
+
+typedef struct {
+    int mode; // ADDRESS_MODE_*
+    uint8_t *base; // start of the test array
+    size_t pool_lines; // lines of the test array searched for elements
+    size_t line_size;
+    size_t known_lines; // the physical line number is known modulo known_lines, 0 if it is known fully
+    int pagemap_fd;
+    size_t cached_page; // virtual page number and physical line number of its first line, of the last page looked up in pagemap
+    uint64_t cached_line;
+    const SliceHash *slice_hash; // LLC slice hash from the slice hash benchmark, NULL if none
+    int slice; // with a slice hash: the LLC slice find_physical_lines() keeps to, or -1 for any
+    int in_slice; // 1 to find lines in slice, 0 to find lines in any other slice
+} physical_lines_t;
+
+// Returns the ADDRESS_MODE_* for a name such as "pagemap", or -1 if unknown
+static int parse_address_mode(const char *name) {
+    for (int i = 0; i < 4; i++) {
+        if (strcmp(name, address_mode_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Returns the PAGE_MODE_* the test array needs in the given address mode
+static int address_mode_page_mode(int mode) {
+    if (mode == ADDRESS_MODE_2M) {
+        return PAGE_MODE_2M;
+    }
+    if (mode == ADDRESS_MODE_1G) {
+        return PAGE_MODE_1G;
+    }
+    return PAGE_MODE_4K;
+}
+
+// Returns the largest power of two dividing x. Real caches have a power of two sets, and that divides the number of lines, so every line
+// whose physical line number is a multiple of this maps to set 0, whatever the associativity
+static size_t power_of_two_part(size_t x) {
+    return x & (~x + 1);
+}
+
+// Prepares the physical lookup of the lines of arena, which must be backed with the page mode of address_mode_page_mode(mode).
+// Returns 0 on success, -1 with a message on stderr when the physical addresses cannot be resolved
+static int physical_lines_open(physical_lines_t *map, int mode, Arena *arena, size_t line_size) {
+    memset(map, 0, sizeof(*map));
+    map->mode = mode;
+    map->base = arena->ptr;
+    map->line_size = line_size;
+    map->pagemap_fd = -1;
+    map->cached_page = SIZE_MAX;
+    map->slice = -1;
+    if (mode == ADDRESS_MODE_PAGEMAP) {
+        map->pool_lines = (arena->bytesize < PAGEMAP_POOL_SIZE ? arena->bytesize : PAGEMAP_POOL_SIZE) / line_size;
+        map->pagemap_fd = PagemapOpen();
+        map->base[0] = 1;
+        if (PhysicalAddress(map->pagemap_fd, map->base) == 0) {
+            fprintf(stderr, "/proc/self/pagemap does not show physical addresses, run as root or use --address_mode=2m\n");
+            PagemapClose(map->pagemap_fd);
+            return -1;
+        }
+        return 0;
+    }
+    if (arena->mode != address_mode_page_mode(mode)) {
+        fprintf(stderr, "No %s hugepages for --address_mode=%s, reserve them in /sys/kernel/mm/hugepages first\n", address_mode_names[mode],
+                address_mode_names[mode]);
+        return -1;
+    }
+    map->pool_lines = arena->bytesize / line_size;
+    map->known_lines = ((mode == ADDRESS_MODE_2M) ? ((size_t)1 << 21) : ((size_t)1 << 30)) / line_size;
+    return 0;
+}
+
+static void physical_lines_close(physical_lines_t *map) {
+    PagemapClose(map->pagemap_fd);
+    map->pagemap_fd = -1;
+}
+
+// Returns whether the physical line number modulo modulus is known for every line
+static int physical_lines_resolve(const physical_lines_t *map, size_t modulus) {
+    return map->known_lines == 0 || map->known_lines % modulus == 0;
+}
+
+// Sets *line to the physical line number of element index, faulting its page in. In hugepage mode it is only correct modulo known_lines.
+// Returns 0 on success, -1 if pagemap does not know the page
+static int physical_line(physical_lines_t *map, size_t index, uint64_t *line) {
+    if (map->mode != ADDRESS_MODE_PAGEMAP) {
+        *line = index;
+        return 0;
+    }
+    size_t lines_per_page = 4096 / map->line_size;
+    size_t page = index / lines_per_page;
+    if (page != map->cached_page) {
+        // Writing, not reading, so the page gets a frame of its own instead of the shared zero page
+        uint8_t *first = map->base + page * 4096;
+        *(volatile uint8_t *)first = 1;
+        uint64_t address = PhysicalAddress(map->pagemap_fd, first);
+        if (address == 0) {
+            return -1;
+        }
+        map->cached_page = page;
+        map->cached_line = address / map->line_size;
+    }
+    *line = map->cached_line + index % lines_per_page;
+    return 0;
+}
+
+// Returns the LLC slice of element index under map->slice_hash
+static int physical_slice(physical_lines_t *map, size_t index) {
+    uint64_t line;
+    physical_line(map, index, &line);
+    return SliceOf(map->slice_hash, line * map->line_size);
+}
+
+// Finds count elements whose physical line number is a multiple of same but, if differ is not 0, not a multiple of differ, and that keep to
+// map->slice, skipping the elements already in out[0..start). Writes their indices to out[start..start + count). Returns 0 on success, -1
+// when the physical line numbers are not known modulo same and differ, or the pool holds too few such elements
+static int find_physical_lines(physical_lines_t *map, size_t same, size_t differ, size_t *out, int start, int count) {
+    if (!physical_lines_resolve(map, same) || (differ != 0 && !physical_lines_resolve(map, differ))) {
+        return -1;
+    }
+    int found = 0;
+    for (size_t index = 0; index < map->pool_lines && found < count; index++) {
+        uint64_t line;
+        if (physical_line(map, index, &line) != 0 || line % same != 0 || (differ != 0 && line % differ == 0)) {
+            continue;
+        }
+        if (map->slice_hash != NULL && map->slice >= 0 && (physical_slice(map, index) == map->slice) != map->in_slice) {
+            continue;
+        }
+        int duplicate = 0;
+        for (int k = 0; k < start + found; k++) {
+            duplicate |= (out[k] == index);
+        }
+        if (!duplicate) {
+            out[start + found++] = index;
+        }
+    }
+    return (found == count) ? 0 : -1;
+}
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+
+// Per-(associativity, element) access time histograms, kept in one buffer allocated before the benchmark starts and written out once at the end.
+// Writing one csv line per timed load produced files of hundreds of MB, and the stdio traffic between iterations polluted the caches being measured.
+
+#define HIST_MAX_ASSOCIATIVITIES 12 // associativities 2, 4, ..., 24
+#define HIST_MAX_ELEMENTS 24 // timed elements per iteration, at most the largest associativity
+#define HIST_BUCKETS 1024 // one bucket per cycle; the last one also counts every longer access
+#define HIST_MAGIC "LATHIST1"
+
+typedef struct {
+    int num_associativities; // slots in use, in the order the associativities were first recorded
+    int associativity[HIST_MAX_ASSOCIATIVITIES];
+    int elements[HIST_MAX_ASSOCIATIVITIES]; // timed elements per iteration of each associativity
+    uint32_t *counts; // [HIST_MAX_ASSOCIATIVITIES][HIST_MAX_ELEMENTS][HIST_BUCKETS]
+} latency_histograms_t;
+
+// Allocates the zeroed histogram buffer. Returns 0 on success.
+static int histograms_alloc(latency_histograms_t *hist) {
+    memset(hist, 0, sizeof(*hist));
+    hist->counts = calloc((size_t)HIST_MAX_ASSOCIATIVITIES * HIST_MAX_ELEMENTS * HIST_BUCKETS, sizeof(uint32_t));
+    return (hist->counts == NULL) ? -1 : 0;
+}
+
+static void histograms_free(latency_histograms_t *hist) {
+    free(hist->counts);
+    hist->counts = NULL;
+}
+
+// Returns the histogram of one element of an associativity
+static uint32_t *histogram_of(const latency_histograms_t *hist, int slot, int element) {
+    return hist->counts + ((size_t)slot * HIST_MAX_ELEMENTS + element) * HIST_BUCKETS;
+}
+
+// Adds the access times of one iteration, latencies[k] being the time of element k. Call it after the timed loop, so the timed loads only ever
+// touch the small latencies array.
+static void histograms_record(latency_histograms_t *hist, int associativity, const uint64_t *latencies, int count) {
+    int slot = 0;
+    while (slot < hist->num_associativities && hist->associativity[slot] != associativity) {
+        slot++;
+    }
+    if (slot == hist->num_associativities) {
+        if (slot == HIST_MAX_ASSOCIATIVITIES) {
+            return;
+        }
+        hist->associativity[slot] = associativity;
+        hist->num_associativities++;
+    }
+    if (count > HIST_MAX_ELEMENTS) {
+        count = HIST_MAX_ELEMENTS;
+    }
+    if (count > hist->elements[slot]) {
+        hist->elements[slot] = count;
+    }
+    for (int k = 0; k < count; k++) {
+        uint64_t bucket = latencies[k] < HIST_BUCKETS ? latencies[k] : HIST_BUCKETS - 1;
+        histogram_of(hist, slot, k)[bucket]++;
+    }
+}
+
+// Returns the sum of the access times of one iteration, each capped at the last bucket like histograms_record() does, so one interrupted
+// load does not outweigh a whole batch
+static uint64_t latencies_total(const uint64_t *latencies, int count) {
+    uint64_t total = 0;
+    for (int k = 0; k < count; k++) {
+        total += latencies[k] < HIST_BUCKETS ? latencies[k] : HIST_BUCKETS - 1;
+    }
+    return total;
+}
+
+// Returns the smallest access time with at least fraction of the samples at or below it
+static int histogram_percentile(const uint32_t *counts, uint64_t samples, double fraction) {
+    uint64_t target = (uint64_t)(fraction * samples + 0.5);
+    uint64_t seen = 0;
+    if (target < 1) {
+        target = 1;
+    }
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += counts[b];
+        if (seen >= target) {
+            return b;
+        }
+    }
+    return HIST_BUCKETS - 1;
+}
+
+// Writes one summary row per (associativity, element): sample count, min, quartiles, 90th percentile, max and mean access time in cycles.
+// Times of HIST_BUCKETS - 1 or more are counted as HIST_BUCKETS - 1. Returns 0 on success.
+static int histograms_write_csv(const latency_histograms_t *hist, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        return -1;
+    }
+    fprintf(f, "associativity,element_index,samples,min,p25,median,p75,p90,max,mean\n");
+    for (int slot = 0; slot < hist->num_associativities; slot++) {
+        for (int k = 0; k < hist->elements[slot]; k++) {
+            const uint32_t *counts = histogram_of(hist, slot, k);
+            uint64_t samples = 0;
+            double sum = 0.0;
+            int min = -1;
+            int max = 0;
+            for (int b = 0; b < HIST_BUCKETS; b++) {
+                if (counts[b] == 0) {
+                    continue;
+                }
+                if (min < 0) {
+                    min = b;
+                }
+                max = b;
+                samples += counts[b];
+                sum += (double)b * counts[b];
+            }
+            if (samples == 0) {
+                continue;
+            }
+            fprintf(f, "%d,%d,%" PRIu64 ",%d,%d,%d,%d,%d,%d,%.2f\n", hist->associativity[slot], k, samples, min,
+                    histogram_percentile(counts, samples, 0.25), histogram_percentile(counts, samples, 0.5),
+                    histogram_percentile(counts, samples, 0.75), histogram_percentile(counts, samples, 0.9), max, sum / samples);
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+// Writes the full histograms in a compact binary format, all fields little-endian on x86:
+//   char magic[8] = "LATHIST1"
+//   int32 num_associativities, max_elements, buckets, reserved
+//   int32 associativity[num_associativities]
+//   int32 elements[num_associativities]
+//   uint32 counts[num_associativities][max_elements][buckets], bucket b counting accesses of b cycles
+// Returns 0 on success.
+static int histograms_write_binary(const latency_histograms_t *hist, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        return -1;
+    }
+    int32_t header[4] = {hist->num_associativities, HIST_MAX_ELEMENTS, HIST_BUCKETS, 0};
+    int32_t associativity[HIST_MAX_ASSOCIATIVITIES];
+    int32_t elements[HIST_MAX_ASSOCIATIVITIES];
+    for (int slot = 0; slot < hist->num_associativities; slot++) {
+        associativity[slot] = hist->associativity[slot];
+        elements[slot] = hist->elements[slot];
+    }
+    fwrite(HIST_MAGIC, 1, 8, f);
+    fwrite(header, sizeof(int32_t), 4, f);
+    fwrite(associativity, sizeof(int32_t), hist->num_associativities, f);
+    fwrite(elements, sizeof(int32_t), hist->num_associativities, f);
+    fwrite(hist->counts, sizeof(uint32_t), (size_t)hist->num_associativities * HIST_MAX_ELEMENTS * HIST_BUCKETS, f);
+    fclose(f);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,789 @@
+/*
+ * Program related to caches and memory. It measures the sustained bandwidth
+ * of every level of the memory hierarchy, from L1d out to DRAM.
+ *
+ * Four STREAM-style kernels, each in a scalar, SSE2, AVX2 and AVX-512
+ * version:
+ *   read     sum += a[i]
+ *   write    a[i] = 1.0
+ *   copy     a[i] = b[i]
+ *   triad    a[i] = b[i] + 3.0 * c[i]
+ * and write and copy again with non-temporal stores (movnti, movntpd), which
+ * skip the write-allocate read of every stored line:
+ *   ntwrite  a[i] = 1.0
+ *   ntcopy   a[i] = b[i]
+ * The vector versions are compiled with target attributes and only run when
+ * CPUID says the CPU (and OS) support them, so one binary covers every host.
+ *
+ * The working set per thread is swept logarithmically from a few KB, well
+ * inside L1d, to well beyond the last level cache. Every thread gets its own
+ * page-aligned arena from pagealloc.h, first touched by the thread itself so
+ * its pages are local, and threads are pinned one per CPU.
+ *
+ * Copyright (c) 2024 Christ Lin
+ *
+ * Modifications were made by the Laboratory for Physical Science (LPS) team
+ * from the Applied Methods and Research Experience (AMRE) program, 2024.
+ *
+ * Note that due to the sensitivity of how caches work, it's better to close all other background programs to run the test.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h> // for time()
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "cacheinfo.h"
+#include "measureenv.h"
+#include "numabind.h"
+#include "pagealloc.h"
+#include "perfcounters.h"
+
+// Sweep tuning
+static const int kPointsPerOctave = 2;
+static const int kTrials = 5;
+// Each trial repeats the kernel until it has moved at least this many bytes,
+// so the small working sets are not timing the clock
+static const int64_t kMinBytesPerTrial = 64 << 20;
+// Array lengths are a multiple of this many doubles, one unrolled AVX-512
+// iteration, so no kernel needs a remainder loop
+static const int64_t kElementAlign = 32;
+// Default total working set when sysfs does not describe the caches
+static const int64_t kDefaultMaxBytes = 256ll << 20;
+static const int64_t kDefaultMaxBytesCap = 1ll << 30;
+
+// We use this to make variables live by never printing them, but make sure
+// the compiler doesn't know that.
+static time_t gNeverZero = 1;
+
+// Page mode of the benchmark arenas, recorded in every row after the timings
+static const char* gPageModeName = "4k";
+
+enum Kernel {kRead = 0, kWrite, kCopy, kTriad, kNtWrite, kNtCopy, kKernelCount};
+static const char* const kKernelNames[kKernelCount] = {"read", "write", "copy", "triad", "ntwrite", "ntcopy"};
+// How many arrays each kernel streams through; all of them are counted as
+// moved bytes. Write-allocate traffic for the stored array is not counted.
+static const int kKernelArrays[kKernelCount] = {1, 1, 2, 3, 1, 2};
+
+enum Isa {kScalar = 0, kSse2, kAvx2, kAvx512, kIsaCount};
+static const char* const kIsaNames[kIsaCount] = {"scalar", "sse2", "avx2", "avx512"};
+
+// Every kernel takes the same arguments: n doubles in each array, n a multiple
+// of kElementAlign, arrays 64-byte aligned. Read returns its sum; the others
+// return a[0] so their stores stay live.
+typedef double (*KernelFn)(double* a, const double* b, const double* c, int64_t n);
+
+//----------------------------------------------------------------------------//
+// Scalar kernels. Auto-vectorization is off for these so they stay scalar at
+// -O2. Four accumulators hide the FP add latency in read.
+//----------------------------------------------------------------------------//
+
+__attribute__((noinline, optimize("no-tree-vectorize")))
+double ReadScalar(double* a, const double* b, const double* c, int64_t n) {
+  double sum0 = 0.0, sum1 = 0.0, sum2 = 0.0, sum3 = 0.0;
+  for (int64_t i = 0; i < n; i += 4) {
+    sum0 += a[i];
+    sum1 += a[i + 1];
+    sum2 += a[i + 2];
+    sum3 += a[i + 3];
+  }
+  return (sum0 + sum1) + (sum2 + sum3);
+}
+
+__attribute__((noinline, optimize("no-tree-vectorize")))
+double WriteScalar(double* a, const double* b, const double* c, int64_t n) {
+  for (int64_t i = 0; i < n; ++i) {a[i] = 1.0;}
+  return a[0];
+}
+
+__attribute__((noinline, optimize("no-tree-vectorize")))
+double CopyScalar(double* a, const double* b, const double* c, int64_t n) {
+  for (int64_t i = 0; i < n; ++i) {a[i] = b[i];}
+  return a[0];
+}
+
+__attribute__((noinline, optimize("no-tree-vectorize")))
+double TriadScalar(double* a, const double* b, const double* c, int64_t n) {
+  for (int64_t i = 0; i < n; ++i) {a[i] = b[i] + 3.0 * c[i];}
+  return a[0];
+}
+
+#if defined(__x86_64__)
+//----------------------------------------------------------------------------//
+// SSE2 kernels, 16 bytes per instruction, unrolled four times (twice in triad)
+//----------------------------------------------------------------------------//
+
+__attribute__((noinline, target("sse2")))
+double ReadSse2(double* a, const double* b, const double* c, int64_t n) {
+  __m128d sum0 = _mm_setzero_pd(), sum1 = _mm_setzero_pd();
+  __m128d sum2 = _mm_setzero_pd(), sum3 = _mm_setzero_pd();
+  for (int64_t i = 0; i < n; i += 8) {
+    sum0 = _mm_add_pd(sum0, _mm_load_pd(a + i));
+    sum1 = _mm_add_pd(sum1, _mm_load_pd(a + i + 2));
+    sum2 = _mm_add_pd(sum2, _mm_load_pd(a + i + 4));
+    sum3 = _mm_add_pd(sum3, _mm_load_pd(a + i + 6));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, _mm_add_pd(_mm_add_pd(sum0, sum1), _mm_add_pd(sum2, sum3)));
+  return lanes[0] + lanes[1];
+}
+
+__attribute__((noinline, target("sse2")))
+double WriteSse2(double* a, const double* b, const double* c, int64_t n) {
+  __m128d one = _mm_set1_pd(1.0);
+  for (int64_t i = 0; i < n; i += 8) {
+    _mm_store_pd(a + i, one);
+    _mm_store_pd(a + i + 2, one);
+    _mm_store_pd(a + i + 4, one);
+    _mm_store_pd(a + i + 6, one);
+  }
+  return a[0];
+}
+
+__attribute__((noinline, target("sse2")))
+double CopySse2(double* a, const double* b, const double* c, int64_t n) {
+  for (int64_t i = 0; i < n; i += 8) {
+    _mm_store_pd(a + i, _mm_load_pd(b + i));
+    _mm_store_pd(a + i + 2, _mm_load_pd(b + i + 2));
+    _mm_store_pd(a + i + 4, _mm_load_pd(b + i + 4));
+    _mm_store_pd(a + i + 6, _mm_load_pd(b + i + 6));
+  }
+  return a[0];
+}
+
+__attribute__((noinline, target("sse2")))
+double TriadSse2(double* a, const double* b, const double* c, int64_t n) {
+  __m128d scalar = _mm_set1_pd(3.0);
+  for (int64_t i = 0; i < n; i += 4) {
+    _mm_store_pd(a + i, _mm_add_pd(_mm_load_pd(b + i), _mm_mul_pd(scalar, _mm_load_pd(c + i))));
+    _mm_store_pd(a + i + 2, _mm_add_pd(_mm_load_pd(b + i + 2), _mm_mul_pd(scalar, _mm_load_pd(c + i + 2))));
+  }
+  return a[0];
+}
+
+//----------------------------------------------------------------------------//
+// AVX2 kernels, 32 bytes per instruction, unrolled like SSE2. Triad uses a
+// separate multiply and add, not FMA, so it runs on every AVX2 part.
+//----------------------------------------------------------------------------//
+
+__attribute__((noinline, target("avx2")))
+double ReadAvx2(double* a, const double* b, const double* c, int64_t n) {
+  __m256d sum0 = _mm256_setzero_pd(), sum1 = _mm256_setzero_pd();
+  __m256d sum2 = _mm256_setzero_pd(), sum3 = _mm256_setzero_pd();
+  for (int64_t i = 0; i < n; i += 16) {
+    sum0 = _mm256_add_pd(sum0, _mm256_load_pd(a + i));
+    sum1 = _mm256_add_pd(sum1, _mm256_load_pd(a + i + 4));
+    sum2 = _mm256_add_pd(sum2, _mm256_load_pd(a + i + 8));
+    sum3 = _mm256_add_pd(sum3, _mm256_load_pd(a + i + 12));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, _mm256_add_pd(_mm256_add_pd(sum0, sum1), _mm256_add_pd(sum2, sum3)));
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+__attribute__((noinline, target("avx2")))
+double WriteAvx2(double* a, const double* b, const double* c, int64_t n) {
+  __m256d one = _mm256_set1_pd(1.0);
+  for (int64_t i = 0; i < n; i += 16) {
+    _mm256_store_pd(a + i, one);
+    _mm256_store_pd(a + i + 4, one);
+    _mm256_store_pd(a + i + 8, one);
+    _mm256_store_pd(a + i + 12, one);
+  }
+  return a[0];
+}
+
+__attribute__((noinline, target("avx2")))
+double CopyAvx2(double* a, const double* b, const double* c, int64_t n) {
+  for (int64_t i = 0; i < n; i += 16) {
+    _mm256_store_pd(a + i, _mm256_load_pd(b + i));
+    _mm256_store_pd(a + i + 4, _mm256_load_pd(b + i + 4));
+    _mm256_store_pd(a + i + 8, _mm256_load_pd(b + i + 8));
+    _mm256_store_pd(a + i + 12, _mm256_load_pd(b + i + 12));
+  }
+  return a[0];
+}
+
+__attribute__((noinline, target("avx2")))
+double TriadAvx2(double* a, const double* b, const double* c, int64_t n) {
+  __m256d scalar = _mm256_set1_pd(3.0);
+  for (int64_t i = 0; i < n; i += 8) {
+    _mm256_store_pd(a + i, _mm256_add_pd(_mm256_load_pd(b + i),
+                                         _mm256_mul_pd(scalar, _mm256_load_pd(c + i))));
+    _mm256_store_pd(a + i + 4, _mm256_add_pd(_mm256_load_pd(b + i + 4),
+                                             _mm256_mul_pd(scalar, _mm256_load_pd(c + i + 4))));
+  }
+  return a[0];
+}
+
+//----------------------------------------------------------------------------//
+// AVX-512 kernels, 64 bytes, one full cache line, per instruction
+//----------------------------------------------------------------------------//
+
+__attribute__((noinline, target("avx512f")))
+double ReadAvx512(double* a, const double* b, const double* c, int64_t n) {
+  __m512d sum0 = _mm512_setzero_pd(), sum1 = _mm512_setzero_pd();
+  __m512d sum2 = _mm512_setzero_pd(), sum3 = _mm512_setzero_pd();
+  for (int64_t i = 0; i < n; i += 32) {
+    sum0 = _mm512_add_pd(sum0, _mm512_load_pd(a + i));
+    sum1 = _mm512_add_pd(sum1, _mm512_load_pd(a + i + 8));
+    sum2 = _mm512_add_pd(sum2, _mm512_load_pd(a + i + 16));
+    sum3 = _mm512_add_pd(sum3, _mm512_load_pd(a + i + 24));
+  }
+  return _mm512_reduce_add_pd(_mm512_add_pd(_mm512_add_pd(sum0, sum1), _mm512_add_pd(sum2, sum3)));
+}
+
+__attribute__((noinline, target("avx512f")))
+double WriteAvx512(double* a, const double* b, const double* c, int64_t n) {
+  __m512d one = _mm512_set1_pd(1.0);
+  for (int64_t i = 0; i < n; i += 32) {
+    _mm512_store_pd(a + i, one);
+    _mm512_store_pd(a + i + 8, one);
+    _mm512_store_pd(a + i + 16, one);
+    _mm512_store_pd(a + i + 24, one);
+  }
+  return a[0];
+}
+
+__attribute__((noinline, target("avx512f")))
+double CopyAvx512(double* a, const double* b, const double* c, int64_t n) {
+  for (int64_t i = 0; i < n; i += 32) {
+    _mm512_store_pd(a + i, _mm512_load_pd(b + i));
+    _mm512_store_pd(a + i + 8, _mm512_load_pd(b + i + 8));
+    _mm512_store_pd(a + i + 16, _mm512_load_pd(b + i + 16));
+    _mm512_store_pd(a + i + 24, _mm512_load_pd(b + i + 24));
+  }
+  return a[0];
+}
+
+__attribute__((noinline, target("avx512f")))
+double TriadAvx512(double* a, const double* b, const double* c, int64_t n) {
+  __m512d scalar = _mm512_set1_pd(3.0);
+  for (int64_t i = 0; i < n; i += 16) {
+    _mm512_store_pd(a + i, _mm512_add_pd(_mm512_load_pd(b + i),
+                                         _mm512_mul_pd(scalar, _mm512_load_pd(c + i))));
+    _mm512_store_pd(a + i + 8, _mm512_add_pd(_mm512_load_pd(b + i + 8),
+                                             _mm512_mul_pd(scalar, _mm512_load_pd(c + i + 8))));
+  }
+  return a[0];
+}
+
+//----------------------------------------------------------------------------//
+// Non-temporal kernels. The stores go around the caches through the write-
+// combining buffers, so a stored line is never read in first; the sfence
+// waits for the last of them before the kernel returns. The scalar versions
+// use movnti, which every x86-64 CPU has.
+//----------------------------------------------------------------------------//
+
+__attribute__((noinline, optimize("no-tree-vectorize")))
+double NtWriteScalar(double* a, const double* b, const double* c, int64_t n) {
+  long long one;
+  double value = 1.0;
+  memcpy(&one, &value, sizeof(one));
+  long long* out = reinterpret_cast<long long*>(a);
+  for (int64_t i = 0; i < n; ++i) {_mm_stream_si64(out + i, one);}
+  _mm_sfence();
+  return a[0];
+}
+
+__attribute__((noinline, optimize("no-tree-vectorize")))
+double NtCopyScalar(double* a, const double* b, const double* c, int64_t n) {
+  long long* out = reinterpret_cast<long long*>(a);
+  const long long* in = reinterpret_cast<const long long*>(b);
+  for (int64_t i = 0; i < n; ++i) {_mm_stream_si64(out + i, in[i]);}
+  _mm_sfence();
+  return a[0];
+}
+
+__attribute__((noinline, target("sse2")))
+double NtWriteSse2(double* a, const double* b, const double* c, int64_t n) {
+  __m128d one = _mm_set1_pd(1.0);
+  for (int64_t i = 0; i < n; i += 8) {
+    _mm_stream_pd(a + i, one);
+    _mm_stream_pd(a + i + 2, one);
+    _mm_stream_pd(a + i + 4, one);
+    _mm_stream_pd(a + i + 6, one);
+  }
+  _mm_sfence();
+  return a[0];
+}
+
+__attribute__((noinline, target("sse2")))
+double NtCopySse2(double* a, const double* b, const double* c, int64_t n) {
+  for (int64_t i = 0; i < n; i += 8) {
+    _mm_stream_pd(a + i, _mm_load_pd(b + i));
+    _mm_stream_pd(a + i + 2, _mm_load_pd(b + i + 2));
+    _mm_stream_pd(a + i + 4, _mm_load_pd(b + i + 4));
+    _mm_stream_pd(a + i + 6, _mm_load_pd(b + i + 6));
+  }
+  _mm_sfence();
+  return a[0];
+}
+
+__attribute__((noinline, target("avx2")))
+double NtWriteAvx2(double* a, const double* b, const double* c, int64_t n) {
+  __m256d one = _mm256_set1_pd(1.0);
+  for (int64_t i = 0; i < n; i += 16) {
+    _mm256_stream_pd(a + i, one);
+    _mm256_stream_pd(a + i + 4, one);
+    _mm256_stream_pd(a + i + 8, one);
+    _mm256_stream_pd(a + i + 12, one);
+  }
+  _mm_sfence();
+  return a[0];
+}
+
+__attribute__((noinline, target("avx2")))
+double NtCopyAvx2(double* a, const double* b, const double* c, int64_t n) {
+  for (int64_t i = 0; i < n; i += 16) {
+    _mm256_stream_pd(a + i, _mm256_load_pd(b + i));
+    _mm256_stream_pd(a + i + 4, _mm256_load_pd(b + i + 4));
+    _mm256_stream_pd(a + i + 8, _mm256_load_pd(b + i + 8));
+    _mm256_stream_pd(a + i + 12, _mm256_load_pd(b + i + 12));
+  }
+  _mm_sfence();
+  return a[0];
+}
+
+__attribute__((noinline, target("avx512f")))
+double NtWriteAvx512(double* a, const double* b, const double* c, int64_t n) {
+  __m512d one = _mm512_set1_pd(1.0);
+  for (int64_t i = 0; i < n; i += 32) {
+    _mm512_stream_pd(a + i, one);
+    _mm512_stream_pd(a + i + 8, one);
+    _mm512_stream_pd(a + i + 16, one);
+    _mm512_stream_pd(a + i + 24, one);
+  }
+  _mm_sfence();
+  return a[0];
+}
+
+__attribute__((noinline, target("avx512f")))
+double NtCopyAvx512(double* a, const double* b, const double* c, int64_t n) {
+  for (int64_t i = 0; i < n; i += 32) {
+    _mm512_stream_pd(a + i, _mm512_load_pd(b + i));
+    _mm512_stream_pd(a + i + 8, _mm512_load_pd(b + i + 8));
+    _mm512_stream_pd(a + i + 16, _mm512_load_pd(b + i + 16));
+    _mm512_stream_pd(a + i + 24, _mm512_load_pd(b + i + 24));
+  }
+  _mm_sfence();
+  return a[0];
+}
+#endif  // __x86_64__
+
+// kKernels[isa][kernel], NULL where this build has no such version
+static const KernelFn kKernels[kIsaCount][kKernelCount] = {
+#if defined(__x86_64__)
+  {ReadScalar, WriteScalar, CopyScalar, TriadScalar, NtWriteScalar, NtCopyScalar},
+  {ReadSse2, WriteSse2, CopySse2, TriadSse2, NtWriteSse2, NtCopySse2},
+  {ReadAvx2, WriteAvx2, CopyAvx2, TriadAvx2, NtWriteAvx2, NtCopyAvx2},
+  {ReadAvx512, WriteAvx512, CopyAvx512, TriadAvx512, NtWriteAvx512, NtCopyAvx512},
+#else
+  {ReadScalar, WriteScalar, CopyScalar, TriadScalar, NULL, NULL},
+  {NULL, NULL, NULL, NULL, NULL, NULL},
+  {NULL, NULL, NULL, NULL, NULL, NULL},
+  {NULL, NULL, NULL, NULL, NULL, NULL},
+#endif
+};
+
+// CPUID dispatch: can this CPU, under this OS, run the isa kernels?
+// __builtin_cpu_supports() also checks XGETBV, i.e. that the OS saves the
+// wider registers.
+bool IsaSupported(int isa) {
+  if (kKernels[isa][0] == NULL) {return false;}
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  switch (isa) {
+    case kSse2: return __builtin_cpu_supports("sse2");
+    case kAvx2: return __builtin_cpu_supports("avx2");
+    case kAvx512: return __builtin_cpu_supports("avx512f");
+  }
+#endif
+  return true;
+}
+
+// True if name is one of the comma-separated words of list, or list is "all"
+bool InList(const char* list, const char* name) {
+  if (strcmp(list, "all") == 0) {return true;}
+  size_t len = strlen(name);
+  for (const char* p = list; p != NULL; p = strchr(p, ',')) {
+    if (*p == ',') {++p;}
+    if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0')) {return true;}
+  }
+  return false;
+}
+
+// A minimal reusable spinning barrier. Waiters yield, so it still works with
+// more threads than CPUs, just slower.
+class SpinBarrier {
+ public:
+  explicit SpinBarrier(int count) : count_(count), waiting_(0), generation_(0) {}
+
+  void Wait() {
+    int generation = generation_.load(std::memory_order_acquire);
+    if (waiting_.fetch_add(1, std::memory_order_acq_rel) + 1 == count_) {
+      waiting_.store(0, std::memory_order_relaxed);
+      generation_.fetch_add(1, std::memory_order_release);
+      return;
+    }
+    while (generation_.load(std::memory_order_acquire) == generation) {
+      std::this_thread::yield();
+    }
+  }
+
+ private:
+  const int count_;
+  std::atomic<int> waiting_;
+  std::atomic<int> generation_;
+};
+
+// One timed point of the sweep: a per-thread working set, kernel and isa
+struct Point {
+  int64_t bytes;    // working set per thread
+  int kernel;
+  int isa;
+};
+
+// One measured point, kept for the per-level summary
+struct Result {
+  int64_t bytes;    // working set per thread
+  int level;        // cache level the working set fits in, 0 for memory, -1 between levels
+  int kernel;
+  int isa;
+  double gbps;
+};
+
+// Everything the workers of one thread count share
+struct Sweep {
+  int threads;
+  std::vector<Point> points;
+  std::vector<Arena> arenas;          // one per thread
+  std::vector<int> cpus;              // CPU of each thread, -1 for unpinned
+  std::vector<double> starts;         // each thread's start and stop time for
+  std::vector<double> stops;          // the current trial, in seconds
+  std::vector<Result> results;
+  const CacheInfo* caches;
+  int cache_count;
+  SpinBarrier* barrier;
+  bool fifo;                          // every thread SCHED_FIFO, see measureenv.h
+};
+
+// The cache level a per-thread working set of bytes sits comfortably in:
+// at least twice the level below it and at most half of this level's share.
+// A cache shared by several CPUs gives each of the threads running on them
+// an equal share. Returns 0 for memory, beyond twice the last level cache,
+// and -1 for the transitions in between.
+int LevelOf(int64_t bytes, int threads, const CacheInfo* caches, int cache_count) {
+  int64_t below = 0;
+  for (int i = 0; i < cache_count; ++i) {
+    int64_t share = caches[i].bytesize / std::min(threads, caches[i].sharers);
+    if (bytes <= share / 2) {return (bytes >= 2 * below) ? caches[i].level : -1;}
+    below = share;
+  }
+  return (bytes >= 2 * below) ? 0 : -1;
+}
+
+// Runs every point of the sweep on one pinned thread, in lockstep with the
+// others. Thread 0 also times and prints each point.
+void Worker(int id, Sweep* sweep) {
+  if (sweep->cpus[id] >= 0) {PinThreadToCpu(sweep->cpus[id]);}
+  SetThreadFifo(sweep->fifo);
+
+  // First touch from this thread, so the pages land on its NUMA node
+  Arena* arena = &sweep->arenas[id];
+  double* base = reinterpret_cast<double*>(arena->ptr);
+  int64_t arena_doubles = arena->bytesize / sizeof(double);
+  for (int64_t i = 0; i < arena_doubles; ++i) {base[i] = 1.0;}
+
+  // Thread 0 counts its own last trial of each point, see perfcounters.h
+  PerfGroup perf;
+  if (id == 0 && PerfGroupOpen(&perf) == 0) {
+    fprintf(stderr, "Hardware counters not available, their columns will be -\n");
+  }
+
+  double sum = 0.0;
+  for (size_t p = 0; p < sweep->points.size(); ++p) {
+    const Point& point = sweep->points[p];
+    int arrays = kKernelArrays[point.kernel];
+    int64_t n = point.bytes / arrays / sizeof(double) / kElementAlign * kElementAlign;
+    int64_t moved = n * arrays * sizeof(double);
+    int64_t passes = std::max(static_cast<int64_t>(1), kMinBytesPerTrial / moved);
+    KernelFn fn = kKernels[point.isa][point.kernel];
+    double* a = base;
+    double* b = base + n;
+    double* c = base + 2 * n;
+
+    // One untimed pass to bring the working set into the caches
+    sum += fn(a, b, c, n);
+    double best = 0.0;
+    for (int trial = 0; trial < kTrials; ++trial) {
+      sweep->barrier->Wait();
+      if (id == 0) {PerfGroupStart(&perf);}
+      auto start = std::chrono::steady_clock::now();
+      for (int64_t pass = 0; pass < passes; ++pass) {sum += fn(a, b, c, n);}
+      auto stop = std::chrono::steady_clock::now();
+      if (id == 0) {PerfGroupStop(&perf);}
+      sweep->starts[id] = std::chrono::duration<double>(start.time_since_epoch()).count();
+      sweep->stops[id] = std::chrono::duration<double>(stop.time_since_epoch()).count();
+      sweep->barrier->Wait();
+      if (id == 0) {
+        // All threads' bytes over the time from the first start to the last
+        // stop, which stays honest even with more threads than CPUs.
+        // Interference only ever slows a trial down, so keep the best one.
+        double first = *std::min_element(sweep->starts.begin(), sweep->starts.end());
+        double last = *std::max_element(sweep->stops.begin(), sweep->stops.end());
+        double gbps = static_cast<double>(moved) * passes * sweep->threads / (last - first) / 1e9;
+        best = std::max(best, gbps);
+      }
+    }
+
+    if (id == 0) {
+      char perf_columns[256];
+      PerfCsvValues(&perf, static_cast<double>(moved) * passes / 64, ", ", perf_columns, sizeof(perf_columns));
+      int level = LevelOf(point.bytes, sweep->threads, sweep->caches, sweep->cache_count);
+      std::cout << sweep->threads << ", " << point.bytes / 1024 << ", "
+                << ((level < 0) ? "-" : CacheLevelName(level)) << ", "
+                << kKernelNames[point.kernel] << ", " << kIsaNames[point.isa] << ", "
+                << best << ", " << gPageModeName << perf_columns << std::endl;
+      Result result = {point.bytes, level, point.kernel, point.isa, best};
+      sweep->results.push_back(result);
+    }
+  }
+  if (id == 0) {PerfGroupClose(&perf);}
+  if (gNeverZero == 0) {fprintf(stdout, "sum = %f\n", sum);}
+}
+
+// Prints to stderr, for each level and kernel, the median GB/s of the points
+// labelled with that level, one column per isa
+void PrintSummary(const Sweep& sweep) {
+  std::vector<int> levels;
+  for (int i = 0; i < sweep.cache_count; ++i) {levels.push_back(sweep.caches[i].level);}
+  levels.push_back(0);
+
+  for (size_t l = 0; l < levels.size(); ++l) {
+    for (int k = 0; k < kKernelCount; ++k) {
+      std::string line;
+      for (int isa = 0; isa < kIsaCount; ++isa) {
+        std::vector<double> gbps;
+        for (size_t r = 0; r < sweep.results.size(); ++r) {
+          const Result& result = sweep.results[r];
+          if (result.level == levels[l] && result.kernel == k && result.isa == isa) {
+            gbps.push_back(result.gbps);
+          }
+        }
+        if (gbps.empty()) {continue;}
+        std::sort(gbps.begin(), gbps.end());
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%s%s %.1f", line.empty() ? "" : ", ",
+                 kIsaNames[isa], gbps[gbps.size() / 2]);
+        line += buf;
+      }
+      if (line.empty()) {continue;}
+      fprintf(stderr, "%d threads, %s %s: %s GB/s\n", sweep.threads,
+              CacheLevelName(levels[l]), kKernelNames[k], line.c_str());
+    }
+  }
+}
+
+// Prints to stderr, for each isa, from which working set per thread on the
+// non-temporal kernels beat write and copy at every size: where skipping the
+// write-allocate read pays for losing the stored lines from the caches
+void PrintNtCrossover(const Sweep& sweep) {
+  const int pairs[2][2] = {{kWrite, kNtWrite}, {kCopy, kNtCopy}};
+  for (int isa = 0; isa < kIsaCount; ++isa) {
+    for (int p = 0; p < 2; ++p) {
+      // The sizes of the regular kernel, ascending, against the nt ones
+      std::vector<int64_t> sizes;
+      std::vector<double> regular;
+      std::vector<double> nt;
+      for (size_t r = 0; r < sweep.results.size(); ++r) {
+        const Result& result = sweep.results[r];
+        if (result.isa != isa || result.kernel != pairs[p][0]) {continue;}
+        for (size_t q = 0; q < sweep.results.size(); ++q) {
+          const Result& other = sweep.results[q];
+          if (other.isa == isa && other.kernel == pairs[p][1] && other.bytes == result.bytes) {
+            sizes.push_back(result.bytes);
+            regular.push_back(result.gbps);
+            nt.push_back(other.gbps);
+          }
+        }
+      }
+      if (sizes.empty()) {continue;}
+      size_t from = sizes.size();
+      while (from > 0 && nt[from - 1] >= regular[from - 1]) {--from;}
+      if (from == sizes.size()) {
+        fprintf(stderr, "%d threads, %s %s: never faster than %s, up to %lld KB per thread\n", sweep.threads,
+                kIsaNames[isa], kKernelNames[pairs[p][1]], kKernelNames[pairs[p][0]],
+                static_cast<long long>(sizes.back() / 1024));
+      } else {
+        fprintf(stderr, "%d threads, %s %s: faster than %s from %lld KB per thread, %.1f against %.1f GB/s at "
+                "%lld KB\n", sweep.threads, kIsaNames[isa], kKernelNames[pairs[p][1]], kKernelNames[pairs[p][0]],
+                static_cast<long long>(sizes[from] / 1024), nt.back(), regular.back(),
+                static_cast<long long>(sizes.back() / 1024));
+      }
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  double min_size_kb = 4.0;
+  double max_size_mb = 0.0;   // 0 means pick from the cache sizes
+  std::string thread_list;
+  const char* kernel_list = "all";
+  const char* isa_list = "all";
+  int page_mode = PAGE_MODE_4K;
+  MeasureEnv env;
+  InitMeasureEnv(&env);
+
+  for (int i = 1; i < argc; ++i) {
+    if (std::strncmp(argv[i], "--min_size=", 11) == 0) {
+      min_size_kb = std::atof(argv[i] + 11);
+    } else if (std::strncmp(argv[i], "--max_size=", 11) == 0) {
+      max_size_mb = std::atof(argv[i] + 11);
+    } else if (std::strncmp(argv[i], "--threads=", 10) == 0) {
+      thread_list = argv[i] + 10;
+    } else if (std::strncmp(argv[i], "--kernel=", 9) == 0) {
+      kernel_list = argv[i] + 9;
+    } else if (std::strncmp(argv[i], "--isa=", 6) == 0) {
+      isa_list = argv[i] + 6;
+    } else if (std::strncmp(argv[i], "--page_mode=", 12) == 0) {
+      page_mode = ParsePageMode(argv[i] + 12);
+      if (page_mode < 0) {
+        fprintf(stderr, "Unknown --page_mode, use 4k, thp, 2m or 1g\n");
+        return 1;
+      }
+    } else {
+      ParseMeasureEnvFlag(&env, argv[i]);
+    }
+  }
+  gNeverZero = time(NULL);
+  SetupMeasureEnv(&env);
+
+  CacheInfo caches[CACHE_MAX_LEVELS];
+  int cache_count = ReadCacheInfo(caches, CACHE_MAX_LEVELS);
+  // By default the total working set goes to 4x the last level cache
+  int64_t max_bytes = kDefaultMaxBytes;
+  if (max_size_mb > 0.0) {
+    max_bytes = static_cast<int64_t>(max_size_mb * 1024 * 1024);
+  } else if (cache_count > 0) {
+    max_bytes = std::min(4 * caches[cache_count - 1].bytesize, kDefaultMaxBytesCap);
+  }
+
+  // The CPUs we may run on, in order, or those --pin_cpu lists; thread i is
+  // pinned to the i-th
+  std::vector<int> cpus(env.cpus, env.cpus + env.cpu_count);
+#ifdef __linux__
+  cpu_set_t allowed;
+  if (cpus.empty() && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &allowed)) {cpus.push_back(cpu);}
+    }
+  }
+#endif
+  int cpu_count = cpus.empty() ? static_cast<int>(std::thread::hardware_concurrency()) : cpus.size();
+  cpu_count = std::max(cpu_count, 1);
+
+  // Default thread counts: powers of two up to every CPU, and every CPU
+  std::vector<int> thread_counts;
+  if (thread_list.empty()) {
+    for (int t = 1; t < cpu_count; t *= 2) {thread_counts.push_back(t);}
+    thread_counts.push_back(cpu_count);
+  } else {
+    for (const char* p = thread_list.c_str(); p != NULL; p = strchr(p, ',')) {
+      if (*p == ',') {++p;}
+      int t = std::atoi(p);
+      if (t > 0) {thread_counts.push_back(t);}
+    }
+  }
+
+  std::vector<int> isas;
+  for (int isa = 0; isa < kIsaCount; ++isa) {
+    if (!InList(isa_list, kIsaNames[isa])) {continue;}
+    if (!IsaSupported(isa)) {
+      fprintf(stderr, "%s not supported on this CPU, skipping it\n", kIsaNames[isa]);
+      continue;
+    }
+    isas.push_back(isa);
+  }
+  std::vector<int> kernels;
+  for (int k = 0; k < kKernelCount; ++k) {
+    if (InList(kernel_list, kKernelNames[k])) {kernels.push_back(k);}
+  }
+  if (isas.empty() || kernels.empty()) {
+    fprintf(stderr, "Nothing to run, check --kernel= and --isa=\n");
+    return 1;
+  }
+
+  char perf_header[256];
+  PerfCsvHeader(", ", perf_header, sizeof(perf_header));
+  std::cout << "threads, size_kb, level, kernel, isa, gbps, page_mode" << perf_header << std::endl;
+  for (size_t t = 0; t < thread_counts.size(); ++t) {
+    int threads = thread_counts[t];
+    if (threads > cpu_count) {
+      fprintf(stderr, "%d threads share %d CPUs, the threads will take turns\n", threads, cpu_count);
+    }
+    int64_t per_thread = max_bytes / threads;
+
+    Sweep sweep;
+    sweep.threads = threads;
+    sweep.caches = caches;
+    sweep.cache_count = cache_count;
+    double step = pow(2.0, 1.0 / kPointsPerOctave);
+    for (double bytes = min_size_kb * 1024; bytes <= per_thread * 1.0001; bytes *= step) {
+      for (size_t k = 0; k < kernels.size(); ++k) {
+        for (size_t i = 0; i < isas.size(); ++i) {
+          Point point = {static_cast<int64_t>(bytes), kernels[k], isas[i]};
+          // Too small to hold one aligned chunk per array, or no such version
+          if (point.bytes < kKernelArrays[point.kernel] * kElementAlign * 8) {continue;}
+          if (kKernels[point.isa][point.kernel] == NULL) {continue;}
+          sweep.points.push_back(point);
+        }
+      }
+    }
+
+    sweep.arenas.resize(threads);
+    bool allocated = true;
+    for (int i = 0; i < threads; ++i) {
+      if (AllocArena(&sweep.arenas[i], per_thread, page_mode) != 0) {
+        fprintf(stderr, "Could not allocate %lld bytes\n", static_cast<long long>(per_thread));
+        allocated = false;
+        break;
+      }
+      gPageModeName = PageModeName(sweep.arenas[i].mode);
+    }
+    if (!allocated) {return 1;}
+    for (int i = 0; i < threads; ++i) {
+      sweep.cpus.push_back((i < static_cast<int>(cpus.size())) ? cpus[i] : -1);
+    }
+    sweep.starts.assign(threads, 0.0);
+    sweep.stops.assign(threads, 0.0);
+    SpinBarrier barrier(threads);
+    // FIFO threads spinning at the barrier would starve the ones sharing
+    // their CPU, so with more threads than CPUs all of them run normal
+    sweep.fifo = env.fifo && threads <= cpu_count;
+    sweep.barrier = &barrier;
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threads; ++i) {workers.push_back(std::thread(Worker, i, &sweep));}
+    Worker(0, &sweep);
+    for (size_t i = 0; i < workers.size(); ++i) {workers[i].join();}
+
+    PrintSummary(sweep);
+    PrintNtCrossover(sweep);
+    for (int i = 0; i < threads; ++i) {FreeArena(&sweep.arenas[i]);}
+  }
+  return 0;
+}
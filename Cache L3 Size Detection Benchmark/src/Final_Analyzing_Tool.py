@@ -1,5 +1,6 @@
 #!/usr/bin/env python3
 import csv
+import glob
 import matplotlib.pyplot as plt
 import numpy as np
 import pandas as pd
@@ -13,12 +14,47 @@ from datetime import datetime
 # Get the current timestamp for the file name
 timestamp = datetime.now().strftime('%Y-%m-%d_%H-%M-%S')
 
-def cache_L3size_output_obtain_maximum(cache_line_size=64):
-    cmd = ["./cachesize_maximum", f"--cache_line_size={cache_line_size}"]
+# The size of the last level cache in MB as sysfs reports it, or None
+def reported_llc_size():
+    size_mb = None
+    level = 0
+    for index in glob.glob('/sys/devices/system/cpu/cpu0/cache/index*'):
+        try:
+            with open(index + '/type') as f:
+                if f.read().strip() == 'Instruction':
+                    continue
+            with open(index + '/level') as f:
+                index_level = int(f.read())
+            with open(index + '/size') as f:
+                text = f.read().strip()
+        except (OSError, ValueError):
+            continue
+        scale = {'K': 1.0 / 1024, 'M': 1.0, 'G': 1024.0}.get(text[-1:], 1.0 / 1048576)
+        if index_level > level:
+            level = index_level
+            size_mb = float(text.rstrip('KMG')) * scale
+    return size_mb
+
+# Times only the window around the reported LLC size. Returns True if the
+# benchmark found the LLC ending inside it.
+def cache_L3size_verify(cache_line_size, page_mode='4k'):
+    cmd = ["./cachesize_estimated", "--sweep=verify", f"--cache_line_size={cache_line_size}", f"--page_mode={page_mode}"]
+    filename = f'cache_L3size_benchmark_data_verify_{timestamp}.csv'
+    print("Running L3 Cache Size Verification. Should take a few minutes: ")
+    with open(filename, 'w', newline='') as csvfile:
+        process = subprocess.run(cmd, stdout=csvfile, stderr=subprocess.PIPE, text=True)
+    print(process.stderr)
+    return process.returncode == 0
+
+def cache_L3size_output_obtain_maximum(cache_line_size=64, page_mode='4k', full=False):
+    cmd = ["./cachesize_maximum", f"--cache_line_size={cache_line_size}", f"--page_mode={page_mode}"]
     filename = f'cache_L3size_benchmark_data_maximum_{timestamp}.csv'
     
-    process = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
-    print("Running Maximum Cache Size Detection Benchmark. Should take 10-20 minutes: ")
+    process = subprocess.Popen(cmd + (["--full"] if full else []), stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+    if full:
+        print("Running Maximum Cache Size Detection Benchmark. Should take 10-20 minutes: ")
+    else:
+        print("Running Maximum Cache Size Detection Benchmark around the reported size. Should take a few minutes: ")
  
     with open(filename, 'w', newline='') as csvfile:
         while True:
@@ -33,12 +69,15 @@ def cache_L3size_output_obtain_maximum(cache_line_size=64):
     process.wait()
     return pd.read_csv(filename)
 
-def cache_L3size_output_obtain_estimated(cache_line_size, max_cache_size):
-    cmd = ["./cachesize_estimated", f"--cache_line_size={cache_line_size}", f"--max_cache_size={max_cache_size}"]
+def cache_L3size_output_obtain_estimated(cache_line_size, max_cache_size, adaptive=False, page_mode='4k'):
+    cmd = ["./cachesize_estimated", f"--cache_line_size={cache_line_size}", f"--max_cache_size={max_cache_size}", f"--page_mode={page_mode}"]
     filename = f'cache_L3size_benchmark_data_estimated_{timestamp}.csv'
     
-    process = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
-    print("Running L3 Cache Size Detection Benchmark. Should take 30 mins - 2 hours: ")
+    process = subprocess.Popen(cmd + (["--sweep=adaptive"] if adaptive else []), stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+    if adaptive:
+        print("Running L3 Cache Size Detection Benchmark (adaptive sweep). Should take a few minutes: ")
+    else:
+        print("Running L3 Cache Size Detection Benchmark. Should take 30 mins - 2 hours: ")
  
     with open(filename, 'w', newline='') as csvfile:
         while True:
@@ -59,7 +98,8 @@ def get_data(file_name):
         data_dict = {}
         for row in reader:
             size = float(row[0].split(' ')[0])
-            number_interested = [int(val) for val in row[1:] if val != ''] 
+            # Four timings per row, the page mode and any later columns are not timings
+            number_interested = [int(val) for val in row[1:5] if val != ''] 
             if size in data_dict:
                 data_dict[size].extend(number_interested)
             else:
@@ -67,7 +107,8 @@ def get_data(file_name):
     x = []
     y_mean = []
     y_median = []
-    for size, values in data_dict.items():
+    # The adaptive sweep revisits sizes out of order, so sort by size
+    for size, values in sorted(data_dict.items()):
         x.append(size)
         values_array = np.array(values)
         y_mean.append(np.mean(values_array))
@@ -136,10 +177,25 @@ if __name__ == '__main__':
     if not cache_line_size:
         cache_line_size = 64
 
+    page_mode = input("Please enter the page size for the benchmark memory, 4k, thp, 2m or 1g (default is 4k): ")
+    if not page_mode:
+        page_mode = '4k'
+
+    # With a reported size, a short sweep around it is often all that is needed
+    llc_size = reported_llc_size()
+    if llc_size is not None:
+        print(f"The system reports a last level cache of {llc_size:g} MB.")
+        verify = input("Verify it with a quick sweep around that size instead of the full sweep? (Y/N): ")
+        if verify.lower() == 'y':
+            if cache_L3size_verify(int(cache_line_size), page_mode):
+                raise SystemExit(0)
+            print("The reported size did not hold, continuing with the full sweep.")
+            llc_size = None
+
     knows_max_cache_size = input("Do you know how big your biggest cache size is? (Y/N): ")
 
     if knows_max_cache_size.lower() == 'n':
-        output = cache_L3size_output_obtain_maximum(int(cache_line_size))
+        output = cache_L3size_output_obtain_maximum(int(cache_line_size), page_mode, llc_size is None)
         file_name = f'cache_L3size_benchmark_data_maximum_{timestamp}.csv'
 
         window_size = 5
@@ -168,13 +224,19 @@ if __name__ == '__main__':
         print("Based on the SG smoothing with Kneedle Algorithm, your biggest Cache Size should not exceed: ", max_cache_size)
 
     else:
-        max_cache_size = input("Please enter the max cache size in MB: ")
-        if not max_cache_size:
+        if llc_size is not None:
+            max_cache_size = input(f"Please enter the max cache size in MB (default is the reported {llc_size:g}): ")
+        else:
+            max_cache_size = input("Please enter the max cache size in MB: ")
+        if not max_cache_size and llc_size is not None:
+            max_cache_size = llc_size*7/6
+        elif not max_cache_size:
             max_cache_size = 32
         else:
             max_cache_size = float(max_cache_size)*7/6
 
-    output = cache_L3size_output_obtain_estimated(int(cache_line_size), float(max_cache_size))
+    adaptive_sweep = input("Use the adaptive sweep, which takes minutes instead of hours? (Y/N): ")
+    output = cache_L3size_output_obtain_estimated(int(cache_line_size), float(max_cache_size), adaptive_sweep.lower() == 'y', page_mode)
     file_name = f'cache_L3size_benchmark_data_estimated_{timestamp}.csv'
     piecewise_segments_number = 6
     window_size = 5
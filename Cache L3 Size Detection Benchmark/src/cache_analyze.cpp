@@ -0,0 +1,87 @@
+/*
+ * Native analysis of the L3 cache size benchmarks, replacing the pwlf, kneed,
+ * scipy and sklearn steps of Final_Analyzing_Tool.py. Reads the csv rows of
+ * cachesize_maximum or cachesize_estimated from a file, or from stdin so the
+ * benchmark can be piped straight in:
+ *
+ *   ./cachesize_maximum | ./cache_analyze --data=maximum
+ *   ./cachesize_estimated --sweep=adaptive --max_cache_size=28 | ./cache_analyze
+ *
+ * For maximum data, prints the knee of the Savitzky-Golay smoothed mean
+ * curve, the largest the cache can be. For estimated data, prints the L3 size
+ * interval from the last breakpoint of a segmented regression, on the raw
+ * medians and on the KNN smoothed medians, as the Python tool does.
+ *
+ * Copyright (c) 2024 Christ Lin
+ *
+ * Modifications were made by the Laboratory for Physical Science (LPS) team
+ * from the Applied Methods and Research Experience (AMRE) program, 2024.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cstring>
+#include <string>
+
+#include "cacheanalysis.h"
+
+// Print the L3 size interval in MB, the last breakpoint plus and minus 1MB
+void PrintL3Interval(const std::vector<double>& x, const std::vector<double>& y, int segments) {
+  SegmentFit fit = SegmentedRegression(x, y, segments);
+  if (fit.breakpoints.empty()) {
+    printf("Not enough data for %d segments\n", segments);
+    return;
+  }
+  double breakpoint_mb = fit.breakpoints.back() / 1024;
+  printf("Your total cache size based on the piecewise regression is within the interval in MB: [%.2f, %.2f]\n",
+         breakpoint_mb - 1, breakpoint_mb + 1);
+}
+
+int main(int argc, char* argv[]) {
+  bool maximum = false;
+  int segments = 6;
+  int window_size = 5;
+  const char* filename = NULL;
+
+  for (int i = 1; i < argc; ++i) {
+    if (std::strncmp(argv[i], "--data=", 7) == 0) {
+      // "estimated" (default) for cachesize_estimated, "maximum" for cachesize_maximum
+      maximum = (std::strcmp(argv[i] + 7, "maximum") == 0);
+    } else if (std::strncmp(argv[i], "--segments=", 11) == 0) {
+      segments = std::atoi(argv[i] + 11);
+    } else if (std::strncmp(argv[i], "--window_size=", 14) == 0) {
+      window_size = std::atoi(argv[i] + 14);
+    } else {
+      filename = argv[i];
+    }
+  }
+
+  FILE* f = (filename == NULL) ? stdin : fopen(filename, "r");
+  if (f == NULL) {
+    fprintf(stderr, "Could not open %s\n", filename);
+    return 1;
+  }
+  SweepData data = ReadSweepCsv(f);
+  if (f != stdin) {fclose(f);}
+  if (data.size.empty()) {
+    fprintf(stderr, "No benchmark rows found\n");
+    return 1;
+  }
+
+  if (maximum) {
+    std::vector<double> smooth = SavitzkyGolay(data.mean, window_size, 3);
+    double knee;
+    if (!FindKnee(data.size, smooth, 1.0, &knee)) {
+      printf("No knee found in the maximum cache size data\n");
+      return 1;
+    }
+    printf("Based on the SG smoothing with the Kneedle Algorithm, your biggest Cache Size should not exceed:  %g\n", knee);
+    return 0;
+  }
+
+  printf("Raw Data:\n");
+  PrintL3Interval(data.size, data.median, segments);
+  printf("Denoising Method KNN :\n");
+  PrintL3Interval(data.size, KnnSmooth(data.size, data.median, window_size), segments);
+  return 0;
+}
@@ -0,0 +1,323 @@
+// cacheanalysis.h
+//
+// Analysis of the cache size sweeps: the same pipeline as
+// Final_Analyzing_Tool.py, without Python. Reads the csv rows the benchmarks
+// print, smooths them with Savitzky-Golay or k-nearest-neighbours filters,
+// finds the knee of the curve with the Kneedle algorithm, and fits an exact
+// segmented linear regression by dynamic programming. Used by cache_analyze.
+
+#ifndef __CACHEANALYSIS_H__
+#define __CACHEANALYSIS_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <vector>
+
+// One sweep, grouped by data size as in get_data() of the Python tool
+struct SweepData {
+  std::vector<double> size;     // data size, KB for cachesize_estimated, MB for cachesize_maximum
+  std::vector<double> mean;     // mean cycles per load at that size
+  std::vector<double> median;   // median cycles per load at that size
+};
+
+// Read the csv rows of a sweep: the size, then four cycles-per-load readings.
+// Later columns (page mode, ...) are ignored, as are lines that do not start
+// with a number. Readings of the same size are pooled, and the result is
+// sorted by size.
+inline SweepData ReadSweepCsv(FILE* f) {
+  std::map<double, std::vector<double> > readings;
+  char line[1024];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    char* field = strtok(line, ",");
+    char* end = NULL;
+    if (field == NULL) {continue;}
+    double size = strtod(field, &end);
+    if (end == field) {continue;}
+    for (int i = 0; i < 4; ++i) {
+      field = strtok(NULL, ",");
+      if (field == NULL) {break;}
+      double value = strtod(field, &end);
+      if (end == field) {break;}
+      readings[size].push_back(value);
+    }
+  }
+
+  SweepData data;
+  for (std::map<double, std::vector<double> >::iterator it = readings.begin(); it != readings.end(); ++it) {
+    std::vector<double>& values = it->second;
+    if (values.empty()) {continue;}
+    double sum = 0.0;
+    for (size_t i = 0; i < values.size(); ++i) {sum += values[i];}
+    std::sort(values.begin(), values.end());
+    size_t half = values.size() / 2;
+    double median = (values.size() % 2) ? values[half] : (values[half - 1] + values[half]) / 2.0;
+    data.size.push_back(it->first);
+    data.mean.push_back(sum / values.size());
+    data.median.push_back(median);
+  }
+  return data;
+}
+
+// Least-squares polynomial of the given order through y[0..count), sampled at
+// 0, 1, 2, ..., evaluated at position at
+inline double PolyFitAt(const double* y, int count, int order, double at) {
+  int terms = order + 1;
+  double center = (count - 1) / 2.0;
+  // Normal equations, augmented with the right-hand side
+  std::vector<std::vector<double> > a(terms, std::vector<double>(terms + 1, 0.0));
+  for (int k = 0; k < count; ++k) {
+    double t = k - center;
+    std::vector<double> powers(2 * terms, 1.0);
+    for (int p = 1; p < 2 * terms; ++p) {powers[p] = powers[p - 1] * t;}
+    for (int r = 0; r < terms; ++r) {
+      for (int c = 0; c < terms; ++c) {a[r][c] += powers[r + c];}
+      a[r][terms] += powers[r] * y[k];
+    }
+  }
+  // Gaussian elimination with partial pivoting
+  for (int c = 0; c < terms; ++c) {
+    int pivot = c;
+    for (int r = c + 1; r < terms; ++r) {
+      if (fabs(a[r][c]) > fabs(a[pivot][c])) {pivot = r;}
+    }
+    std::swap(a[c], a[pivot]);
+    if (a[c][c] == 0.0) {continue;}
+    for (int r = 0; r < terms; ++r) {
+      if (r == c) {continue;}
+      double factor = a[r][c] / a[c][c];
+      for (int k = c; k <= terms; ++k) {a[r][k] -= factor * a[c][k];}
+    }
+  }
+  double value = 0.0;
+  double tpower = 1.0;
+  for (int c = 0; c < terms; ++c) {
+    if (a[c][c] != 0.0) {value += a[c][terms] / a[c][c] * tpower;}
+    tpower *= at - center;
+  }
+  return value;
+}
+
+// Savitzky-Golay filter, as scipy.signal.savgol_filter(y, window, order) with
+// its default mode="interp": each interior point is replaced by the
+// polynomial fit over the window centred on it, and the first and last
+// window / 2 points by the fit over the first and last full window. Like
+// scipy, treats the samples as evenly spaced. window must be odd.
+inline std::vector<double> SavitzkyGolay(const std::vector<double>& y, int window, int order) {
+  int n = y.size();
+  if (n < window || window <= order) {return y;}
+  int half = window / 2;
+  std::vector<double> smooth(n);
+  for (int i = 0; i < n; ++i) {
+    if (i < half) {
+      smooth[i] = PolyFitAt(&y[0], window, order, i);
+    } else if (i >= n - half) {
+      smooth[i] = PolyFitAt(&y[n - window], window, order, i - (n - window));
+    } else {
+      smooth[i] = PolyFitAt(&y[i - half], window, order, half);
+    }
+  }
+  return smooth;
+}
+
+// K-nearest-neighbours smoothing, as sklearn's KNeighborsRegressor(k) with
+// uniform weights fitted on (x, y) and predicting at x: each point becomes the
+// mean y of the k points nearest to it in x, itself included
+inline std::vector<double> KnnSmooth(const std::vector<double>& x, const std::vector<double>& y, int k) {
+  int n = x.size();
+  k = std::min(k, n);
+  std::vector<double> smooth(n);
+  for (int i = 0; i < n; ++i) {
+    // x is sorted, so the k nearest form a window around i
+    int lo = i;
+    int hi = i + 1;
+    while (hi - lo < k) {
+      if (lo == 0) {
+        ++hi;
+      } else if (hi == n) {
+        --lo;
+      } else if (x[i] - x[lo - 1] <= x[hi] - x[i]) {
+        --lo;
+      } else {
+        ++hi;
+      }
+    }
+    double sum = 0.0;
+    for (int j = lo; j < hi; ++j) {sum += y[j];}
+    smooth[i] = sum / k;
+  }
+  return smooth;
+}
+
+// Kneedle knee detection for a concave, increasing curve, as
+// kneed.KneeLocator(x, y, S, curve="concave", direction="increasing").
+// Normalizes both axes to [0, 1] and takes the difference curve y - x. Each
+// local maximum of the difference curve sets a threshold of its height minus
+// S times the mean x step; the knee is the first maximum after which the
+// difference curve falls below its threshold before the next maximum.
+// Returns false if there is no knee.
+inline bool FindKnee(const std::vector<double>& x, const std::vector<double>& y, double sensitivity,
+                     double* knee) {
+  int n = x.size();
+  if (n < 3) {return false;}
+  double xmin = *std::min_element(x.begin(), x.end());
+  double xmax = *std::max_element(x.begin(), x.end());
+  double ymin = *std::min_element(y.begin(), y.end());
+  double ymax = *std::max_element(y.begin(), y.end());
+  if (xmax == xmin || ymax == ymin) {return false;}
+
+  std::vector<double> xnorm(n);
+  std::vector<double> diff(n);
+  for (int i = 0; i < n; ++i) {
+    xnorm[i] = (x[i] - xmin) / (xmax - xmin);
+    diff[i] = (y[i] - ymin) / (ymax - ymin) - xnorm[i];
+  }
+  double mean_step = fabs(xnorm[n - 1] - xnorm[0]) / (n - 1);
+
+  // Local maxima and minima, counting ties, with the ends compared to
+  // themselves as scipy's argrelextrema(mode="clip") does
+  std::vector<bool> is_max(n);
+  std::vector<bool> is_min(n);
+  for (int i = 0; i < n; ++i) {
+    double left = diff[std::max(0, i - 1)];
+    double right = diff[std::min(n - 1, i + 1)];
+    is_max[i] = diff[i] >= left && diff[i] >= right;
+    is_min[i] = diff[i] <= left && diff[i] <= right;
+  }
+
+  bool started = false;
+  double threshold = 0.0;
+  int threshold_index = 0;
+  for (int i = 0; i + 1 < n; ++i) {
+    if (!started && !is_max[i]) {continue;}
+    started = true;
+    if (is_max[i]) {
+      threshold = diff[i] - sensitivity * mean_step;
+      threshold_index = i;
+    }
+    if (is_min[i]) {threshold = 0.0;}
+    if (diff[i + 1] < threshold) {
+      *knee = x[threshold_index];
+      return true;
+    }
+  }
+  return false;
+}
+
+// Prefix sums for least-squares lines through any range of points, with x
+// centred for numerical stability
+struct LineSums {
+  double xcenter;
+  std::vector<double> sx, sy, sxx, sxy, syy;
+
+  LineSums(const std::vector<double>& x, const std::vector<double>& y) {
+    int n = x.size();
+    xcenter = 0.0;
+    for (int i = 0; i < n; ++i) {xcenter += x[i] / n;}
+    sx.assign(n + 1, 0.0);
+    sy.assign(n + 1, 0.0);
+    sxx.assign(n + 1, 0.0);
+    sxy.assign(n + 1, 0.0);
+    syy.assign(n + 1, 0.0);
+    for (int i = 0; i < n; ++i) {
+      double xc = x[i] - xcenter;
+      sx[i + 1] = sx[i] + xc;
+      sy[i + 1] = sy[i] + y[i];
+      sxx[i + 1] = sxx[i] + xc * xc;
+      sxy[i + 1] = sxy[i] + xc * y[i];
+      syy[i + 1] = syy[i] + y[i] * y[i];
+    }
+  }
+
+  // Squared error of the best line through points [i, j)
+  double Error(int i, int j) const {
+    double m = j - i;
+    double mx = sx[j] - sx[i];
+    double my = sy[j] - sy[i];
+    double varx = (sxx[j] - sxx[i]) - mx * mx / m;
+    double cov = (sxy[j] - sxy[i]) - mx * my / m;
+    double vary = (syy[j] - syy[i]) - my * my / m;
+    return (varx > 0.0) ? vary - cov * cov / varx : vary;
+  }
+
+  // Best line through points [i, j), against centred x, and its squared error
+  void Fit(int i, int j, double* slope, double* intercept, double* sse) const {
+    double m = j - i;
+    double mx = sx[j] - sx[i];
+    double my = sy[j] - sy[i];
+    double varx = (sxx[j] - sxx[i]) - mx * mx / m;
+    double cov = (sxy[j] - sxy[i]) - mx * my / m;
+    double vary = (syy[j] - syy[i]) - my * my / m;
+    *slope = (varx > 0.0) ? cov / varx : 0.0;
+    *intercept = (my - *slope * mx) / m;
+    *sse = std::max(0.0, (varx > 0.0) ? vary - cov * cov / varx : vary);
+  }
+};
+
+// Result of SegmentedRegression()
+struct SegmentFit {
+  std::vector<int> starts;            // index of the first point of each segment
+  std::vector<double> breakpoints;    // x between consecutive segments
+  std::vector<double> slope;          // per segment
+  std::vector<double> intercept;      // per segment
+  double sse;                         // total squared error
+};
+
+// Exact segmented linear regression: splits the points, sorted by x, into
+// the given number of segments of at least two points, with a separate
+// least-squares line through each, minimizing the total squared error. Dynamic
+// programming over the segment ends finds the global optimum in
+// O(segments * n^2), where pwlf searches for it with a randomized global
+// optimizer. A breakpoint is reported halfway between the last point of one
+// segment and the first point of the next.
+inline SegmentFit SegmentedRegression(const std::vector<double>& x, const std::vector<double>& y, int segments) {
+  int n = x.size();
+  SegmentFit fit;
+  fit.sse = 0.0;
+  segments = std::min(segments, n / 2);
+  if (segments < 1) {return fit;}
+
+  LineSums line(x, y);
+
+  // cost[s][j]: best error of the first j points in s + 1 segments, the last
+  // of which starts at from[s][j]
+  const double kInfinity = HUGE_VAL;
+  std::vector<std::vector<double> > cost(segments, std::vector<double>(n + 1, kInfinity));
+  std::vector<std::vector<int> > from(segments, std::vector<int>(n + 1, 0));
+  for (int j = 2; j <= n; ++j) {
+    cost[0][j] = line.Error(0, j);
+  }
+  for (int s = 1; s < segments; ++s) {
+    for (int j = 2 * (s + 1); j <= n; ++j) {
+      for (int i = 2 * s; i <= j - 2; ++i) {
+        double total = cost[s - 1][i] + line.Error(i, j);
+        if (total < cost[s][j]) {
+          cost[s][j] = total;
+          from[s][j] = i;
+        }
+      }
+    }
+  }
+
+  fit.sse = cost[segments - 1][n];
+  fit.starts.resize(segments);
+  int j = n;
+  for (int s = segments - 1; s >= 0; --s) {
+    fit.starts[s] = (s == 0) ? 0 : from[s][j];
+    j = fit.starts[s];
+  }
+  double slope, intercept, sse;
+  for (int s = 0; s < segments; ++s) {
+    int end = (s + 1 < segments) ? fit.starts[s + 1] : n;
+    line.Fit(fit.starts[s], end, &slope, &intercept, &sse);
+    fit.slope.push_back(slope);
+    fit.intercept.push_back(intercept - slope * line.xcenter);
+    if (s > 0) {fit.breakpoints.push_back((x[fit.starts[s] - 1] + x[fit.starts[s]]) / 2.0);}
+  }
+  return fit;
+}
+
+#endif	// __CACHEANALYSIS_H__
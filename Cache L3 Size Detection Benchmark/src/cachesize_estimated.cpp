@@ -22,160 +22,270 @@
 #include <iostream>
 #include <cstring>
 #include <cstdlib>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <vector>
 
 #include "basetypes.h"
+#include "cacheinfo.h"
+#include "measureenv.h"
+#include "numabind.h"
+#include "pagealloc.h"
+#include "pairlist.h"
+#include "perfcounters.h"
+#include "plateaus.h"
 #include "polynomial.h"
+#include "sampling.h"
+#include "threadscaling.h"
 #include "timecounters.h"
 
-// We use a couple of fast pseudo-random generators that are based on standard 
-// cyclic reduncy check arithmetic. Look in Wikipedia for more information on 
-// CRC calculations.
-//
-// The particular CRC style we use is a left shift by one bit, followed by an 
-// XOR of a specific CRC bit pattern if the bit shifted out is 1. This mimics
-// long-used hardware that feeds back the top bit to XOR taps at specific 
-// places in a shift register. Our use here is just to get a bunch of non-zero 
-// bit patterns that have poor correlation from one to the next.
-//
-// Rather than the simple 
-//  if (highbit is 1)
-//    x = (x << 1) ^ bit_pattern
-//  else
-//    x = (x << 1)
-//
-// we make this calculation branch-free and therefore fast by ANDing the bit
-// pattern against either 00000... or 11111..., depending on the value of the
-// high bit. This is accomplished by an arithmetic right shift that sign-
-// extends the input value. The entire expansion is four inline instrucitons:
-// shift, shift, and, xor.
-// 
-
-// x must be of type uint8
-// #define POLY8 (0x1d)   // From CRC-8-SAE J1850
-// #define POLYSHIFT8(x) ( ((x) << 1) ^ ((static_cast<int8>((x)) >> 7) & POLY8) )
-// #define POLYINIT8 (0xffu)
-
-// POLY8 is a crc-based calculation that cycles through 255 byte values,
-// excluding zero so long as the initial value is non-zero. If the initial
-// value is zero, it cycles at zero every time.
-//
-// Here are the values if started at POLYINIT8 = 0xff
-//   ff e3 db ab 4b 96 31 62 c4 95 37 6e dc a5 57 ae 
-//   41 82 19 32 64 c8 8d 07 0e 1c 38 70 e0 dd a7 53 
-//   a6 51 a2 59 b2 79 f2 f9 ef c3 9b 2b 56 ac 45 8a 
-//   09 12 24 48 90 3d 7a f4 f5 f7 f3 fb eb cb 8b 0b 
-//   16 2c 58 b0 7d fa e9 cf 83 1b 36 6c d8 ad 47 8e 
-//   01 02 04 08 10 20 40 80 1d 3a 74 e8 cd 87 13 26 
-//   4c 98 2d 5a b4 75 ea c9 8f 03 06 0c 18 30 60 c0 
-//   9d 27 4e 9c 25 4a 94 35 6a d4 b5 77 ee c1 9f 23 
-//   46 8c 05 0a 14 28 50 a0 5d ba 69 d2 b9 6f de a1 
-//   5f be 61 c2 99 2f 5e bc 65 ca 89 0f 1e 3c 78 f0 
-//   fd e7 d3 bb 6b d6 b1 7f fe e1 df a3 5b b6 71 e2 
-//   d9 af 43 86 11 22 44 88 0d 1a 34 68 d0 bd 67 ce 
-//   81 1f 3e 7c f8 ed c7 93 3b 76 ec c5 97 33 66 cc 
-//   85 17 2e 5c b8 6d da a9 4f 9e 21 42 84 15 2a 54 
-//   a8 4d 9a 29 52 a4 55 aa 49 92 39 72 e4 d5 b7 73 
-//   e6 d1 bf 63 c6 91 3f 7e fc e5 d7 b3 7b f6 f1 ff 
-
-static const int kPageSize = 4096;
-static const int kPageSizeMask = kPageSize - 1;
-
-// We will read and write these pairs, allocated at different strides
-struct Pair {
-  Pair* next;
-  int64 data;
+// Sampling of every sweep point, see SampleSweepPoint() and sampling.h: at
+// least kMinSamples rows, at most kMaxSamples, done once the median is known
+// to within kCiTarget or after kPointBudgetMs
+static const int kMinSamples = 5;
+static const int kMaxSamples = 11;
+static const double kCiTarget = 0.05;
+static const double kPointBudgetMs = 200.0;
+
+// Verify sweep tuning, see VerifyCacheSize(): sizes timed across the window
+// around the reported LLC size
+static const int kVerifyPoints = 64;
+
+// Adaptive sweep tuning, see FindCacheSizesAdaptive()
+static const int kCoarsePointsPerOctave = 4;
+static const int kDenseStepsPerBracket = 64;
+// A coarse point is a slope change if its bend is at least this fraction of
+// the sharpest bend in the coarse curve
+static const double kBendFraction = 0.25;
+
+// Hierarchy sweep tuning, see FindCacheHierarchy()
+static const int kHierarchyPointsPerOctave = 8;
+static const int kHierarchyMinLoads = 1 << 20;
+
+// MLP sweep tuning, see FindMemoryParallelism()
+static const int kMaxChains = 32;
+static const int kMlpMinSizeKB = 16;
+static const int kMlpMinLoads = 1 << 20;
+// The chain count that reaches this fraction of the peak throughput is taken
+// as the number of misses the level can keep in flight
+static const double kMlpSaturation = 0.9;
+
+// Prefetch sweep tuning, see FindPrefetchCoverage()
+static const int kMaxPrefetchStride = 4096;
+static const int kMaxPrefetchStreams = 32;
+// Each sample of a chase is at least this many loads, see SampleChase()
+static const int kChaseMinLoads = 1 << 18;
+// Lines of the L1 hit latency the coverage is measured against
+static const int kPrefetchL1Lines = 16;
+// A pattern whose latency is at least this fraction of the way from random
+// down to an L1 hit is taken as tracked by a prefetcher
+static const double kPrefetchTracked = 0.5;
+// A prefetcher crosses page boundaries if linear order covers this much more
+// than the same pages in random order
+static const double kPrefetchPageGain = 0.1;
+
+// Traversal patterns of the prefetch sweep
+enum PrefetchPattern {
+  kPatternRandom = 0,   // random line order within each page, pages in random order
+  kPatternLinear,       // every line in address order, param 64
+  kPatternBackward,     // every line in reverse address order
+  kPatternStride,       // runs at a fixed stride of param bytes
+  kPatternStreams,      // param linear streams interleaved
+  kPatternRuns,         // runs of param consecutive lines, in random order within each page
+};
+
+static const char* const kPrefetchPatternNames[] = {"random", "linear", "backward", "stride", "streams", "runs"};
+
+// Loaded sweep tuning, see FindLoadedLatency(). Each generator moves
+// kLoadedChunkBytes at a time and then waits out a delay, in cycles; the
+// delays go from a trickle to flat out.
+static const int kLoadedChunkBytes = 4096;
+static const int kLoadedDelays[] = {65536, 16384, 4096, 1024, 256, 0};
+// The bandwidth where the latency first grows to this factor of idle is
+// reported as where the queueing starts
+static const double kLoadedKnee = 1.5;
+
+enum Traffic {kTrafficRead = 0, kTrafficWrite, kTrafficMix, kTrafficCount};
+static const char* const kTrafficNames[kTrafficCount] = {"read", "write", "mix"};
+
+// What the generator threads of one loaded point share
+struct LoadedPoint {
+  int traffic;
+  int64 delay;                    // cycles to wait after each chunk
+  std::atomic<int> started;       // generators running
+  std::atomic<bool> go;           // all started, stream from now
+  std::atomic<bool> stop;         // chase done
+  std::vector<int64> bytes;       // moved per generator, kOpsStride apart
 };
 
 // We use this to make variables live by never printing them, but make sure
 // the compiler doesn't know that.
 static time_t gNeverZero = 1;
 
-// Allocate a byte array of given size, aligned on a page boundary
-// Caller will call free(rawptr)
-uint8* AllocPageAligned(int bytesize, uint8** rawptr) {
-  int newsize = bytesize + kPageSizeMask;
-  *rawptr = reinterpret_cast<uint8*>(malloc(newsize));
-  uintptr_t temp = reinterpret_cast<uintptr_t>(*rawptr);
-  temp = (temp + kPageSizeMask) & ~kPageSizeMask;
-  return reinterpret_cast<uint8*>(temp);
+// Page mode of the benchmark arena, recorded in every row after the timings
+static const char* gPageModeName = "4k";
+
+// Hardware counters around each timed region, see perfcounters.h
+static PerfGroup gPerf;
+
+// When a sweep point has enough samples, --ci_target=, --time_budget= and
+// --max_samples= change it
+static SamplingPolicy gSampling;
+
+// The counters of the last timed region per load, as extra csv columns
+std::string PerfColumns(double loads) {
+  char buf[256];
+  PerfCsvValues(&gPerf, loads, ", ", buf, sizeof(buf));
+  return buf;
 }
 
+// List order and seed chosen with --list= and --seed=, see MakeSweepList()
+static int gListOrder = kListPoly8;
+static uint64 gListSeed = 1;
+
 // Zero a byte array
-void ZeroAll(uint8* ptr, int bytesize) {
+void ZeroAll(uint8* ptr, int64 bytesize) {
   memset(ptr, 0, bytesize);
 }
 
 // Fill byte array with non-zero pseudo-random bits
-void PseudoAll(uint8* ptr, int bytesize) {
+void PseudoAll(uint8* ptr, int64 bytesize) {
   uint32* wordptr = reinterpret_cast<uint32*>(ptr);
-  int wordcount = bytesize >> 2;
+  int64 wordcount = bytesize >> 2;
   uint32 x = POLYINIT32;
-  for (int i = 0; i < wordcount; ++i) {
+  for (int64 i = 0; i < wordcount; ++i) {
     *wordptr++ = x;
     x = POLYSHIFT32(x);
   }
 }
 
-// In a byte array, create a linked list of Pairs, spaced by the given stride. 
-// Pairs are generally allocated near the front of the array first and near 
-// the end of the array last. The list will have floor(bytesize / bytestride) 
-// elements. The last element's next field is NULL and all the data fields are 
-// zero. 
-//
-// ptr must be aligned on a multiple of sizeof(void*), i.e. 8 for a 64-bit CPU
-// bytestride must be a multiple of sizeof(void*), and  must be at least 16
-//
-// If makelinear is true, the list elements are at offsets 0, 1, 2, ... times
-// stride. If makelinear is false, the list elements are in a scrambled order 
-// that is intended to defeat any cache prefetching hardware. See the POLY8 
-// discussion above.
-//
-// This routine is not intended to be particularly fast; it is called just once
-//
-// Returns a pointer to the first element of the list
-Pair* MakeLongList(uint8* ptr, int bytesize, int bytestride, bool makelinear) {
-  // Make an array of 256 mixed-up offsets
-  int mixedup[256];
-  mixedup[0] = 0;
-  uint8 x = POLYINIT8;
-  for (int i = 1; i < 256; ++i) {
-    mixedup[i] = x;
-    x = POLYSHIFT8(x);
-  }
-
-  Pair* pairptr = reinterpret_cast<Pair*>(ptr);
-  int element_count = bytesize / bytestride;
-  int extrabit = makelinear ? 0 : (1 << 14);
-  for (int i = 1; i < element_count; ++i) {
-    int nextelement = makelinear ? i : (i & ~0xff) | mixedup[i & 0xff];
-    Pair* nextptr = reinterpret_cast<Pair*>(ptr + ((nextelement * bytestride) ^ extrabit));
-    pairptr->next = nextptr;
-    pairptr->data = 0;
-    pairptr = nextptr;
+// Build the list the sweep walks, in the order chosen with --list=. The
+// default POLY8 order is the original MakeLongList(); the others are single
+// random cycles from MakeRandomList().
+const Pair* MakeSweepList(uint8* ptr, int64 bytesize, int linesize) {
+  if (gListOrder == kListPoly8) {
+    bool makelinear = false;
+    return MakeLongList(ptr, bytesize, linesize, makelinear);
+  }
+  return MakeRandomList(ptr, bytesize, linesize, gListOrder, gListSeed);
+}
+
+// Like MakeSweepList(), but always an exact cycle through every element, for
+// sweeps that walk a list more than once from wherever the last walk stopped
+Pair* MakeSweepCycle(uint8* ptr, int64 bytesize, int linesize) {
+  if (gListOrder == kListPoly8) {
+    return MakeCyclicList(ptr, bytesize, linesize);
   }
-  pairptr->next = NULL;
-  pairptr->data = 0;
+  return MakeRandomList(ptr, bytesize, linesize, gListOrder, gListSeed);
+}
 
-  return reinterpret_cast<Pair*>(ptr);
+// Walk K independent chains in lockstep, steps loads on each, and return the
+// elapsed cycles. The rest of this file is built -O0 so every load is
+// visible; this kernel alone is optimized so the K chain pointers live in
+// registers and the loop body is nothing but the K dependent loads.
+template <int K>
+__attribute__((optimize("O2"))) int64 ChaseChains(Pair** heads, int64 steps) {
+  const Pair* chains[K];
+  for (int c = 0; c < K; ++c) {chains[c] = heads[c];}
+  int64 startcy = GetCycles();
+  for (int64 i = 0; i < steps; ++i) {
+#pragma GCC unroll 32
+    for (int c = 0; c < K; ++c) {
+      chains[c] = chains[c]->next;
+    }
+  }
+  int64 stopcy = GetCycles();
+  int64 sum = 0;
+  for (int c = 0; c < K; ++c) {sum += chains[c]->data;}
+  if (gNeverZero == 0) {fprintf(stdout, "sum = %lld\n", sum);}
+  return stopcy - startcy;
+}
+
+typedef int64 (*ChaseChainsFn)(Pair** heads, int64 steps);
+
+// ChaseChains<K> for K = 1..kMaxChains, indexed by K
+static const ChaseChainsFn kChaseChains[kMaxChains + 1] = {
+  NULL, ChaseChains<1>, ChaseChains<2>, ChaseChains<3>,
+  ChaseChains<4>, ChaseChains<5>, ChaseChains<6>, ChaseChains<7>,
+  ChaseChains<8>, ChaseChains<9>, ChaseChains<10>, ChaseChains<11>,
+  ChaseChains<12>, ChaseChains<13>, ChaseChains<14>, ChaseChains<15>,
+  ChaseChains<16>, ChaseChains<17>, ChaseChains<18>, ChaseChains<19>,
+  ChaseChains<20>, ChaseChains<21>, ChaseChains<22>, ChaseChains<23>,
+  ChaseChains<24>, ChaseChains<25>, ChaseChains<26>, ChaseChains<27>,
+  ChaseChains<28>, ChaseChains<29>, ChaseChains<30>, ChaseChains<31>,
+  ChaseChains<32>,
+};
+
+// Streams chunk after chunk of the words at buffer, words a multiple of a
+// chunk, in the point's traffic and waits point->delay cycles after each,
+// until point->stop. A mix chunk copies its first half to its second, half
+// reads and half writes. Returns the bytes moved, without write-allocate
+// traffic. Optimized like ChaseChains(), so the generators stream as fast as
+// the hardware lets them.
+__attribute__((optimize("O2"))) int64 GenerateTraffic(LoadedPoint* point, uint64* buffer, int64 words) {
+  const int64 chunk = kLoadedChunkBytes / sizeof(uint64);
+  int64 moved = 0;
+  int64 offset = 0;
+  uint64 sum0 = 0, sum1 = 0;
+  while (!point->stop.load(std::memory_order_relaxed)) {
+    uint64* wordptr = buffer + offset;
+    if (point->traffic == kTrafficRead) {
+      for (int64 i = 0; i < chunk; i += 2) {
+        sum0 += wordptr[i];
+        sum1 += wordptr[i + 1];
+      }
+    } else if (point->traffic == kTrafficWrite) {
+      for (int64 i = 0; i < chunk; ++i) {wordptr[i] = moved;}
+    } else {
+      for (int64 i = 0; i < chunk / 2; ++i) {wordptr[chunk / 2 + i] = wordptr[i];}
+    }
+    moved += kLoadedChunkBytes;
+    offset = (offset + chunk < words) ? offset + chunk : 0;
+    if (point->delay > 0) {
+      int64 until = GetCycles() + point->delay;
+      while (GetCycles() < until) {}
+    }
+  }
+  if (gNeverZero == 0) {fprintf(stdout, "sum = %lld\n", sum0 + sum1);}
+  return moved;
+}
+
+// The chase of ChaseChains<1>() with a read-modify-write of every element's
+// data on the way, so every line it visits is dirty when it is evicted.
+// Returns the elapsed cycles.
+__attribute__((optimize("O2"))) int64 ChaseDirty(Pair** heads, int64 steps) {
+  Pair* pairptr = heads[0];
+  int64 startcy = GetCycles();
+  for (int64 i = 0; i < steps; ++i) {
+    pairptr->data += 1;
+    pairptr = pairptr->next;
+  }
+  int64 stopcy = GetCycles();
+  if (gNeverZero == 0) {fprintf(stdout, "pairptr->data = %lld\n", pairptr->data);}
+  return stopcy - startcy;
 }
 
 // Read all the bytes
-void TrashTheCaches(const uint8* ptr, int bytesize) {
+void TrashTheCaches(const uint8* ptr, int64 bytesize) {
   const uint64* uint64ptr = reinterpret_cast<const uint64*>(ptr);
-  int wordcount = bytesize >> 3;
+  int64 wordcount = bytesize >> 3;
   uint64 sum = 0;
-  for (int i = 0; i < wordcount; ++i) {
+  for (int64 i = 0; i < wordcount; ++i) {
     sum += uint64ptr[i];
   }
   if (gNeverZero == 0) {fprintf(stdout, "sum = %lld\n", sum);}
 } __attribute__((optimize(0)))
 
-int64 ScrambledLoads(const Pair* pairptr, int count) {
+int64 ScrambledLoads(const Pair* pairptr, int64 count) {
   if (count == 0) {
     return 0;  // Return a default value
   }
   int64 startcy = GetCycles();
-  for (int i = 0; i < (count >> 2); ++i) {
+  for (int64 i = 0; i < (count >> 2); ++i) {
     if (pairptr != NULL) {
       pairptr = pairptr->next;
     }
@@ -195,36 +305,755 @@ int64 ScrambledLoads(const Pair* pairptr, int count) {
   return elapsed / count;
 } __attribute__((optimize(0)))
 
+// Time one point of the sweep. Try to force the data we will access out of the
+// caches, then time four passes over the first count elements of the list.
+// Prints one csv row, the data size in KB followed by the four cycles-per-load
+// readings, the page mode and the hardware counters per load over the four
+// passes, and returns the median of the four readings.
+int64 MeasureSweepPoint(uint8* ptr, int64 kMaxArraySize, const Pair* pairptr, int64 count, int linesize) {
+  TrashTheCaches(ptr, kMaxArraySize);
+
+  int64 readings[4];
+  PerfGroupStart(&gPerf);
+  for (int i = 0; i < 4; ++i) {
+    readings[i] = ScrambledLoads(pairptr, count);
+  }
+  PerfGroupStop(&gPerf);
+  std::cout << count * linesize / 1024 << ", ";
+  for (int i = 0; i < 4; ++i) {std::cout << readings[i] << ", ";}
+  std::cout << gPageModeName << PerfColumns(4.0 * count) << std::endl;
+
+  std::sort(readings, readings + 4);
+  return (readings[1] + readings[2]) / 2;
+} __attribute__((optimize(0)))
+
+// Measures one sweep point until gSampling says its median is known well
+// enough, one csv row per sample, and returns that median
+double SampleSweepPoint(uint8* ptr, int64 kMaxArraySize, const Pair* pairptr, int64 count, int linesize) {
+  Sampler sampler;
+  StartSampler(&sampler, &gSampling);
+  do {
+    AddSample(&sampler, MeasureSweepPoint(ptr, kMaxArraySize, pairptr, count, linesize));
+  } while (!SamplerDone(&sampler));
+  return SamplerMedian(&sampler);
+}
+
 // 2024, we only change the FindCacheSizes() for detecting non-power-of-2 cache.
-void FindCacheSizes(uint8* ptr, int kMaxArraySize, int linesize, double max_cache_size) {
-  bool makelinear = false;
-  const Pair* pairptr = MakeLongList(ptr, kMaxArraySize, linesize, makelinear);
+void FindCacheSizes(uint8* ptr, int64 kMaxArraySize, int linesize, double max_cache_size) {
+  const Pair* pairptr = MakeSweepList(ptr, kMaxArraySize, linesize);
 
-  int max_count = static_cast<int>(max_cache_size * 1024 * 1024 / linesize);
-  int count_start = 4 * 1024 / linesize;
+  int64 max_count = static_cast<int64>(max_cache_size * 1024 * 1024 / linesize);
+  int64 count_start = 4 * 1024 / linesize;
 
-//Iterates 10 times to denoise.
-  for (int i = 0; i <= 10; ++i) {
 // Load 4KB to max_cache_size in KB, and transform the unit into count of cache lines and time it.
-    for (int count = count_start; count <= max_count; count += count_start) {
-      std::cout << count / 16 << ", ";
-      TrashTheCaches(ptr, kMaxArraySize);
+// Each size is sampled until its median is stable instead of sweeping 11 times: flat
+// stretches take kMinSamples rows, the noisy steps between levels up to kMaxSamples.
+  for (int64 count = count_start; count <= max_count; count += count_start) {
+    SampleSweepPoint(ptr, kMaxArraySize, pairptr, count, linesize);
+  }
+} __attribute__((optimize(0)))
+
+// Adaptive sweep, a much faster alternative to the linear 4KB sweep above.
+//
+// A coarse pass first times sizes spaced logarithmically from 4KB to
+// max_cache_size, kCoarsePointsPerOctave per doubling. Wherever the
+// cycles-per-load curve changes slope at a coarse point, the bracket between
+// its two neighbours is timed again at kDenseStepsPerBracket evenly spaced
+// sizes. The flat stretches, which are most of the sweep, are only timed by
+// the coarse pass. Every point is sampled as in the linear sweep, see
+// SampleSweepPoint(). Rows have the same csv format as the linear sweep, so
+// Final_Analyzing_Tool.py reads either one.
+void FindCacheSizesAdaptive(uint8* ptr, int64 kMaxArraySize, int linesize, double max_cache_size) {
+  const Pair* pairptr = MakeSweepList(ptr, kMaxArraySize, linesize);
+
+  // Work in 4KB steps, as the linear sweep does
+  int64 max_count = static_cast<int64>(max_cache_size * 1024 * 1024 / linesize);
+  int64 count_start = 4 * 1024 / linesize;
+  max_count -= max_count % count_start;
+
+  // Coarse sizes, rounded to 4KB and without duplicates
+  std::vector<int64> coarse;
+  double step = pow(2.0, 1.0 / kCoarsePointsPerOctave);
+  for (double count = count_start; count < max_count; count *= step) {
+    int64 rounded = static_cast<int64>(count / count_start + 0.5) * count_start;
+    if (coarse.empty() || coarse.back() != rounded) {coarse.push_back(rounded);}
+  }
+  if (coarse.empty() || coarse.back() != max_count) {coarse.push_back(max_count);}
+
+  // Median cycles per load of each coarse point, then the slope between
+  // neighbouring points against log2 of the size
+  int n = coarse.size();
+  std::vector<double> y(n);
+  for (int i = 0; i < n; ++i) {
+    y[i] = SampleSweepPoint(ptr, kMaxArraySize, pairptr, coarse[i], linesize);
+  }
+  std::vector<double> slope(n, 0.0);
+  for (int i = 0; i + 1 < n; ++i) {
+    slope[i] = (y[i + 1] - y[i]) / (log2(coarse[i + 1]) - log2(coarse[i]));
+  }
+
+  // The bend at an interior point is how much the slope changes there
+  std::vector<double> bend(n, 0.0);
+  double max_bend = 0.0;
+  for (int i = 1; i + 1 < n; ++i) {
+    bend[i] = fabs(slope[i] - slope[i - 1]);
+    max_bend = std::max(max_bend, bend[i]);
+  }
+
+  // Merge the brackets around every sharp bend, then time each one densely
+  std::vector<std::pair<int64, int64> > brackets;
+  for (int i = 1; i + 1 < n; ++i) {
+    if (max_bend <= 0.0 || bend[i] < kBendFraction * max_bend) {continue;}
+    if (!brackets.empty() && brackets.back().second >= coarse[i - 1]) {
+      brackets.back().second = coarse[i + 1];
+    } else {
+      brackets.push_back(std::make_pair(coarse[i - 1], coarse[i + 1]));
+    }
+  }
+
+  for (size_t b = 0; b < brackets.size(); ++b) {
+    int64 lo = brackets[b].first;
+    int64 hi = brackets[b].second;
+    int64 dense_step = (hi - lo) / kDenseStepsPerBracket;
+    dense_step = std::max(count_start, dense_step - dense_step % count_start);
+    for (int64 count = lo; count <= hi; count += dense_step) {
+      SampleSweepPoint(ptr, kMaxArraySize, pairptr, count, linesize);
+    }
+  }
+} __attribute__((optimize(0)))
+
+// Hierarchy sweep: find every cache level in one run.
+//
+// Sweeps the working set logarithmically from 1KB to max_cache_size,
+// kHierarchyPointsPerOctave points per doubling. Each point builds a cycle
+// over exactly that many bytes, walks it once to warm the caches, then times
+// four walks of at least kHierarchyMinLoads loads. Unlike the other sweeps the
+// caches are not trashed in between, so each point measures the steady-state
+// latency of a working set of that size.
+//
+// The sweep rows go to stdout in the usual csv format. The plateaus of the
+// curve, i.e. L1d, L2, L3, ... and finally memory, go to stderr with each
+// level's capacity and load-to-use latency. The last plateau is always taken
+// to be memory, so pick max_cache_size comfortably beyond the last level
+// cache, e.g. 4x.
+// Levels whose capacity is not within CACHE_HINT_WINDOW of what sysfs or
+// CPUID reports are noted.
+void FindCacheHierarchy(uint8* ptr, int64 kMaxArraySize, int linesize, double max_cache_size) {
+  CacheInfo caches[CACHE_MAX_LEVELS];
+  int cache_count = ReadCacheHints(caches, CACHE_MAX_LEVELS);
+  int64 max_count = static_cast<int64>(max_cache_size * 1024 * 1024 / linesize);
+  int64 min_count = std::max(4, 1024 / linesize);
+
+  std::vector<int64> counts;
+  double step = pow(2.0, 1.0 / kHierarchyPointsPerOctave);
+  for (double count = min_count; count < max_count; count *= step) {
+    int64 rounded = static_cast<int64>(count + 0.5);
+    if (counts.empty() || counts.back() != rounded) {counts.push_back(rounded);}
+  }
+  counts.push_back(max_count);
+
+  std::vector<double> latency;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    int64 count = counts[i];
+    const Pair* pairptr = MakeSweepCycle(ptr, count * linesize, linesize);
+    int64 loads = std::max(count, static_cast<int64>(kHierarchyMinLoads));
+    ScrambledLoads(pairptr, count);
+
+    int64 readings[4];
+    PerfGroupStart(&gPerf);
+    for (int r = 0; r < 4; ++r) {
+      readings[r] = ScrambledLoads(pairptr, loads);
+    }
+    PerfGroupStop(&gPerf);
+    std::cout << static_cast<double>(count) * linesize / 1024 << ", ";
+    for (int r = 0; r < 4; ++r) {std::cout << readings[r] << ", ";}
+    std::cout << gPageModeName << PerfColumns(4.0 * loads) << std::endl;
+    std::sort(readings, readings + 4);
+    latency.push_back((readings[1] + readings[2]) / 2.0);
+  }
+
+  std::vector<double> sizes;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    sizes.push_back(static_cast<double>(counts[i]) * linesize / 1024);
+  }
+  std::vector<Plateau> plateaus = FindPlateaus(latency, kHierarchyPointsPerOctave);
+  for (size_t p = 0; p < plateaus.size(); ++p) {
+    if (p + 1 == plateaus.size()) {
+      fprintf(stderr, "memory: beyond %.0f KB, %.1f cycles per load\n", sizes[plateaus[p].first], plateaus[p].latency);
+      break;
+    }
+    double capacity_kb = PlateauCapacity(latency, sizes, plateaus, p);
+    fprintf(stderr, "L%d%s: %.0f KB, %.1f cycles per load\n",
+            static_cast<int>(p) + 1, (p == 0) ? "d" : "", capacity_kb, plateaus[p].latency);
+    CheckCacheHint(CacheLevelName(p + 1), capacity_kb * 1024, FindCacheLevel(caches, cache_count, p + 1));
+  }
+} __attribute__((optimize(0)))
+
+// Verify sweep: check the LLC size that sysfs or CPUID reports instead of
+// searching for it.
+//
+// Times kVerifyPoints evenly spaced sizes from 1 - CACHE_HINT_WINDOW to
+// 1 + CACHE_HINT_WINDOW times the reported size, each sampled as in the
+// linear sweep. If the latency climbs by more than kPlateauTolerance across
+// the window, the LLC ends where it crosses the midpoint between the medians
+// of its first and last quarters, which is printed to stderr. Otherwise the
+// LLC ends outside the window and the report is flagged, so only a host whose
+// report is wrong needs the full sweep. Returns 0 if the report held.
+int VerifyCacheSize(uint8* ptr, int64 kMaxArraySize, int linesize, const CacheInfo* llc) {
+  const Pair* pairptr = MakeSweepList(ptr, kMaxArraySize, linesize);
+  double lo_bytes = (1.0 - CACHE_HINT_WINDOW) * llc->bytesize;
+  double hi_bytes = std::min((1.0 + CACHE_HINT_WINDOW) * llc->bytesize, static_cast<double>(kMaxArraySize));
+  std::vector<double> sizes;
+  std::vector<double> latency;
+  for (int i = 0; i < kVerifyPoints; ++i) {
+    double bytes = lo_bytes + (hi_bytes - lo_bytes) * i / (kVerifyPoints - 1);
+    int64 count = static_cast<int64>(bytes / linesize);
+    sizes.push_back(static_cast<double>(count) * linesize);
+    latency.push_back(SampleSweepPoint(ptr, kMaxArraySize, pairptr, count, linesize));
+  }
+
+  int quarter = kVerifyPoints / 4;
+  std::vector<double> first(latency.begin(), latency.begin() + quarter);
+  std::vector<double> last(latency.end() - quarter, latency.end());
+  std::sort(first.begin(), first.end());
+  std::sort(last.begin(), last.end());
+  double inside = first[quarter / 2];
+  double beyond = last[quarter / 2];
+  const char* name = CacheLevelName(llc->level);
+  if (beyond < (1.0 + kPlateauTolerance) * inside) {
+    fprintf(stderr, "%s: no step between %.0f and %.0f KB, where %s reports %lld KB; run the full sweep\n", name,
+            lo_bytes / 1024, hi_bytes / 1024, llc->source, static_cast<long long>(llc->bytesize >> 10));
+    return 1;
+  }
+  size_t i = 0;
+  while (i + 1 < latency.size() && latency[i] < (inside + beyond) / 2) {++i;}
+  fprintf(stderr, "%s: %.0f KB, %.1f cycles per load inside and %.1f beyond; %s reports %lld KB\n", name,
+          sizes[i] / 1024, inside, beyond, llc->source, static_cast<long long>(llc->bytesize >> 10));
+  return 0;
+} __attribute__((optimize(0)))
+
+// MLP sweep: memory-level parallelism of each level.
+//
+// For working sets from kMlpMinSizeKB up to max_cache_size, one point per
+// octave, splits a cycle over the working set into K = 1..kMaxChains
+// independent chains with SplitCycle() and walks all K at once. A single
+// chain measures latency; with K chains the core may have up to K misses in
+// flight, so loads per cycle climbs with K until the level, or the core's
+// miss buffers, can take no more. Each (size, K) point is walked once to warm
+// the caches and then three times timed with at least kMlpMinLoads loads.
+//
+// Prints one csv row per point: size in KB, chains, median loads per cycle,
+// page mode. For each size, prints to stderr the peak loads per cycle, its
+// speedup over one chain, and the fewest chains reaching kMlpSaturation of
+// the peak, i.e. how many misses that level sustains in parallel.
+void FindMemoryParallelism(uint8* ptr, int64 kMaxArraySize, int linesize, double max_cache_size) {
+  int64 max_bytes = static_cast<int64>(max_cache_size * 1024 * 1024);
+  Pair* heads[kMaxChains];
+
+  char perf_header[256];
+  PerfCsvHeader(", ", perf_header, sizeof(perf_header));
+  std::cout << "size_kb, chains, loads_per_cycle, page_mode" << perf_header << std::endl;
+  for (int64 bytes = kMlpMinSizeKB * 1024; bytes <= max_bytes; bytes *= 2) {
+    int64 count = bytes / linesize;
+    double throughput[kMaxChains + 1];
+    int max_chains = static_cast<int>(std::min(static_cast<int64>(kMaxChains), count));
+    for (int k = 1; k <= max_chains; ++k) {
+      // SplitCycle() relinks the list, so every K starts from a fresh cycle
+      Pair* first = MakeSweepCycle(ptr, bytes, linesize);
+      SplitCycle(first, count, k, heads);
+      int64 steps = std::max(count, static_cast<int64>(kMlpMinLoads)) / k;
+      kChaseChains[k](heads, count / k);
 
-      for (int i = 0; i < 3; ++i) {
-        int64 cyclesperload = ScrambledLoads(pairptr, count);
-        std::cout << cyclesperload << ", ";
+      double readings[3];
+      PerfGroupStart(&gPerf);
+      for (int r = 0; r < 3; ++r) {
+        int64 elapsed = kChaseChains[k](heads, steps);
+        readings[r] = static_cast<double>(steps * k) / std::max(elapsed, static_cast<int64>(1));
       }
-      int64 cyclesperload = ScrambledLoads(pairptr, count);
-      std::cout << cyclesperload << std::endl;
+      PerfGroupStop(&gPerf);
+      std::sort(readings, readings + 3);
+      throughput[k] = readings[1];
+      std::cout << bytes / 1024 << ", " << k << ", " << throughput[k] << ", "
+                << gPageModeName << PerfColumns(3.0 * steps * k) << std::endl;
     }
+
+    int peak = 1;
+    for (int k = 2; k <= max_chains; ++k) {
+      if (throughput[k] > throughput[peak]) {peak = k;}
+    }
+    int saturated = 1;
+    while (throughput[saturated] < kMlpSaturation * throughput[peak]) {++saturated;}
+    fprintf(stderr, "%lld KB: peak %.3f loads per cycle at %d chains, %.1fx one chain, "
+            "%.0f%% of peak at %d chains\n",
+            bytes / 1024, throughput[peak], peak, throughput[peak] / throughput[1],
+            kMlpSaturation * 100, saturated);
+  }
+} __attribute__((optimize(0)))
+
+// Link the lines of ptr whose indices order lists into a cycle in that order
+Pair* LinkLines(uint8* ptr, int linesize, const std::vector<int64>& order) {
+  for (size_t i = 0; i < order.size(); ++i) {
+    Pair* pairptr = reinterpret_cast<Pair*>(ptr + order[i] * linesize);
+    pairptr->next = reinterpret_cast<Pair*>(ptr + order[(i + 1) % order.size()] * linesize);
+    pairptr->data = 0;
+  }
+  return reinterpret_cast<Pair*>(ptr + order[0] * linesize);
+}
+
+// Build a cycle over the bytesize bytes at ptr, one element per line, in the
+// given pattern. Every pattern visits every line once, so they all have the
+// same footprint and differ only in the order of the addresses.
+Pair* MakePrefetchList(uint8* ptr, int64 bytesize, int linesize, int pattern, int param) {
+  int64 count = bytesize / linesize;
+  if (pattern == kPatternRandom) {
+    return MakeRandomList(ptr, bytesize, linesize, kListPageLocal, gListSeed);
+  }
+  if (pattern == kPatternLinear) {
+    // The makelinear list of the original sweep, closed into a cycle
+    Pair* first = MakeLongList(ptr, bytesize, linesize, true);
+    reinterpret_cast<Pair*>(ptr + (count - 1) * linesize)->next = first;
+    return first;
+  }
+
+  std::vector<int64> order;
+  order.reserve(count);
+  if (pattern == kPatternBackward) {
+    for (int64 i = count - 1; i >= 0; --i) {order.push_back(i);}
+  } else if (pattern == kPatternStride) {
+    // Column by column: a run of count / step loads param bytes apart, then
+    // the same run one line further on
+    int64 step = param / linesize;
+    for (int64 column = 0; column < step; ++column) {
+      for (int64 i = column; i < count; i += step) {order.push_back(i);}
+    }
+  } else if (pattern == kPatternStreams) {
+    // param equal parts of the working set, one line of each in turn
+    int64 part = count / param;
+    for (int64 i = 0; i < part; ++i) {
+      for (int k = 0; k < param; ++k) {order.push_back(k * part + i);}
+    }
+  } else {
+    // Runs of param lines, each starting on a multiple of param lines, in
+    // random order within each page and pages in random order, so the TLB
+    // misses are those of random. Runs of 4KB are whole pages.
+    int64 lines_per_page = kPageSize / linesize;
+    std::vector<uint32> pages(count / lines_per_page);
+    std::vector<uint32> runs(lines_per_page / param);
+    for (size_t g = 0; g < pages.size(); ++g) {pages[g] = g;}
+    for (size_t r = 0; r < runs.size(); ++r) {runs[r] = r;}
+    uint64 state = gListSeed;
+    ShuffleIndices(&pages, &state);
+    for (size_t g = 0; g < pages.size(); ++g) {
+      ShuffleIndices(&runs, &state);
+      for (size_t r = 0; r < runs.size(); ++r) {
+        for (int i = 0; i < param; ++i) {
+          order.push_back(static_cast<int64>(pages[g]) * lines_per_page + static_cast<int64>(runs[r]) * param + i);
+        }
+      }
+    }
+  }
+  return LinkLines(ptr, linesize, order);
+}
+
+// Cycles per load of a cycle walked by chase, ChaseChains<1>() or
+// ChaseDirty(), once to warm up and then sampled, at least kChaseMinLoads
+// loads per sample. Sets loads to the loads timed.
+double SampleChase(ChaseChainsFn chase, Pair* first, int64 count, int64* loads) {
+  Pair* heads[1] = {first};
+  int64 steps = std::max(count, static_cast<int64>(kChaseMinLoads));
+  chase(heads, count);
+  Sampler sampler;
+  StartSampler(&sampler, &gSampling);
+  PerfGroupStart(&gPerf);
+  do {
+    AddSample(&sampler, static_cast<double>(chase(heads, steps)) / steps);
+  } while (!SamplerDone(&sampler));
+  PerfGroupStop(&gPerf);
+  *loads = steps * sampler.count;
+  return SamplerMedian(&sampler);
+} __attribute__((optimize(0)))
+
+// A working set in each cache level from L2 on, between its size and the size
+// of the level below, and one of half of kMaxArraySize in memory, in whole
+// pages. Appends the level names to names and the sizes to sizes.
+void LevelWorkingSets(int64 kMaxArraySize, std::vector<std::string>* names, std::vector<int64>* sizes) {
+  CacheInfo caches[CACHE_MAX_LEVELS];
+  int cache_count = ReadCacheHints(caches, CACHE_MAX_LEVELS);
+  for (int c = 1; c < cache_count; ++c) {
+    double between = sqrt(static_cast<double>(caches[c - 1].bytesize) * caches[c].bytesize);
+    int64 bytes = static_cast<int64>(std::min(between, kMaxArraySize / 2.0)) & ~static_cast<int64>(kPageSizeMask);
+    names->push_back(CacheLevelName(caches[c].level));
+    sizes->push_back(bytes);
+  }
+  names->push_back("memory");
+  sizes->push_back((kMaxArraySize / 2) & ~static_cast<int64>(kPageSizeMask));
+}
+
+// Prefetch sweep: which traversals the hardware prefetchers keep up with.
+//
+// For a working set in each level, see LevelWorkingSets(), times a cycle over
+// every line of the working set in several orders:
+//   random    random within each page, pages in random order: the baseline
+//             no stream prefetcher can follow, with the same TLB misses as a
+//             scan
+//   linear    address order, the makelinear list of MakeLongList()
+//   backward  reverse address order
+//   stride    runs at a fixed stride from 128 B to kMaxPrefetchStride
+//   streams   2 to kMaxPrefetchStreams interleaved linear streams
+//   runs      runs of 2 to 64 consecutive lines, in random order within
+//             each page; runs of 64 lines are whole 4KB pages
+// A pattern's coverage is how far its latency falls from random towards an
+// L1 hit, from 0 to 1; at kPrefetchTracked or more a prefetcher tracks it.
+// There is no need for software prefetch in loops that look like a tracked
+// pattern.
+//
+// Prints one csv row per level and pattern: level, size in KB, pattern, its
+// stride, stream count or run length, cycles per load, coverage, page mode
+// and the hardware counters per load. For each level, prints to stderr the
+// strides tracked, whether backward is, the most streams tracked, the
+// shortest run tracked, i.e. how many lines into a page it takes the
+// prefetcher to start, and whether it crosses pages: linear against the same
+// pages walked in random order.
+void FindPrefetchCoverage(uint8* ptr, int64 kMaxArraySize, int linesize) {
+  std::vector<std::string> names;
+  std::vector<int64> sizes;
+  LevelWorkingSets(kMaxArraySize, &names, &sizes);
+
+  Pair* l1_first = MakeRandomList(ptr, kPrefetchL1Lines * linesize, linesize, kListRandom, gListSeed);
+  int64 loads = 0;
+  double l1_cycles = SampleChase(kChaseChains[1], l1_first, kPrefetchL1Lines, &loads);
+  fprintf(stderr, "L1 hit: %.1f cycles per load\n", l1_cycles);
+
+  char perf_header[256];
+  PerfCsvHeader(", ", perf_header, sizeof(perf_header));
+  std::cout << "level, size_kb, pattern, param, cycles_per_load, coverage, page_mode" << perf_header << std::endl;
+  int lines_per_page = kPageSize / linesize;
+  for (size_t l = 0; l < sizes.size(); ++l) {
+    int64 count = sizes[l] / linesize;
+    std::vector<int> patterns;
+    std::vector<int> params;
+    patterns.push_back(kPatternRandom);
+    params.push_back(0);
+    patterns.push_back(kPatternLinear);
+    params.push_back(linesize);
+    patterns.push_back(kPatternBackward);
+    params.push_back(linesize);
+    for (int stride = 2 * linesize; stride <= kMaxPrefetchStride; stride *= 2) {
+      patterns.push_back(kPatternStride);
+      params.push_back(stride);
+    }
+    for (int streams = 2; streams <= kMaxPrefetchStreams; streams *= 2) {
+      patterns.push_back(kPatternStreams);
+      params.push_back(streams);
+    }
+    for (int run = 2; run <= lines_per_page; run *= 2) {
+      patterns.push_back(kPatternRuns);
+      params.push_back(run);
+    }
+
+    std::vector<double> coverage(patterns.size(), 0.0);
+    double random_cycles = 0.0;
+    for (size_t p = 0; p < patterns.size(); ++p) {
+      Pair* first = MakePrefetchList(ptr, sizes[l], linesize, patterns[p], params[p]);
+      double cycles = SampleChase(kChaseChains[1], first, count, &loads);
+      if (p == 0) {random_cycles = cycles;}
+      if (random_cycles > l1_cycles) {
+        coverage[p] = std::min(1.0, std::max(0.0, (random_cycles - cycles) / (random_cycles - l1_cycles)));
+      }
+      std::cout << names[l] << ", " << sizes[l] / 1024 << ", " << kPrefetchPatternNames[patterns[p]] << ", "
+                << params[p] << ", " << cycles << ", " << coverage[p] << ", " << gPageModeName
+                << PerfColumns(static_cast<double>(loads)) << std::endl;
+    }
+
+    std::string strides;
+    bool backward = false;
+    int streams = 1;
+    int shortest_run = 0;
+    double page_order = 0.0;
+    for (size_t p = 0; p < patterns.size(); ++p) {
+      bool tracked = coverage[p] >= kPrefetchTracked;
+      if (patterns[p] == kPatternStride && tracked) {
+        strides += (strides.empty() ? "" : " ") + std::to_string(params[p]);
+      }
+      if (patterns[p] == kPatternBackward) {backward = tracked;}
+      if (patterns[p] == kPatternStreams && tracked && params[p] == 2 * streams) {streams = params[p];}
+      if (patterns[p] == kPatternRuns && tracked && shortest_run == 0) {shortest_run = params[p];}
+      if (patterns[p] == kPatternRuns && params[p] == lines_per_page) {page_order = coverage[p];}
+    }
+    fprintf(stderr, "%s (%lld KB): random %.1f cycles per load, linear coverage %.2f; strides tracked: %s; "
+            "backward %s; streams tracked: %d; ", names[l].c_str(), static_cast<long long>(sizes[l] / 1024), random_cycles,
+            coverage[1], strides.empty() ? "none" : strides.c_str(), backward ? "tracked" : "not tracked",
+            (coverage[1] >= kPrefetchTracked) ? streams : 0);
+    if (shortest_run > 0) {
+      fprintf(stderr, "runs of %d lines tracked; ", shortest_run);
+    } else {
+      fprintf(stderr, "no run within a page tracked; ");
+    }
+    fprintf(stderr, "pages in random order %.2f, so it %s page boundaries\n", page_order,
+            (coverage[1] - page_order > kPrefetchPageGain) ? "crosses" : "stops at");
+  }
+} __attribute__((optimize(0)))
+
+// Generator id of a loaded point: pins itself to cpu, waits for the others,
+// then streams its slice of bytes at buffer until the chase is done
+void LoadGenerator(LoadedPoint* point, int id, int cpu, uint8* buffer, int64 bytes) {
+  PinThreadToCpu(cpu);
+  point->started.fetch_add(1);
+  while (!point->go.load()) {std::this_thread::yield();}
+  point->bytes[id * kOpsStride] = GenerateTraffic(point, reinterpret_cast<uint64*>(buffer), bytes / sizeof(uint64));
+} __attribute__((optimize(0)))
+
+// One point of the loaded sweep: generators threads on cpus, wrapping around,
+// each stream their own slice of slice bytes from generator_ptr while the
+// chase from first is sampled. Returns its cycles per load, and sets gbps to
+// the generators' bandwidth over the same time and loads to the loads timed.
+double MeasureLoadedPoint(Pair* first, int64 count, uint8* generator_ptr, int64 slice, const std::vector<int>& cpus,
+                          int generators, int traffic, int64 delay, double* gbps, int64* loads) {
+  LoadedPoint point;
+  point.traffic = traffic;
+  point.delay = delay;
+  point.started.store(0);
+  point.go.store(false);
+  point.stop.store(false);
+  point.bytes.assign(generators * kOpsStride, 0);
+  std::vector<std::thread> threads;
+  for (int g = 0; g < generators; ++g) {
+    threads.push_back(std::thread(LoadGenerator, &point, g, cpus[g % cpus.size()], generator_ptr + g * slice, slice));
+  }
+  while (point.started.load() < generators) {std::this_thread::yield();}
+
+  auto start = std::chrono::steady_clock::now();
+  point.go.store(true);
+  double cycles = SampleChase(kChaseChains[1], first, count, loads);
+  point.stop.store(true);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  for (int g = 0; g < generators; ++g) {threads[g].join();}
+
+  int64 moved = 0;
+  for (int g = 0; g < generators; ++g) {moved += point.bytes[g * kOpsStride];}
+  *gbps = (generators > 0) ? moved / elapsed.count() / 1e9 : 0.0;
+  return cycles;
+} __attribute__((optimize(0)))
+
+// Loaded sweep: pointer-chase latency under background bandwidth pressure.
+//
+// The chase of ScrambledLoads() on an otherwise idle machine is the best
+// case. Here the chase runs on one pinned CPU while generator threads, pinned
+// to the other CPUs, stream reads, writes or a mix through memory of their
+// own, and the latency is measured again at each injection rate. For a
+// working set in each level, see LevelWorkingSets(), the chase walks a random
+// cycle, first alone and then against generators moving kLoadedChunkBytes
+// at a time with each of the kLoadedDelays in turn. Between them the
+// generators stream as many bytes as the chase's working set, each its own
+// slice, so they press on the same level: the shared levels see the
+// generators' traffic, a private one only that of an SMT sibling.
+//
+// CPUs: the chase stays on the CPU it is pinned to, or is pinned to the one
+// it runs on. The generators take the rest of the --pin_cpu list, or else
+// every other online CPU, one per core first. generators 0 means one per CPU.
+//
+// Prints one csv row per point: level, size in KB, traffic ("idle" for the
+// chase alone), generators, delay in cycles per chunk, the generators'
+// bandwidth in GB/s, cycles per load, page mode and the hardware counters of
+// the chase per load. For each level and traffic, prints to stderr the idle
+// and peak-bandwidth latencies and the bandwidth where the latency reaches
+// kLoadedKnee times idle, where queueing starts to show in the tail.
+void FindLoadedLatency(uint8* ptr, int64 kMaxArraySize, int linesize, int page_mode, const MeasureEnv* env,
+                       int generators, const std::vector<int>& traffics) {
+  std::vector<std::string> names;
+  std::vector<int64> sizes;
+  LevelWorkingSets(kMaxArraySize, &names, &sizes);
+
+  int chase_cpu = (env->cpu_count > 0) ? env->cpus[0] : sched_getcpu();
+  if (env->cpu_count == 0 && PinThreadToCpu(chase_cpu) == 0) {
+    fprintf(stderr, "loaded: chase pinned to cpu %d\n", chase_cpu);
+  }
+  std::vector<int> cpus;
+  if (env->cpu_count > 1) {
+    cpus.assign(env->cpus + 1, env->cpus + env->cpu_count);
+  } else {
+    char buf[256];
+    cpu_set_t online;
+    CPU_ZERO(&online);
+    if (ReadSysfsLine("/sys/devices/system/cpu/online", buf, sizeof(buf)) == 0) {ParseCpuList(buf, &online);}
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &online) && cpu != chase_cpu) {cpus.push_back(cpu);}
+    }
+    OrderCpusByCore(&cpus);
+  }
+  if (cpus.empty()) {
+    fprintf(stderr, "loaded: no CPU besides the chase's, the generators share it and the latency includes their "
+            "time slices\n");
+    cpus.push_back(chase_cpu);
+  }
+  if (generators <= 0) {generators = cpus.size();}
+
+  // A slice per generator, together as large as the largest working set
+  int64 arena_bytes = std::max(sizes.back(), static_cast<int64>(generators) * kLoadedChunkBytes);
+  Arena arena;
+  if (AllocArena(&arena, arena_bytes, page_mode) != 0) {
+    fprintf(stderr, "Could not allocate %lld bytes for the generators\n", arena_bytes);
+    return;
+  }
+  memset(arena.ptr, 1, arena_bytes);
+
+  char perf_header[256];
+  PerfCsvHeader(", ", perf_header, sizeof(perf_header));
+  std::cout << "level, size_kb, traffic, generators, delay_cycles, bandwidth_gbps, cycles_per_load, page_mode"
+            << perf_header << std::endl;
+  int delay_count = sizeof(kLoadedDelays) / sizeof(kLoadedDelays[0]);
+  for (size_t l = 0; l < sizes.size(); ++l) {
+    int64 count = sizes[l] / linesize;
+    Pair* first = MakeRandomList(ptr, sizes[l], linesize, kListRandom, gListSeed);
+    int64 slice = std::max(static_cast<int64>(kLoadedChunkBytes),
+                           sizes[l] / generators / kLoadedChunkBytes * kLoadedChunkBytes);
+    int64 loads = 0;
+    double gbps = 0.0;
+    double idle = MeasureLoadedPoint(first, count, arena.ptr, slice, cpus, 0, kTrafficRead, 0, &gbps, &loads);
+    std::cout << names[l] << ", " << sizes[l] / 1024 << ", idle, 0, 0, 0, " << idle << ", " << gPageModeName
+              << PerfColumns(static_cast<double>(loads)) << std::endl;
+
+    for (size_t t = 0; t < traffics.size(); ++t) {
+      double peak_gbps = 0.0;
+      double peak_cycles = idle;
+      double knee_gbps = -1.0;
+      for (int d = 0; d < delay_count; ++d) {
+        double cycles = MeasureLoadedPoint(first, count, arena.ptr, slice, cpus, generators, traffics[t],
+                                           kLoadedDelays[d], &gbps, &loads);
+        std::cout << names[l] << ", " << sizes[l] / 1024 << ", " << kTrafficNames[traffics[t]] << ", " << generators
+                  << ", " << kLoadedDelays[d] << ", " << gbps << ", " << cycles << ", " << gPageModeName
+                  << PerfColumns(static_cast<double>(loads)) << std::endl;
+        if (gbps > peak_gbps) {
+          peak_gbps = gbps;
+          peak_cycles = cycles;
+        }
+        if (knee_gbps < 0.0 && cycles >= kLoadedKnee * idle) {knee_gbps = gbps;}
+      }
+      fprintf(stderr, "%s (%lld KB), %s: idle %.1f cycles per load, %.1f at the peak of %.1f GB/s; ",
+              names[l].c_str(), static_cast<long long>(sizes[l] / 1024), kTrafficNames[traffics[t]], idle,
+              peak_cycles, peak_gbps);
+      if (knee_gbps >= 0.0) {
+        fprintf(stderr, "%.1fx idle from %.1f GB/s\n", kLoadedKnee, knee_gbps);
+      } else {
+        fprintf(stderr, "never %.1fx idle\n", kLoadedKnee);
+      }
+    }
+  }
+  FreeArena(&arena);
+} __attribute__((optimize(0)))
+
+// Write sweep: what a dirty line costs when it is evicted.
+//
+// Every other sweep only loads; the lines are written once when the list is
+// built and are clean from then on. For a working set in each level, see
+// LevelWorkingSets(), walks a random cycle twice: clean, loads only, then
+// dirty, with a read-modify-write of every element's data, so each line
+// leaves the level with a writeback to the next. The difference is the
+// writeback cost per line at that level, what a store-heavy loop such as a
+// log append pays on top of its loads.
+//
+// Prints one csv row per level and chase: level, size in KB, chase ("clean"
+// or "dirty"), cycles per load, page mode and the hardware counters per load.
+// For each level, prints to stderr both latencies and their difference.
+void FindWritebackCosts(uint8* ptr, int64 kMaxArraySize, int linesize) {
+  std::vector<std::string> names;
+  std::vector<int64> sizes;
+  LevelWorkingSets(kMaxArraySize, &names, &sizes);
+
+  char perf_header[256];
+  PerfCsvHeader(", ", perf_header, sizeof(perf_header));
+  std::cout << "level, size_kb, chase, cycles_per_load, page_mode" << perf_header << std::endl;
+  for (size_t l = 0; l < sizes.size(); ++l) {
+    int64 count = sizes[l] / linesize;
+    Pair* first = MakeRandomList(ptr, sizes[l], linesize, kListRandom, gListSeed);
+    // Building the list wrote every line, so read all of the arena first to
+    // leave clean copies behind
+    TrashTheCaches(ptr, kMaxArraySize);
+    int64 loads = 0;
+    double clean = SampleChase(kChaseChains[1], first, count, &loads);
+    std::cout << names[l] << ", " << sizes[l] / 1024 << ", clean, " << clean << ", " << gPageModeName
+              << PerfColumns(static_cast<double>(loads)) << std::endl;
+    double dirty = SampleChase(ChaseDirty, first, count, &loads);
+    std::cout << names[l] << ", " << sizes[l] / 1024 << ", dirty, " << dirty << ", " << gPageModeName
+              << PerfColumns(static_cast<double>(loads)) << std::endl;
+    fprintf(stderr, "%s (%lld KB): clean %.1f cycles per load, dirty %.1f, %+.1f per line written back\n",
+            names[l].c_str(), static_cast<long long>(sizes[l] / 1024), clean, dirty, dirty - clean);
   }
 } __attribute__((optimize(0)))
 
+// NUMA sweep: a node-to-node latency matrix.
+//
+// For every memory node, allocates an arena of kMaxArraySize bytes bound to
+// that node and builds a list through it. Then, pinned to each node's CPUs in
+// turn, walks every list once to warm up and four more times timed. Prints a
+// header row, then one row per CPU node: the node, the median cycles per load
+// to each memory node, and the page mode. Pick max_cache_size well beyond the
+// last level cache so the walks measure memory.
+void FindNumaLatencies(int64 kMaxArraySize, int linesize, int page_mode) {
+  int nodes = NumaNodeCount();
+  int64 count = kMaxArraySize / linesize;
+
+  std::vector<Arena> arenas(nodes);
+  std::vector<const Pair*> lists(nodes, static_cast<const Pair*>(NULL));
+  for (int m = 0; m < nodes; ++m) {
+    if (AllocArena(&arenas[m], kMaxArraySize, page_mode) != 0) {
+      fprintf(stderr, "Could not allocate %lld bytes\n", kMaxArraySize);
+      continue;
+    }
+    gPageModeName = PageModeName(arenas[m].mode);
+    if (BindMemoryToNode(arenas[m].ptr, kMaxArraySize, m) != 0) {
+      fprintf(stderr, "Could not bind memory to node %d, skipping it\n", m);
+      continue;
+    }
+    lists[m] = MakeSweepList(arenas[m].ptr, kMaxArraySize, linesize);
+  }
+
+  std::cout << "cpu_node";
+  for (int m = 0; m < nodes; ++m) {std::cout << ", memory_node_" << m;}
+  std::cout << ", page_mode" << std::endl;
+  for (int c = 0; c < nodes; ++c) {
+    if (PinThreadToNode(c) != 0) {continue;}  // no CPUs on this node
+    std::cout << c << ", ";
+    for (int m = 0; m < nodes; ++m) {
+      if (lists[m] == NULL) {
+        std::cout << "-, ";
+        continue;
+      }
+      ScrambledLoads(lists[m], count);
+      int64 readings[4];
+      for (int r = 0; r < 4; ++r) {readings[r] = ScrambledLoads(lists[m], count);}
+      std::sort(readings, readings + 4);
+      std::cout << (readings[1] + readings[2]) / 2 << ", ";
+    }
+    std::cout << gPageModeName << std::endl;
+  }
+
+  for (int m = 0; m < nodes; ++m) {FreeArena(&arenas[m]);}
+} __attribute__((optimize(0)))
+
 int main(int argc, char* argv[]) {
   int default_cache_line_size = 64;
-  double kDefaultmax_cache_size = 32.0; // Default Max Cache Size in MB
+  double kDefaultmax_cache_size = 32.0; // Default Max Cache Size in MB, when neither sysfs nor CPUID reports the LLC
   int linesize = default_cache_line_size;
-  double max_cache_size = kDefaultmax_cache_size;
+  double max_cache_size = 0.0;     // 0 means from the reported LLC
+  bool adaptive = false;
+  bool verify = false;
+  bool hierarchy = false;
+  bool numa = false;
+  bool mlp = false;
+  bool prefetch = false;
+  bool loaded = false;
+  bool write = false;
+  int generators = 0;                       // 0 means one per CPU besides the chase's
+  std::string traffic_list = "read,write,mix";
+  int page_mode = PAGE_MODE_4K;
+  int cpu_node = -1;
+  int memory_node = -1;
+  MeasureEnv env;
+  InitMeasureEnv(&env);
+  InitSamplingPolicy(&gSampling, kMinSamples, kMaxSamples, kCiTarget, kPointBudgetMs);
+  // Readings are whole cycles, so an interval one cycle wide is as good as it gets
+  gSampling.resolution = 1.0;
 
   for (int i = 1; i < argc; ++i) {
     if (std::strncmp(argv[i], "--cache_line_size=", 18) == 0) {
@@ -237,16 +1066,135 @@ int main(int argc, char* argv[]) {
       if (!arg_value.empty()) {
         max_cache_size = std::atof(arg_value.c_str());
       }
+    } else if (std::strncmp(argv[i], "--sweep=", 8) == 0) {
+      // "linear" (default) walks every 4KB step, "adaptive" refines only the
+      // knees, "verify" checks the reported LLC size, "hierarchy" reports
+      // every cache level from 1KB up, "numa" prints a node-to-node latency
+      // matrix, "mlp" measures how many misses each level keeps in flight,
+      // "prefetch" which traversals the hardware prefetchers keep up with,
+      // "loaded" the latency under bandwidth pressure from other CPUs,
+      // "write" what writing back a dirty line costs at each level
+      adaptive = (std::strcmp(argv[i] + 8, "adaptive") == 0);
+      verify = (std::strcmp(argv[i] + 8, "verify") == 0);
+      hierarchy = (std::strcmp(argv[i] + 8, "hierarchy") == 0);
+      numa = (std::strcmp(argv[i] + 8, "numa") == 0);
+      mlp = (std::strcmp(argv[i] + 8, "mlp") == 0);
+      prefetch = (std::strcmp(argv[i] + 8, "prefetch") == 0);
+      loaded = (std::strcmp(argv[i] + 8, "loaded") == 0);
+      write = (std::strcmp(argv[i] + 8, "write") == 0);
+      if (!(adaptive || verify || hierarchy || numa || mlp || prefetch || loaded || write) &&
+          std::strcmp(argv[i] + 8, "linear") != 0) {
+        fprintf(stderr, "Unknown --sweep, use linear, adaptive, verify, hierarchy, numa, mlp, prefetch, loaded or write\n");
+        return 1;
+      }
+    } else if (std::strncmp(argv[i], "--generators=", 13) == 0) {
+      generators = std::atoi(argv[i] + 13);
+    } else if (std::strncmp(argv[i], "--traffic=", 10) == 0) {
+      traffic_list = argv[i] + 10;
+    } else if (std::strncmp(argv[i], "--page_mode=", 12) == 0) {
+      page_mode = ParsePageMode(argv[i] + 12);
+      if (page_mode < 0) {
+        fprintf(stderr, "Unknown --page_mode, use 4k, thp, 2m or 1g\n");
+        return 1;
+      }
+    } else if (std::strncmp(argv[i], "--list=", 7) == 0) {
+      gListOrder = ParseListOrder(argv[i] + 7);
+      if (gListOrder < 0) {
+        fprintf(stderr, "Unknown --list, use poly8, random, pagelocal or crosspage\n");
+        return 1;
+      }
+    } else if (std::strncmp(argv[i], "--seed=", 7) == 0) {
+      gListSeed = std::strtoull(argv[i] + 7, NULL, 10);
+    } else if (std::strncmp(argv[i], "--cpu_node=", 11) == 0) {
+      cpu_node = std::atoi(argv[i] + 11);
+    } else if (std::strncmp(argv[i], "--memory_node=", 14) == 0) {
+      memory_node = std::atoi(argv[i] + 14);
+    } else if (!ParseSamplingFlag(&gSampling, argv[i])) {
+      ParseMeasureEnvFlag(&env, argv[i]);
+    }
+  }
+
+  // The loaded sweep's generator traffic, a list of read, write and mix
+  std::vector<int> traffics;
+  std::string list = traffic_list + ",";
+  for (size_t start = 0, comma; (comma = list.find(',', start)) != std::string::npos; start = comma + 1) {
+    std::string name = list.substr(start, comma - start);
+    int traffic = std::find(kTrafficNames, kTrafficNames + kTrafficCount, name) - kTrafficNames;
+    if (traffic == kTrafficCount) {
+      fprintf(stderr, "Unknown --traffic, use a list of read, write and mix\n");
+      return 1;
     }
+    traffics.push_back(traffic);
+  }
+
+  // Without --max_cache_size, the sweeps that look for the LLC go 7/6 of the
+  // reported size, just past it, and those that must reach memory 4 times it
+  CacheInfo caches[CACHE_MAX_LEVELS];
+  int cache_count = ReadCacheHints(caches, CACHE_MAX_LEVELS);
+  const CacheInfo* llc = (cache_count > 0) ? &caches[cache_count - 1] : NULL;
+  if (verify && llc == NULL) {
+    fprintf(stderr, "Neither sysfs nor CPUID reports the caches, there is nothing to verify\n");
+    return 1;
+  }
+  if (verify) {
+    max_cache_size = (1.0 + CACHE_HINT_WINDOW) * llc->bytesize / (1024 * 1024);
+  } else if (max_cache_size <= 0.0 && llc != NULL) {
+    double multiple = (hierarchy || mlp || numa || prefetch || loaded || write) ? 4.0 : 7.0 / 6.0;
+    max_cache_size = multiple * llc->bytesize / (1024 * 1024);
+    fprintf(stderr, "%s is %lld KB, from %s; sweeping to %.1f MB\n", CacheLevelName(llc->level),
+            static_cast<long long>(llc->bytesize >> 10), llc->source, max_cache_size);
+  } else if (max_cache_size <= 0.0) {
+    max_cache_size = kDefaultmax_cache_size;
   }
 
   gNeverZero = time(NULL);
-  int kMaxArraySize = static_cast<int>(max_cache_size * 1024 * 1024);
-  uint8* rawptr;
-  uint8* ptr = AllocPageAligned(kMaxArraySize, &rawptr);
+  int64 kMaxArraySize = static_cast<int64>(max_cache_size * 1024 * 1024);
+  if (numa) {
+    FindNumaLatencies(kMaxArraySize, linesize, page_mode);
+    return 0;
+  }
+
+  if (cpu_node >= 0 && PinThreadToNode(cpu_node) != 0) {
+    fprintf(stderr, "Could not pin to the CPUs of node %d\n", cpu_node);
+    return 1;
+  }
+  // After the node, so --pin_cpu can pick one CPU of it
+  SetupMeasureEnv(&env);
+  Arena arena;
+  if (AllocArena(&arena, kMaxArraySize, page_mode) != 0) {
+    fprintf(stderr, "Could not allocate %lld bytes\n", kMaxArraySize);
+    return 1;
+  }
+  if (memory_node >= 0 && BindMemoryToNode(arena.ptr, kMaxArraySize, memory_node) != 0) {
+    fprintf(stderr, "Could not bind memory to node %d\n", memory_node);
+    return 1;
+  }
+  gPageModeName = PageModeName(arena.mode);
+  uint8* ptr = arena.ptr;
+  if (PerfGroupOpen(&gPerf) == 0) {
+    fprintf(stderr, "Hardware counters not available, their columns will be -\n");
+  }
 
-  FindCacheSizes(ptr, kMaxArraySize, linesize, max_cache_size);
+  int status = 0;
+  if (verify) {
+    status = VerifyCacheSize(ptr, kMaxArraySize, linesize, llc);
+  } else if (prefetch) {
+    FindPrefetchCoverage(ptr, kMaxArraySize, linesize);
+  } else if (write) {
+    FindWritebackCosts(ptr, kMaxArraySize, linesize);
+  } else if (loaded) {
+    FindLoadedLatency(ptr, kMaxArraySize, linesize, page_mode, &env, generators, traffics);
+  } else if (mlp) {
+    FindMemoryParallelism(ptr, kMaxArraySize, linesize, max_cache_size);
+  } else if (hierarchy) {
+    FindCacheHierarchy(ptr, kMaxArraySize, linesize, max_cache_size);
+  } else if (adaptive) {
+    FindCacheSizesAdaptive(ptr, kMaxArraySize, linesize, max_cache_size);
+  } else {
+    FindCacheSizes(ptr, kMaxArraySize, linesize, max_cache_size);
+  }
 
-  free(rawptr);
-  return 0;
+  PerfGroupClose(&gPerf);
+  FreeArena(&arena);
+  return status;
 }
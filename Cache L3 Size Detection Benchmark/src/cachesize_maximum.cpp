@@ -20,162 +20,99 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h> // for time()
+#include <algorithm>
 #include <iostream>
 #include <cstring>
 #include <cstdlib>
+#include <string>
 
 #include "basetypes.h"
+#include "cacheinfo.h"
+#include "measureenv.h"
+#include "pagealloc.h"
+#include "pairlist.h"
+#include "perfcounters.h"
 #include "polynomial.h"
+#include "sampling.h"
 #include "timecounters.h"
 
-// We use a couple of fast pseudo-random generators that are based on standard 
-// cyclic reduncy check arithmetic. Look in Wikipedia for more information on 
-// CRC calculations.
-//
-// The particular CRC style we use is a left shift by one bit, followed by an 
-// XOR of a specific CRC bit pattern if the bit shifted out is 1. This mimics
-// long-used hardware that feeds back the top bit to XOR taps at specific 
-// places in a shift register. Our use here is just to get a bunch of non-zero 
-// bit patterns that have poor correlation from one to the next.
-//
-// Rather than the simple 
-//  if (highbit is 1)
-//    x = (x << 1) ^ bit_pattern
-//  else
-//    x = (x << 1)
-//
-// we make this calculation branch-free and therefore fast by ANDing the bit
-// pattern against either 00000... or 11111..., depending on the value of the
-// high bit. This is accomplished by an arithmetic right shift that sign-
-// extends the input value. The entire expansion is four inline instrucitons:
-// shift, shift, and, xor.
-// 
-
-// x must be of type uint8
-// #define POLY8 (0x1d)   // From CRC-8-SAE J1850
-// #define POLYSHIFT8(x) ( ((x) << 1) ^ ((static_cast<int8>((x)) >> 7) & POLY8) )
-// #define POLYINIT8 (0xffu)
-
-// POLY8 is a crc-based calculation that cycles through 255 byte values,
-// excluding zero so long as the initial value is non-zero. If the initial
-// value is zero, it cycles at zero every time.
-//
-// Here are the values if started at POLYINIT8 = 0xff
-//   ff e3 db ab 4b 96 31 62 c4 95 37 6e dc a5 57 ae 
-//   41 82 19 32 64 c8 8d 07 0e 1c 38 70 e0 dd a7 53 
-//   a6 51 a2 59 b2 79 f2 f9 ef c3 9b 2b 56 ac 45 8a 
-//   09 12 24 48 90 3d 7a f4 f5 f7 f3 fb eb cb 8b 0b 
-//   16 2c 58 b0 7d fa e9 cf 83 1b 36 6c d8 ad 47 8e 
-//   01 02 04 08 10 20 40 80 1d 3a 74 e8 cd 87 13 26 
-//   4c 98 2d 5a b4 75 ea c9 8f 03 06 0c 18 30 60 c0 
-//   9d 27 4e 9c 25 4a 94 35 6a d4 b5 77 ee c1 9f 23 
-//   46 8c 05 0a 14 28 50 a0 5d ba 69 d2 b9 6f de a1 
-//   5f be 61 c2 99 2f 5e bc 65 ca 89 0f 1e 3c 78 f0 
-//   fd e7 d3 bb 6b d6 b1 7f fe e1 df a3 5b b6 71 e2 
-//   d9 af 43 86 11 22 44 88 0d 1a 34 68 d0 bd 67 ce 
-//   81 1f 3e 7c f8 ed c7 93 3b 76 ec c5 97 33 66 cc 
-//   85 17 2e 5c b8 6d da a9 4f 9e 21 42 84 15 2a 54 
-//   a8 4d 9a 29 52 a4 55 aa 49 92 39 72 e4 d5 b7 73 
-//   e6 d1 bf 63 c6 91 3f 7e fc e5 d7 b3 7b f6 f1 ff 
-
-static const int kPageSize = 4096;
-static const int kPageSizeMask = kPageSize - 1;
+// Here, this data is extracted from the website https://www.techpowerup.com/cpu-specs/?mfgr=Intel&sort=name, we get all the possible L3 cache size.
+static const double Possible_Cache_Size[] = {
+    1.0, 1.5, 2.0, 3.0, 4.0, 5.0, 6.0, 8.0, 8.25, 9.0, 10.0, 11.0, 12.0, 13.75, 14.0, 15.0, 16.0, 16.5, 18.0, 19.25, 20.0, 22.0, 22.5, 24.0, 24.75, 25.0, 26.25, 27.5, 30.0, 30.25, 32.0, 
+  33.0, 33.75, 35.0, 35.75, 36.0, 37.5, 38.5, 39.0, 40.0, 42.0, 45.0, 48.0, 52.5, 54.0, 55.0, 57.0, 60.0, 64.0, 
+  67.5, 71.5, 75.0, 77.0, 82.5, 96.0, 
+  97.5, 105.0, 112.5, 128.0, 160.0, 180.0, 192.0, 250.0, 256.0, 260.0, 300.0, 320.0, 384.0, 768.0, 1152.0
+  };   //In MB, add any if there exist other new L3 cache size
 
-// Make an array bigger than any expected cache size
-static const int kMaxArraySize = 1152 * 1024 * 1024;
+// The array is twice the largest size timed, so the caches can be trashed
+// even around that size: 8 MB at least, 2304 MB with --full
+static const int kArrayPerSize = 2;
+static const int64 kMinArraySize = 8ll << 20;
 
-// We will read and write these pairs, allocated at different strides
-struct Pair {
-  Pair* next;
-  int64 data;
-};
 // We use this to make variables live by never printing them, but make sure
 // the compiler doesn't know that.
 static time_t gNeverZero = 1;
 
-// Allocate a byte array of given size, aligned on a page boundary
-// Caller will call free(rawptr)
-uint8* AllocPageAligned(int bytesize, uint8** rawptr) {
-  int newsize = bytesize + kPageSizeMask;
-  *rawptr = reinterpret_cast<uint8*>(malloc(newsize));
-  uintptr_t temp = reinterpret_cast<uintptr_t>(*rawptr);
-  temp = (temp + kPageSizeMask) & ~kPageSizeMask;
-  return  reinterpret_cast<uint8*>(temp);
+// Page mode of the benchmark arena, recorded in every row after the timings
+static const char* gPageModeName = "4k";
+
+// Hardware counters around each timed region, see perfcounters.h
+static PerfGroup gPerf;
+
+// The counters of the last timed region per load, as extra csv columns
+std::string PerfColumns(double loads) {
+  char buf[256];
+  PerfCsvValues(&gPerf, loads, ", ", buf, sizeof(buf));
+  return buf;
 }
 
+// List order and seed chosen with --list= and --seed=, see MakeSweepList()
+static int gListOrder = kListPoly8;
+static uint64 gListSeed = 1;
+
+// Sampling of every cache size, see sampling.h: at least kMinSamples rows, at
+// most kMaxSamples, done once the median is known to within kCiTarget or after
+// kPointBudgetMs. --ci_target=, --time_budget= and --max_samples= change it.
+static const int kMinSamples = 5;
+static const int kMaxSamples = 20;
+static const double kCiTarget = 0.05;
+static const double kPointBudgetMs = 500.0;
+static SamplingPolicy gSampling;
+
 // Zero a byte array
-void ZeroAll(uint8* ptr, int bytesize) {
+void ZeroAll(uint8* ptr, int64 bytesize) {
   memset(ptr, 0, bytesize);
 }
 
 // Fill byte array with non-zero pseudo-random bits
-void PseudoAll(uint8* ptr, int bytesize) {
+void PseudoAll(uint8* ptr, int64 bytesize) {
   uint32* wordptr = reinterpret_cast<uint32*>(ptr);
-  int wordcount = bytesize >> 2;
+  int64 wordcount = bytesize >> 2;
   uint32 x = POLYINIT32;
-  for (int i = 0; i < wordcount; ++i) {
+  for (int64 i = 0; i < wordcount; ++i) {
     *wordptr++ = x;
     x = POLYSHIFT32(x);
   }
 }
 
-// In a byte array, create a linked list of Pairs, spaced by the given stride. 
-// Pairs are generally allocated near the front of the array first and near 
-// the end of the array last. The list will have floor(bytesize / bytestride) 
-// elements. The last element's next field is NULL and all the data fields are 
-// zero. 
-//
-// ptr must be aligned on a multiple of sizeof(void*), i.e. 8 for a 64-bit CPU
-// bytestride must be a multiple of sizeof(void*), and  must be at least 16
-//
-// If makelinear is true, the list elements are at offsets 0, 1, 2, ... times
-// stride. If makelinear is false, the list elements are in a scrambled order 
-// that is intended to defeat any cache prefetching hardware. See the POLY8 
-// discussion above.
-//
-// This routine is not intended to be particularly fast; it is called just once
-//
-// Returns a pointer to the first element of the list
-Pair* MakeLongList(uint8* ptr, int bytesize, int bytestride, bool makelinear) {
-  // Make an array of 256 mixed-up offsets
-  // 0, ff, e3, db, ... 7b, f6, f1
-  int mixedup[256];
-  // First element
-  mixedup[0] = 0;
-  // 255 more elements
-  uint8 x = POLYINIT8;
-  for (int i = 1; i < 256; ++i) {
-    mixedup[i] = x;
-    x = POLYSHIFT8(x);
+// Build the list the sweep walks, in the order chosen with --list=. The
+// default POLY8 order is the original MakeLongList(); the others are single
+// random cycles from MakeRandomList().
+const Pair* MakeSweepList(uint8* ptr, int64 bytesize, int linesize) {
+  if (gListOrder == kListPoly8) {
+    bool makelinear = false;
+    return MakeLongList(ptr, bytesize, linesize, makelinear);
   }
-
-  Pair* pairptr = reinterpret_cast<Pair*>(ptr);
-  int element_count = bytesize / bytestride;
-  // Make sure next element is in different DRAM row than current element
-  int extrabit = makelinear ? 0 : (1 << 14);
-  // Fill in N-1 elements, each pointing to the next one
-  for (int i = 1; i < element_count; ++i) {
-    // If not linear, there are mixed-up groups of 256 elements chained together
-    int nextelement = makelinear ? i : (i & ~0xff) | mixedup[i & 0xff];
-    Pair* nextptr = reinterpret_cast<Pair*>(ptr + ((nextelement * bytestride) ^ extrabit));
-    pairptr->next = nextptr;
-    pairptr->data = 0;
-    pairptr = nextptr;
-  }
-  // Fill in Nth element
-  pairptr->next = NULL;
-  pairptr->data = 0;
-
-  return reinterpret_cast<Pair*>(ptr);
+  return MakeRandomList(ptr, bytesize, linesize, gListOrder, gListSeed);
 }
 
 // Read all the bytes
-void TrashTheCaches(const uint8* ptr, int bytesize) {
+void TrashTheCaches(const uint8* ptr, int64 bytesize) {
   // Fill up array with pseudo-random nonzero values
   const uint64* uint64ptr = reinterpret_cast<const uint64*>(ptr);
-  int wordcount = bytesize >> 3;
+  int64 wordcount = bytesize >> 3;
   uint64 sum = 0;
-  for (int i = 0; i < wordcount; ++i) {
+  for (int64 i = 0; i < wordcount; ++i) {
     sum += uint64ptr[i];
   }
 
@@ -184,10 +121,10 @@ void TrashTheCaches(const uint8* ptr, int bytesize) {
 } __attribute__((optimize(0)))
 
 
-int64 ScrambledLoads(const Pair* pairptr, int count) {
+int64 ScrambledLoads(const Pair* pairptr, int64 count) {
   // Unroll four times to attempt to reduce loop overhead in timing
   int64 startcy = GetCycles();
-  for (int i = 0; i < (count >> 2); ++i) {
+  for (int64 i = 0; i < (count >> 2); ++i) {
     if (pairptr != NULL) {
       pairptr = pairptr->next;
     }
@@ -209,42 +146,53 @@ int64 ScrambledLoads(const Pair* pairptr, int count) {
 } __attribute__((optimize(0)))
 
 // 2024, we only change the FindCacheSizes() for detecting non-power-of-2 cache.
-void  FindCacheSizes(uint8* ptr, int kMaxArraySize, int linesize) {
-  bool makelinear = false;
-  const Pair* pairptr = MakeLongList(ptr, kMaxArraySize, linesize, makelinear);
-// Here, this data is extracted from the website https://www.techpowerup.com/cpu-specs/?mfgr=Intel&sort=name, we get all the possible L3 cache size.
-  double Possible_Cache_Size[] = {
-    1.0, 1.5, 2.0, 3.0, 4.0, 5.0, 6.0, 8.0, 8.25, 9.0, 10.0, 11.0, 12.0, 13.75, 14.0, 15.0, 16.0, 16.5, 18.0, 19.25, 20.0, 22.0, 22.5, 24.0, 24.75, 25.0, 26.25, 27.5, 30.0, 30.25, 32.0, 
-  33.0, 33.75, 35.0, 35.75, 36.0, 37.5, 38.5, 39.0, 40.0, 42.0, 45.0, 48.0, 52.5, 54.0, 55.0, 57.0, 60.0, 64.0, 
-  67.5, 71.5, 75.0, 77.0, 82.5, 96.0, 
-  97.5, 105.0, 112.5, 128.0, 160.0, 180.0, 192.0, 250.0, 256.0, 260.0, 300.0, 320.0, 384.0, 768.0, 1152.0
-  };   //In MB, add any if there exist other new L3 cache size
+// Only the sizes from min_mb to max_mb are timed.
+void  FindCacheSizes(uint8* ptr, int64 kMaxArraySize, int linesize, double min_mb, double max_mb) {
+  const Pair* pairptr = MakeSweepList(ptr, kMaxArraySize, linesize);
   int size = sizeof(Possible_Cache_Size) / sizeof(Possible_Cache_Size[0]);
-  int Converted_Cache_Size[size]; // Create an array of the same size
+  int64 Converted_Cache_Size[size]; // Create an array of the same size
   for(int j = 0; j < size; j++) {
-      Converted_Cache_Size[j] = (int)(Possible_Cache_Size[j]*1048576/linesize); // Convert MB into B, 1024*1024=1048576, then convert into count.
+      Converted_Cache_Size[j] = (int64)(Possible_Cache_Size[j]*1048576/linesize); // Convert MB into B, 1024*1024=1048576, then convert into count.
   }
 
   // Now loading the datasize into the cache based on the database.
-  // Iterates 30 times to denoise.
-  for(int i=0; i<20; ++i){
-    for (int j = 0; j <= size-1; j ++) {
+  // Each size is sampled until its median is stable, instead of 20 times: sizes
+  // well inside or outside a cache take kMinSamples rows, the noisy ones around
+  // its capacity up to kMaxSamples.
+  for (int j = 0; j <= size-1; j ++) {
+    if (Possible_Cache_Size[j] < min_mb || Possible_Cache_Size[j] > max_mb) {continue;}
+    Sampler sampler;
+    StartSampler(&sampler, &gSampling);
+    do {
     // Try to force the data we will access out of the caches
-      std::cout << Possible_Cache_Size[j] << ", ";
       TrashTheCaches(ptr, kMaxArraySize);
-      for (int t = 0; t < 3; ++t) {
-        int64 cyclesperload = ScrambledLoads(pairptr, Converted_Cache_Size[j]);
-        std::cout << cyclesperload << ", ";
+      int64 cyclesperload[4];
+      PerfGroupStart(&gPerf);
+      for (int t = 0; t < 4; ++t) {
+        cyclesperload[t] = ScrambledLoads(pairptr, Converted_Cache_Size[j]);
       }
-      int64 cyclesperload = ScrambledLoads(pairptr, Converted_Cache_Size[j]);
-      std::cout << cyclesperload << std::endl;
-    }
+      PerfGroupStop(&gPerf);
+      std::cout << Possible_Cache_Size[j] << ", ";
+      for (int t = 0; t < 4; ++t) {std::cout << cyclesperload[t] << ", ";}
+      std::cout << gPageModeName << PerfColumns(4.0 * Converted_Cache_Size[j]) << std::endl;
+      // The median of the four readings is one sample
+      std::sort(cyclesperload, cyclesperload + 4);
+      AddSample(&sampler, (cyclesperload[1] + cyclesperload[2]) / 2.0);
+    } while (!SamplerDone(&sampler));
   }
 } __attribute__((optimize(0)))
 
 int main (int argc, char* argv[]) {
   int default_cache_line_size = 64;
   int linesize = default_cache_line_size;
+  int page_mode = PAGE_MODE_4K;
+  bool full = false;
+  double max_size_mb = 0.0;   // 0 means twice the reported LLC, or the whole table
+  MeasureEnv env;
+  InitMeasureEnv(&env);
+  InitSamplingPolicy(&gSampling, kMinSamples, kMaxSamples, kCiTarget, kPointBudgetMs);
+  // Readings are whole cycles, so an interval one cycle wide is as good as it gets
+  gSampling.resolution = 1.0;
 
   for (int i = 1; i < argc; ++i) {
     if (std::strncmp(argv[i], "--cache_line_size=", 18) == 0) {
@@ -252,16 +200,77 @@ int main (int argc, char* argv[]) {
       if (!arg_value.empty()) {
         linesize = std::atoi(arg_value.c_str());
       }
+    } else if (std::strncmp(argv[i], "--page_mode=", 12) == 0) {
+      page_mode = ParsePageMode(argv[i] + 12);
+      if (page_mode < 0) {
+        fprintf(stderr, "Unknown --page_mode, use 4k, thp, 2m or 1g\n");
+        return 1;
+      }
+    } else if (std::strncmp(argv[i], "--list=", 7) == 0) {
+      gListOrder = ParseListOrder(argv[i] + 7);
+      if (gListOrder < 0) {
+        fprintf(stderr, "Unknown --list, use poly8, random, pagelocal or crosspage\n");
+        return 1;
+      }
+    } else if (std::strncmp(argv[i], "--seed=", 7) == 0) {
+      gListSeed = std::strtoull(argv[i] + 7, NULL, 10);
+    } else if (std::strncmp(argv[i], "--max_size=", 11) == 0) {
+      // The largest table size to time, in MB
+      max_size_mb = std::atof(argv[i] + 11);
+    } else if (std::strcmp(argv[i], "--full") == 0) {
+      // Every size in the table, not just those around the reported LLC
+      full = true;
+    } else if (!ParseSamplingFlag(&gSampling, argv[i])) {
+      ParseMeasureEnvFlag(&env, argv[i]);
+    }
+  }
+
+  // Unless --full, only the sizes from half to twice the LLC that sysfs or
+  // CPUID reports are timed, or up to --max_size=
+  double min_mb = 0.0;
+  double max_mb = 1e9;
+  CacheInfo caches[CACHE_MAX_LEVELS];
+  int cache_count = full ? 0 : ReadCacheHints(caches, CACHE_MAX_LEVELS);
+  if (cache_count > 0) {
+    const CacheInfo* llc = &caches[cache_count - 1];
+    min_mb = 0.5 * llc->bytesize / (1024 * 1024);
+    max_mb = 2.0 * llc->bytesize / (1024 * 1024);
+    if (max_size_mb > 0.0) {
+      max_mb = max_size_mb;
+      min_mb = std::min(min_mb, 0.25 * max_mb);
     }
+    fprintf(stderr, "%s is %lld KB, from %s; timing %.2f to %.2f MB, --full for every size\n",
+            CacheLevelName(llc->level), static_cast<long long>(llc->bytesize >> 10), llc->source, min_mb, max_mb);
+  } else if (max_size_mb > 0.0) {
+    max_mb = max_size_mb;
   }
+  // The array holds and trashes the largest size timed
+  double largest_mb = 0.0;
+  for (size_t j = 0; j < sizeof(Possible_Cache_Size) / sizeof(Possible_Cache_Size[0]); ++j) {
+    if (Possible_Cache_Size[j] >= min_mb && Possible_Cache_Size[j] <= max_mb) {
+      largest_mb = std::max(largest_mb, Possible_Cache_Size[j]);
+    }
+  }
+  int64 array_size = std::max(kMinArraySize,
+                              static_cast<int64>(RoundUp(static_cast<size_t>(kArrayPerSize * largest_mb * 1024 * 1024), 1 << 20)));
 
   gNeverZero = time(NULL);
-  uint8* rawptr;
-  uint8* ptr = AllocPageAligned(kMaxArraySize, &rawptr);
+  SetupMeasureEnv(&env);
+  Arena arena;
+  if (AllocArena(&arena, array_size, page_mode) != 0) {
+    fprintf(stderr, "Could not allocate %lld bytes\n", array_size);
+    return 1;
+  }
+  gPageModeName = PageModeName(arena.mode);
+  uint8* ptr = arena.ptr;
+  if (PerfGroupOpen(&gPerf) == 0) {
+    fprintf(stderr, "Hardware counters not available, their columns will be -\n");
+  }
 
-  FindCacheSizes(ptr, kMaxArraySize, linesize);
+  FindCacheSizes(ptr, array_size, linesize, min_mb, max_mb);
 
-  free(rawptr);
+  PerfGroupClose(&gPerf);
+  FreeArena(&arena);
   return 0;
 }
 
@@ -1,18 +1,56 @@
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <new>
+#include <random>
+#include <string>
 #include <thread>
+#include <vector>
+
+#include "cacheinfo.h"
+#include "measureenv.h"
+#include "perfcounters.h"
+#include "sampling.h"
 
 using namespace std;
 
-constexpr int iterations{10000000}; // the benchmark time tuning
+constexpr uint64_t default_iterations{10000000}; // the benchmark time tuning, --iterations= changes it
+// passes over every stride: at least min_repeats, then a stride stops once the
+// median of its runs is known to within ci_target, at most --repeats= passes
+constexpr int min_repeats{5};
+constexpr int default_repeats{10};
+constexpr double ci_target{0.05};
+
+// --matrix mode: round trips of the line per timed run, runs per CPU pair (the
+// fastest is kept), and the jump between sorted pair latencies that starts a
+// new tier of the topology
+constexpr int matrix_rounds{100000};
+constexpr int matrix_repeats{3};
+constexpr double tier_ratio{1.3};
+
+// --stride mode: the most blocks one chase visits, timed chases per stride
+// (the fastest is kept), the L2 size when sysfs does not say, and the bounds
+// of the memory chase's buffer, twice the LLC size in between so nearly every
+// block starts with a miss
+constexpr int stride_blocks{1 << 18};
+constexpr int stride_repeats{3};
+constexpr size_t stride_default_l2{256ull << 10};
+constexpr size_t stride_min_buffer{64ull << 20};
+constexpr size_t stride_max_buffer{1ull << 30};
 
-// Template to create a struct with various alignments
-//Align both the struct and its members to ensure it fits on the same cache line
-template <std::size_t Align>
-struct alignas(Align) CacheLineShared {
-    alignas(Align/2) std::atomic_uint64_t object1{};
-    alignas(Align/2) std::atomic_uint64_t object2{}; 
+static MeasureEnv gEnv; // pinning and priority of the two threads, see measureenv.h
+static unsigned char* volatile chase_end; // keeps the --stride chase live
+
+//all possible cache line sizes; the two counters are half a stride apart
+constexpr size_t strides[] = {16, 32, 64, 128, 256, 512, 1024, 2048, 4096};
+
+//The two counters live in one page-aligned buffer, the second half a stride
+//after the first, so they share a line until the stride is twice the line size
+struct alignas(4096) SharedBuffer {
+    unsigned char bytes[2 * 4096];
 };
 
 // Function to get an object that represent current time, help to calculate access time
@@ -21,77 +59,489 @@ inline auto now() noexcept {
 }
 
 /**
- * Inducing false-sharing
- * 
- * A template function that works for different alignments of CacheLineShared struct
- * 
- * Align: the alignment of the struct
- * which: a variable to specify which member will be modified each time the function is called, 0 for object1 and 1 for object2
- * Concurrently modifying two members of the CacheLineShared<Align> data struct to cause
- * false sharing to happen
+ * A reusable pair of pinned threads for inducing false sharing
+ *
+ * The two threads are started once and pinned once, to the first and second
+ * --pin_cpu CPU, and then run every stride and repeat. For each run they meet
+ * at a barrier and only then start their clocks and counters, so the loops
+ * overlap from the first increment instead of one thread getting a head
+ * start while the other is still being created. Waiters yield, so this still
+ * works on a single CPU, without any contention to measure.
+ */
+class ThreadPair {
+ public:
+    ThreadPair() {
+        for (int which{0}; which < 2; which++)
+            threads_[which] = std::thread(&ThreadPair::worker, this, which);
+    }
+
+    ~ThreadPair() {
+        quit_ = true;
+        generation_.fetch_add(1, std::memory_order_release);
+        for (auto& t : threads_)
+            t.join();
+    }
+
+    /**
+     * Inducing false-sharing
+     *
+     * Each thread increments its own counter count times, concurrently, so the
+     * line they share, if any, bounces between the two cores.
+     *
+     * @param counter1 the first thread's counter
+     * @param counter2 the second thread's counter
+     * @param count increments per thread
+     * @param perf1, perf2 hardware counters of each thread over its loop
+     * @return the time of both loops added up, in milliseconds
+     */
+    double run(std::atomic_uint64_t* counter1, std::atomic_uint64_t* counter2, uint64_t count,
+               PerfGroup& perf1, PerfGroup& perf2) {
+        counter_[0] = counter1;
+        counter_[1] = counter2;
+        perf_[0] = &perf1;
+        perf_[1] = &perf2;
+        count_ = count;
+        arrived_.store(0);
+        done_.store(0);
+        generation_.fetch_add(1, std::memory_order_release);
+        while (done_.load(std::memory_order_acquire) < 2)
+            std::this_thread::yield();
+        return millis_[0] + millis_[1];
+    }
+
+ private:
+    void worker(int which) {
+        //with --pin_cpu=a,b the threads run on a and b, e.g. two cores that are not SMT siblings
+        PinMeasuringThread(&gEnv, which);
+        int seen = 0;
+        for (;;) {
+            while (generation_.load(std::memory_order_acquire) == seen)
+                std::this_thread::yield();
+            seen = generation_.load(std::memory_order_acquire);
+            if (quit_)
+                return;
+
+            std::atomic_uint64_t* counter = counter_[which];
+            //counters are per thread, so each thread opens its own group
+            PerfGroupOpen(perf_[which]);
+            arrived_.fetch_add(1);
+            while (arrived_.load() < 2)
+                std::this_thread::yield();
+            PerfGroupStart(perf_[which]);
+            const auto start_time{now()};
+
+            for (uint64_t count{}; count != count_; count++) {
+                //using atomic operations to disregard memory order ensuring false sharing occurs
+                counter->fetch_add(1, std::memory_order_relaxed);
+            }
+
+            const auto end_time = now();
+            PerfGroupStop(perf_[which]);
+            PerfGroupClose(perf_[which]);
+            std::chrono::duration<double, std::milli> total_time = end_time - start_time;
+            millis_[which] = total_time.count();
+            done_.fetch_add(1, std::memory_order_release);
+        }
+    }
+
+    std::thread threads_[2];
+    std::atomic_int generation_{0};
+    std::atomic_int arrived_{0};
+    std::atomic_int done_{0};
+    std::atomic_bool quit_{false};
+    std::atomic_uint64_t* counter_[2]{};
+    PerfGroup* perf_[2]{};
+    uint64_t count_{0};
+    double millis_[2]{};
+};
+
+/**
+ * Time of one block of a stride chase, in nanoseconds
+ *
+ * The buffer is cut into blocks of two times stride bytes, and the chase
+ * visits up to stride_blocks of them, spread evenly over the whole buffer, in
+ * one random cycle. In each block it loads the start and then, dependent on
+ * it, the byte stride further on. Laps of the cycle repeat until at least
+ * stride_blocks blocks were visited; the fastest of stride_repeats runs is
+ * returned.
+ */
+double stride_chase(unsigned char* buffer, size_t buffer_size, size_t stride, std::mt19937_64& random) {
+    //blocks evenly spaced over the buffer, visited in one random cycle (Sattolo)
+    size_t block_count = min(buffer_size / (2 * stride), static_cast<size_t>(stride_blocks));
+    size_t spacing = buffer_size / block_count / (2 * stride) * (2 * stride);
+    vector<size_t> order(block_count);
+    for (size_t i{0}; i < block_count; i++)
+        order[i] = i;
+    for (size_t i{block_count - 1}; i > 0; i--)
+        swap(order[i], order[random() % i]);
+    for (size_t i{0}; i < block_count; i++) {
+        unsigned char* block = buffer + i * spacing;
+        *reinterpret_cast<unsigned char**>(block) = block + stride;
+        *reinterpret_cast<unsigned char**>(block + stride) = buffer + order[i] * spacing;
+    }
+
+    size_t laps = (stride_blocks + block_count - 1) / block_count;
+    double best = 0.0;
+    for (int r{0}; r < stride_repeats; r++) {
+        unsigned char* p = buffer;
+        const auto start_time{now()};
+        for (size_t i{0}; i < laps * block_count; i++) {
+            p = *reinterpret_cast<unsigned char* volatile*>(p);
+            p = *reinterpret_cast<unsigned char* volatile*>(p);
+        }
+        std::chrono::duration<double, std::nano> total_time = now() - start_time;
+        double ns = total_time.count() / (laps * block_count);
+        if (r == 0 || ns < best)
+            best = ns;
+        chase_end = p;
+    }
+    return best;
+}
+
+/**
+ * Single-threaded cross-check: line size and prefetch pair size from strides
+ *
+ * Two stride chases, see stride_chase(), for strides of 8 to 1024 bytes:
+ *
+ * Over half the L2, the first load of a block is an L2 hit and the second
+ * hits L1 while the stride is within the line, and is another L2 hit beyond.
+ * The L2 prefetchers only act on L2 misses, so the first step up is the line
+ * size.
  *
- * @param data CacheLineShared<Align> struct that stores two members that will be modified
+ * Over twice the LLC, the first load is a miss to memory. The adjacent-line
+ * prefetcher fetches the other line of the first one's pair along with it, so
+ * the second load stays cheap until the stride leaves the pair, and the step
+ * to a second full miss is the prefetch pair size.
  */
-template <size_t Align, bool which>
-void false_sharing(CacheLineShared<Align>& data) {
-    const auto start_time{now()};
-
-    for (uint64_t count{}; count != iterations; count++) {
-        //using atomic operations to disregard memory order ensuring false sharing occurs
-        if constexpr (which)
-            data.object1.fetch_add(1, std::memory_order_relaxed);
-        else
-            data.object2.fetch_add(1, std::memory_order_relaxed);
-    }
-
-    const auto end_time = now();
-    std::chrono::duration<double, std::milli> total_time = end_time - start_time;
-
-    //Using the members to store the time. Since we need exactly 2 members in CacheLineShared struct, we cannot have a third one to store time
-    if constexpr (which)
-        data.object1 = total_time.count();
-    else
-        data.object2 = total_time.count();
+void stride_benchmark() {
+    CacheInfo caches[CACHE_MAX_LEVELS];
+    int cache_count = ReadCacheInfo(caches, CACHE_MAX_LEVELS);
+    size_t l2_size = stride_default_l2;
+    size_t memory_size = stride_min_buffer;
+    for (int i{0}; i < cache_count; i++)
+        if (caches[i].level == 2)
+            l2_size = caches[i].bytesize;
+    if (cache_count > 0)
+        memory_size = min(max(2 * static_cast<size_t>(caches[cache_count - 1].bytesize), stride_min_buffer), stride_max_buffer);
+    unsigned char* buffer = static_cast<unsigned char*>(aligned_alloc(4096, memory_size));
+    if (buffer == nullptr) {
+        cerr << "Could not allocate " << (memory_size >> 20) << " MB" << endl;
+        return;
+    }
+    memset(buffer, 0, memory_size);
+    std::mt19937_64 random(1);
+
+    cout << "stride, l2_nanoseconds, memory_nanoseconds" << endl;
+    for (size_t stride{8}; stride <= 1024; stride *= 2) {
+        double l2_ns = stride_chase(buffer, l2_size / 2, stride, random);
+        double memory_ns = stride_chase(buffer, memory_size, stride, random);
+        cout << stride << ", " << l2_ns << ", " << memory_ns << "\n";
+        cout.flush();
+    }
+    free(buffer);
 }
 
-int main() {
-
-    //specify all possible cache line size
-    constexpr size_t alignments[] = {16, 32, 64, 128, 256, 512, 1024, 2048, 4096};
-    cout << "stride, milliseconds" << endl;
-    //repeat measurement 10 times to ensure accuracy
-    for (int i{0}; i < 10; i++){
-        for (auto align : alignments) {
-            uint64_t time_taken = 0;
-
-            //lambda function to create structs with various alignments using templaet
-            auto run_test = [&]<size_t A>() {
-                CacheLineShared<A> shared_data;
-                std::thread t1(false_sharing<A, 0>, std::ref(shared_data));
-                std::thread t2(false_sharing<A, 1>, std::ref(shared_data));
-                t1.join();
-                t2.join();
-
-                //record time taken by calculating the total time it takes to modify both of the members, will be divide by 2 later on to get the singular access time
-                time_taken = shared_data.object1 + shared_data.object2;
-            };
-
-                switch (align) {
-                    case 16: run_test.operator()<16>(); break;
-                    case 32: run_test.operator()<32>(); break;
-                    case 64: run_test.operator()<64>(); break;
-                    case 128: run_test.operator()<128>(); break;
-                    case 256: run_test.operator()<256>(); break;
-                    case 512: run_test.operator()<512>(); break;
-                    case 1024: run_test.operator()<1024>(); break;
-                    case 2048: run_test.operator()<2048>(); break;
-                    case 4096: run_test.operator()<4096>(); break;
+// The one line the --matrix threads bounce between them, alone on its own
+// pair of lines so the adjacent-line prefetcher does not drag a neighbour along
+struct alignas(128) PingPongLine {
+    std::atomic_uint64_t value{};
+};
+
+/**
+ * One side of a ping-pong between two pinned threads
+ *
+ * The initiator writes odd values and waits for the next even one; the
+ * responder waits for each odd value and answers with the next even one. Each
+ * write has to take the line from the other core's cache, so a round trip is
+ * two cache-line transfers.
+ *
+ * @param line the shared line
+ * @param ready counts the threads that are pinned and spinning
+ * @param cpu the CPU to pin to
+ * @param initiator whether this thread writes first and times the rounds
+ * @param ns one-way transfer time in nanoseconds, set by the initiator
+ */
+void ping_pong(PingPongLine& line, std::atomic_int& ready, int cpu, bool initiator, double& ns) {
+    PinThreadToCpu(cpu);
+    ready.fetch_add(1);
+    while (ready.load() < 2) {}
+
+    if (initiator) {
+        const auto start_time{now()};
+        for (uint64_t round{}; round != matrix_rounds; round++) {
+            line.value.store(2 * round + 1, std::memory_order_release);
+            while (line.value.load(std::memory_order_acquire) != 2 * round + 2) {}
+        }
+        std::chrono::duration<double, std::nano> total_time = now() - start_time;
+        ns = total_time.count() / (2.0 * matrix_rounds);
+    } else {
+        for (uint64_t round{}; round != matrix_rounds; round++) {
+            while (line.value.load(std::memory_order_acquire) != 2 * round + 1) {}
+            line.value.store(2 * round + 2, std::memory_order_release);
+        }
+    }
+}
+
+// One-way cache-line transfer latency from cpu_i to cpu_j, in nanoseconds, the
+// fastest of matrix_repeats runs
+double transfer_latency(int cpu_i, int cpu_j) {
+    double best = 0.0;
+    for (int r{0}; r < matrix_repeats; r++) {
+        PingPongLine line;
+        std::atomic_int ready{0};
+        double ns = 0.0, unused = 0.0;
+        std::thread t1(ping_pong, std::ref(line), std::ref(ready), cpu_i, true, std::ref(ns));
+        std::thread t2(ping_pong, std::ref(line), std::ref(ready), cpu_j, false, std::ref(unused));
+        t1.join();
+        t2.join();
+        if (r == 0 || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+// The first CPU of a sysfs cpulist file of cpu, e.g. its SMT siblings, as the
+// key of the group it belongs to, or -1 if sysfs does not say
+int sysfs_group_key(int cpu, const char* file) {
+    char path[160];
+    char buf[256];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, file);
+    return (ReadSysfsLine(path, buf, sizeof(buf)) == 0) ? atoi(buf) : -1;
+}
+
+// The first CPU sharing the level 3 cache with cpu, or -1 if there is none
+int sysfs_l3_key(int cpu) {
+    char path[160];
+    char buf[256];
+    for (int index{0}; index < 16; index++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+        if (ReadSysfsLine(path, buf, sizeof(buf)) != 0)
+            break;
+        if (atoi(buf) != 3)
+            continue;
+        snprintf(path, sizeof(path), "cache/index%d/shared_cpu_list", index);
+        return sysfs_group_key(cpu, path);
+    }
+    return -1;
+}
+
+// Returns the representative of x in a union-find forest
+int find_group(vector<int>& parent, int x) {
+    while (parent[x] != x)
+        x = parent[x] = parent[parent[x]];
+    return x;
+}
+
+/**
+ * Core-to-core latency matrix
+ *
+ * Pins a pair of threads to every pair of CPUs in turn and ping-pongs one
+ * line between them. Prints the N x N matrix of one-way transfer latencies,
+ * then groups the CPUs: the sorted pair latencies fall into tiers, and the
+ * CPUs joined by the pairs of a tier and every faster one form the groups of
+ * that tier. Each tier is named from the sysfs topology its groups fit in,
+ * SMT siblings of one core, CPUs sharing an L3 (a CCX on AMD), or one socket,
+ * and the group of each CPU at each of those levels is printed after the
+ * matrix, as the lowest CPU of the group. A level no tier fits gets the
+ * groups of the widest tier below it, so a host with a single L3 or socket
+ * reports one group for it.
+ *
+ * @param cpus the CPUs to measure, in the order of the rows
+ */
+void latency_matrix(const vector<int>& cpus) {
+    int n = cpus.size();
+    vector<vector<double>> latency(n, vector<double>(n, 0.0));
+    for (int i{0}; i < n; i++) {
+        for (int j{0}; j < n; j++) {
+            if (i != j)
+                latency[i][j] = transfer_latency(cpus[i], cpus[j]);
+        }
+        cerr << "matrix: cpu " << cpus[i] << " done" << endl;
+    }
+
+    cout << "cpu";
+    for (int cpu : cpus)
+        cout << ", " << cpu;
+    cout << "\n" << fixed << setprecision(1);
+    for (int i{0}; i < n; i++) {
+        cout << cpus[i];
+        for (int j{0}; j < n; j++) {
+            if (i == j)
+                cout << ", -";
+            else
+                cout << ", " << latency[i][j];
+        }
+        cout << "\n";
+    }
+
+    // Pairs sorted by the mean of both directions, cut into tiers where the
+    // latency jumps by tier_ratio
+    struct PairLatency { double ns; int i; int j; };
+    vector<PairLatency> pairs;
+    for (int i{0}; i < n; i++)
+        for (int j{i + 1}; j < n; j++)
+            pairs.push_back({(latency[i][j] + latency[j][i]) / 2.0, i, j});
+    sort(pairs.begin(), pairs.end(), [](const PairLatency& a, const PairLatency& b) { return a.ns < b.ns; });
+
+    const char* const level_names[] = {"smt", "l3", "socket"};
+    vector<vector<int>> level_group(3, vector<int>(n));
+    for (int level{0}; level < 3; level++)
+        for (int i{0}; i < n; i++)
+            level_group[level][i] = cpus[i];
+    vector<int> parent(n);
+    for (int i{0}; i < n; i++)
+        parent[i] = i;
+
+    int tier = 0;
+    for (size_t p{0}; p < pairs.size(); p++) {
+        parent[find_group(parent, pairs[p].i)] = find_group(parent, pairs[p].j);
+        if (p + 1 < pairs.size() && pairs[p + 1].ns <= tier_ratio * pairs[p].ns)
+            continue;
+
+        // A tier is complete: name it after the smallest sysfs grouping every
+        // one of its groups fits in, or by its rank when sysfs does not say
+        tier++;
+        int level = -1;
+        bool known = true;
+        for (int candidate{0}; candidate < 3 && level < 0; candidate++) {
+            bool fits = true;
+            for (int i{0}; i < n; i++) {
+                int root = find_group(parent, i);
+                int key_i = (candidate == 0) ? sysfs_group_key(cpus[i], "topology/thread_siblings_list")
+                          : (candidate == 1) ? sysfs_l3_key(cpus[i])
+                          : sysfs_group_key(cpus[i], "topology/physical_package_id");
+                int key_root = (candidate == 0) ? sysfs_group_key(cpus[root], "topology/thread_siblings_list")
+                             : (candidate == 1) ? sysfs_l3_key(cpus[root])
+                             : sysfs_group_key(cpus[root], "topology/physical_package_id");
+                if (key_i < 0 || key_root < 0)
+                    known = false;
+                if (key_i != key_root)
+                    fits = false;
+            }
+            if (fits && known)
+                level = candidate;
+        }
+        if (!known)
+            level = min(tier - 1, 2);
+
+        cerr << "tier " << tier << ": up to " << fixed << setprecision(1) << pairs[p].ns << " ns, "
+             << ((level < 0) ? "cross-socket" : level_names[level]) << (known ? "" : " (no sysfs topology, by rank)")
+             << ", groups";
+        for (int i{0}; i < n; i++) {
+            if (find_group(parent, i) != i)
+                continue;
+            cerr << " {";
+            for (int k{0}, first{1}; k < n; k++) {
+                if (find_group(parent, k) == i) {
+                    cerr << (first ? "" : ",") << cpus[k];
+                    first = 0;
                 }
-                
-                //output data in csv format to stdout
-                cout << align << ", " << time_taken / 2 << "\n";
-                cout.flush();
             }
+            cerr << "}";
+        }
+        cerr << endl;
+
+        // The widest tier of a level wins. The groups also stand for every
+        // wider level until a later tier reaches it: with one L3, the tier
+        // that joins every CPU fits the L3 first and is the one socket too.
+        if (level >= 0) {
+            for (int i{0}; i < n; i++) {
+                int lowest = cpus[i];
+                for (int k{0}; k < n; k++)
+                    if (find_group(parent, k) == find_group(parent, i))
+                        lowest = min(lowest, cpus[k]);
+                for (int wider{level}; wider < 3; wider++)
+                    level_group[wider][i] = lowest;
+            }
+        }
+    }
+
+    cout << "\ncpu, smt_group, l3_group, socket_group\n";
+    for (int i{0}; i < n; i++)
+        cout << cpus[i] << ", " << level_group[0][i] << ", " << level_group[1][i] << ", " << level_group[2][i] << "\n";
+    cout.flush();
+}
+
+int main(int argc, char* argv[]) {
+
+    InitMeasureEnv(&gEnv);
+    bool matrix = false;
+    bool stride = false;
+    uint64_t iterations = default_iterations;
+    SamplingPolicy sampling;
+    InitSamplingPolicy(&sampling, min_repeats, default_repeats, ci_target, 0.0);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--matrix") == 0)
+            matrix = true;
+        else if (strcmp(argv[i], "--stride") == 0)
+            stride = true;
+        else if (strncmp(argv[i], "--iterations=", 13) == 0)
+            iterations = max(1ll, atoll(argv[i] + 13));
+        else if (strncmp(argv[i], "--repeats=", 10) == 0)
+            InitSamplingPolicy(&sampling, min_repeats, max(1, atoi(argv[i] + 10)), sampling.target, sampling.budget_ms);
+        else if (!ParseSamplingFlag(&sampling, argv[i]))
+            ParseMeasureEnvFlag(&gEnv, argv[i]);
+    }
+
+    if (matrix) {
+        //every CPU we may run on, or those --pin_cpu lists; each pair pins its own threads
+        vector<int> cpus(gEnv.cpus, gEnv.cpus + gEnv.cpu_count);
+        cpu_set_t allowed;
+        if (cpus.empty() && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+                if (CPU_ISSET(cpu, &allowed))
+                    cpus.push_back(cpu);
+        }
+        //a CPU listed twice would put both threads of a pair on it, spinning in turn
+        for (size_t i = 1; i < cpus.size(); i++)
+            if (find(cpus.begin(), cpus.begin() + i, cpus[i]) != cpus.begin() + i)
+                cpus.erase(cpus.begin() + i--);
+        gEnv.cpu_count = 0;
+        SetupMeasureEnv(&gEnv);
+        latency_matrix(cpus);
+        return 0;
+    }
+    SetupMeasureEnv(&gEnv);
+    if (stride) {
+        stride_benchmark();
+        return 0;
+    }
+
+    char perf_columns[256];
+    PerfCsvHeader(", ", perf_columns, sizeof(perf_columns));
+    cout << "stride, milliseconds" << perf_columns << endl;
+    SharedBuffer shared_data;
+    ThreadPair pair;
+    //repeat measurement to ensure accuracy, passing over every stride still
+    //sampling so slow drift hits all of them alike
+    constexpr size_t stride_count = sizeof(strides) / sizeof(strides[0]);
+    vector<Sampler> samplers(stride_count);
+    for (auto& sampler : samplers)
+        StartSampler(&sampler, &sampling);
+    for (bool sampling_left = true; sampling_left; ){
+        sampling_left = false;
+        for (size_t s{0}; s < stride_count; s++) {
+            if (SamplerDone(&samplers[s]))
+                continue;
+            size_t stride_bytes = strides[s];
+            PerfGroup perf1, perf2;
+            auto* counter1 = new (shared_data.bytes) std::atomic_uint64_t{0};
+            auto* counter2 = new (shared_data.bytes + stride_bytes / 2) std::atomic_uint64_t{0};
+
+            //record time taken by calculating the total time it takes to modify both of the members, will be divide by 2 later on to get the singular access time
+            double time_taken = pair.run(counter1, counter2, iterations, perf1, perf2);
+
+            //add up the counters of both threads, per increment
+            for (int c = 0; c < PERF_COUNTERS; c++)
+                perf1.value[c] += perf2.value[c];
+            PerfCsvValues(&perf1, 2.0 * iterations, ", ", perf_columns, sizeof(perf_columns));
+
+            //output data in csv format to stdout
+            cout << stride_bytes << ", " << time_taken / 2 << perf_columns << "\n";
+            cout.flush();
+            AddSample(&samplers[s], time_taken / 2);
+            sampling_left = sampling_left || !SamplerDone(&samplers[s]);
+        }
     }
     return 0;
 }
@@ -7,14 +7,15 @@ from datetime import datetime
 timestamp = datetime.now().strftime('%Y-%m-%d_%H-%M-%S')
 
 # Get output of Cache Line Size Detection Program and store in a csv
-def cache_linesize_output_obtain():
-    cmd = "./cache_linesize_benchmark"
+# args selects the method, [] for false sharing and ["--stride"] for the single-threaded cross-check
+def cache_linesize_output_obtain(args=[], name="data"):
+    cmd = ["./cache_linesize_benchmark"] + args
     
-    filename = f'cache_linesize_benchmark_data_{timestamp}.csv'
+    filename = f'cache_linesize_benchmark_{name}_{timestamp}.csv'
     
     # Open a subprocess to run the C++ program and capture stdout 
     process = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
-    print("Running Cache Line Size Detection Benchmark. Should take 15-20 seconds: ")
+    print(f"Running Cache Line Size Detection Benchmark {' '.join(args)}. Should take 15-20 seconds: ")
 
     # Open a CSV file to write the output data
     with open(filename, 'w', newline='') as csvfile:
@@ -33,30 +34,62 @@ def cache_linesize_output_obtain():
     process.stdout.close()
     process.wait()
     
-    return pd.read_csv(filename)
+    return pd.read_csv(filename, skipinitialspace=True)
 
-#Calculate Cache Line Size based on obtained output
+#Calculate the coherence granularity and prefetch pairing from the false sharing output
 def cache_linesize_output_calculation(data):
     keys = list(data.keys())
-    #Detect where there is at least a 70% drop in access time
+    shared = data[keys[0]]
+    unshared = min(data.values())
+    #A flat line means the counters never shared anything we could see, returning the biggest size
+    if shared < 1.7 * unshared:
+        return 4096, 4096
+    #The counters stop sharing a line where the time falls below the midpoint of the
+    #shared and unshared times, even if it falls in two steps
+    midpoint = (shared + unshared) / 2
+    granularity = keys[-1]
     for i in range(len(keys) - 1):
-        if data[keys[i]] >= 1.7 * data[keys[i + 1]]:
-            return keys[i]
-    #If no drop detected, indicating a flat line returning the biggest size
-    return 4096
+        if data[keys[i + 1]] < midpoint:
+            granularity = keys[i]
+            break
+    #Past the line, the adjacent-line prefetcher can still drag the other counter's line
+    #along; the last stride still 20% slower than the floor is the pair it fetches
+    pair = granularity
+    for key in keys:
+        if key > granularity and data[key] > 1.2 * unshared:
+            pair = key
+    return granularity, pair
+
+#First stride whose time is past the midpoint between the within-line times of the
+#smallest strides and the plateau of the largest ones
+def stride_step(data, start):
+    keys = list(data.keys())
+    low = min(data[key] for key in keys[:3])
+    high = sorted(data[key] for key in keys[-3:])[1]
+    return next((key for key in keys if key >= start and data[key] > (low + high) / 2), keys[-1])
+
+#Calculate the line size and prefetch pair size from the stride output: the step of
+#the L2-resident chase is the line, the step of the memory chase is the prefetch pair
+def stride_output_calculation(output):
+    strides = output.columns[0]
+    l2_data = output.set_index(strides)["l2_nanoseconds"].to_dict()
+    memory_data = output.set_index(strides)["memory_nanoseconds"].to_dict()
+    line = stride_step(l2_data, 0)
+    pair = stride_step(memory_data, line)
+    return line, pair
 
 #Visualization of Cache Line Size data
-def cache_linesize_output_visualization(data):
+def cache_linesize_output_visualization(data, ylabel='Time (Milliseconds)', name='graph'):
     # Plot the results
     plt.figure(figsize=(10, 6))
     plt.plot(list(data.keys()), list(data.values()), marker='o', linestyle='-', color = "blue", label = "Median")
     plt.xlabel('Cache Line Size (Bytes)')
-    plt.ylabel('Time (Milliseconds)')
+    plt.ylabel(ylabel)
     plt.title('Cache Line Size Graph: Access Time for different Sizes')
     plt.legend()
     plt.grid(True)
     plt.xscale('log', base=2)  # Use a logarithmic scale for the x-axis if needed
-    filename = f'cache_linesize_benchmark_graph_{timestamp}.png'
+    filename = f'cache_linesize_benchmark_{name}_{timestamp}.png'
     plt.savefig(filename)
     plt.close()
 
@@ -68,7 +101,20 @@ def cache_linesize_detection():
     processed_data = output.groupby(output.columns[0])[output.columns[1]].median().to_dict()
     #Visualizing the output
     cache_linesize_output_visualization(processed_data)
+    granularity, sharing_pair = cache_linesize_output_calculation(processed_data)
+
+    #Single-threaded cross-check
+    stride_output = cache_linesize_output_obtain(["--stride"], "stride")
+    stride_data = stride_output.set_index(stride_output.columns[0])["l2_nanoseconds"].to_dict()
+    cache_linesize_output_visualization(stride_data, 'Time per Block (Nanoseconds)', 'stride_graph')
+    line, pair = stride_output_calculation(stride_output)
+
     #Print out prediction
-    print("Cache Line Size predicted is:",cache_linesize_output_calculation(processed_data))
+    print("Coherence granularity predicted by false sharing is:", granularity)
+    print("Prefetch pair size seen by false sharing is:", sharing_pair)
+    print("Cache Line Size predicted by strides is:", line)
+    print("Prefetch pair size predicted by strides is:", pair)
+    if line != granularity:
+        print("The two methods disagree on the line size, run again with --pin_cpu=a,b on two cores that are not SMT siblings")
     
 cache_linesize_detection()
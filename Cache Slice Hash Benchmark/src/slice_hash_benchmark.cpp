@@ -0,0 +1,466 @@
+/*
+ * Program related to caches. It recovers how the last level cache spreads
+ * physical addresses over its slices.
+ *
+ * Intel splits the LLC into slices and picks the slice of a line by an
+ * undocumented hash of its physical address, so lines that agree in every
+ * set index bit can still land in different slices. This benchmark collects
+ * candidate lines that agree in the low address bits, i.e. in the L2 and LLC
+ * set index, and sorts them into classes that conflict with each other, by
+ * timing alone:
+ *   1. Take a victim line x and the remaining candidates. If loading all of
+ *      them evicts x from the LLC, they hold an eviction set for x.
+ *   2. Reduce them to a minimal eviction set by group testing: split the set
+ *      into ways + 1 groups, drop any group without which x is still evicted,
+ *      repeat until only about ways lines are left.
+ *   3. Every candidate that the minimal set evicts shares x's slice and set.
+ *      That is one class; remove it and start over with the rest.
+ * When the physical addresses are known, the classes are then fitted with a
+ * linear (XOR) hash of the address bits, the form Intel uses for a power of
+ * two number of slices.
+ *
+ * The classes go to stdout in csv format, the hash masks to a file that the
+ * L3 associativity test and page-colouring experiments can read, see
+ * common/slicehash.h.
+ *
+ * Copyright (c) 2024 Christ Lin
+ *
+ * Modifications were made by the Laboratory for Physical Science (LPS) team
+ * from the Applied Methods and Research Experience (AMRE) program, 2024.
+ *
+ * Note that due to the sensitivity of how caches work, it's better to close all other background programs to run the test.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <x86intrin.h>
+
+#include "cacheinfo.h"
+#include "measureenv.h"
+#include "pagealloc.h"
+#include "physaddr.h"
+#include "slicehash.h"
+
+// Each eviction test is repeated this many times and the majority decides
+static const int kVotes = 5;
+// How often an eviction set is walked, forward and back, per test. More than
+// one pass lets the lines win against the LLC's adaptive replacement.
+static const int kPasses = 2;
+// Victims whose reduction fails are retried this many times before the next
+// one is tried
+static const int kRetries = 3;
+// Loads timed for the threshold calibration
+static const int kCalibrationLoads = 1001;
+// Default arena size, as a multiple of the LLC size
+static const int kPoolPerLlc = 2;
+// Defaults when sysfs does not describe the caches
+static const int64_t kDefaultLlcBytes = 32ll << 20;
+static const int kDefaultLlcWays = 16;
+static const int64_t kDefaultStride = 128 << 10;
+
+// One candidate line
+struct Candidate {
+  uint8_t* line;
+  int64_t offset;       // byte offset in the arena
+  uint64_t address;     // physical address, or the offset in its huge page, see gAddressKnown
+  int cls;              // class, -1 while unclassified
+};
+
+// What Candidate::address holds: 2 for full physical addresses from pagemap,
+// 1 for offsets into one 1 GB page, whose page base is the same for all of
+// them, 0 for offsets that cannot be compared across pages
+static int gAddressKnown = 0;
+
+// Times one load of p, in TSC ticks
+static inline uint64_t TimeLoad(const uint8_t* p) {
+  unsigned int aux;
+  _mm_mfence();
+  uint64_t start = __rdtscp(&aux);
+  (void)*(const volatile uint8_t*)p;
+  uint64_t end = __rdtscp(&aux);
+  _mm_lfence();
+  return end - start;
+}
+
+// Loads every line of set, forward then back, kPasses times
+static inline void Walk(const std::vector<uint8_t*>& set) {
+  for (int pass = 0; pass < kPasses; ++pass) {
+    for (size_t i = 0; i < set.size(); ++i) {(void)*(volatile uint8_t*)set[i];}
+    for (size_t i = set.size(); i-- > 0;) {(void)*(volatile uint8_t*)set[i];}
+  }
+}
+
+// True if loading set evicts x from every cache level, by majority vote
+static bool Evicts(const std::vector<uint8_t*>& set, uint8_t* x, uint64_t threshold) {
+  int evicted = 0;
+  for (int vote = 0; vote < kVotes; ++vote) {
+    (void)*(volatile uint8_t*)x;
+    _mm_mfence();
+    Walk(set);
+    if (TimeLoad(x) > threshold) {++evicted;}
+    // Settle early either way
+    if (evicted > kVotes / 2 || vote + 1 - evicted > kVotes / 2) {break;}
+  }
+  return evicted > kVotes / 2;
+}
+
+// The time threshold between an LLC hit and a miss to memory. The hit time is
+// that of x after walking candidates that fill its L2 set but are far too few
+// to fill its LLC set; the miss time that of x after clflush.
+static uint64_t CalibrateThreshold(const std::vector<Candidate>& pool, int l2_ways,
+                                   uint64_t* hit_time, uint64_t* miss_time) {
+  std::vector<uint8_t*> l2_set;
+  for (int i = 1; i <= 2 * l2_ways && i < static_cast<int>(pool.size()); ++i) {
+    l2_set.push_back(pool[i].line);
+  }
+  uint8_t* x = pool[0].line;
+  std::vector<uint64_t> hits, misses;
+  for (int i = 0; i < kCalibrationLoads; ++i) {
+    (void)*(volatile uint8_t*)x;
+    Walk(l2_set);
+    hits.push_back(TimeLoad(x));
+    _mm_clflush(x);
+    _mm_mfence();
+    misses.push_back(TimeLoad(x));
+  }
+  std::sort(hits.begin(), hits.end());
+  std::sort(misses.begin(), misses.end());
+  *hit_time = hits[hits.size() / 2];
+  *miss_time = misses[misses.size() / 2];
+  return (*hit_time + *miss_time) / 2;
+}
+
+// Reduces set, which evicts x, to a minimal eviction set of about ways lines
+// by group testing. Returns it, or an empty set if the reduction got stuck
+// far above ways lines, which means noise or an x that is not evictable.
+static std::vector<uint8_t*> Reduce(std::vector<uint8_t*> set, uint8_t* x, int ways, uint64_t threshold) {
+  while (static_cast<int>(set.size()) > ways) {
+    int groups = ways + 1;
+    bool reduced = false;
+    for (int g = 0; g < groups && !reduced; ++g) {
+      size_t begin = set.size() * g / groups;
+      size_t end = set.size() * (g + 1) / groups;
+      if (begin == end) {continue;}
+      std::vector<uint8_t*> rest(set.begin(), set.begin() + begin);
+      rest.insert(rest.end(), set.begin() + end, set.end());
+      if (Evicts(rest, x, threshold)) {
+        set.swap(rest);
+        reduced = true;
+      }
+    }
+    if (!reduced) {
+      // No group can go: every line left is needed, so the LLC has more
+      // ways than sysfs said, or the tests are too noisy to go on
+      if (static_cast<int>(set.size()) <= 2 * ways) {break;}
+      return std::vector<uint8_t*>();
+    }
+  }
+  return set;
+}
+
+// Collects the candidate lines of the arena: every line at offset modulo
+// stride in physical address. Returns them in random order.
+static std::vector<Candidate> CollectCandidates(const Arena& arena, int64_t stride, int64_t offset,
+                                                int pagemap_fd, uint64_t seed) {
+  std::vector<Candidate> pool;
+  int64_t pagesize = 4096;
+  if (arena.mode == PAGE_MODE_2M) {pagesize = 1ll << 21;}
+  if (arena.mode == PAGE_MODE_1G) {pagesize = 1ll << 30;}
+  if (arena.mode == PAGE_MODE_2M || arena.mode == PAGE_MODE_1G) {
+    // Huge pages are physically aligned, so their low bits are physical
+    for (int64_t at = offset; at < static_cast<int64_t>(arena.bytesize); at += stride) {
+      Candidate c = {arena.ptr + at, at, 0, -1};
+      c.line[0] = 1;
+      c.address = (gAddressKnown == 2) ? PhysicalAddress(pagemap_fd, c.line) : static_cast<uint64_t>(at % pagesize);
+      pool.push_back(c);
+    }
+  } else {
+    // 4KB pages: fault every page in and keep the lines whose physical
+    // address lands at offset
+    for (int64_t page = 0; page < static_cast<int64_t>(arena.bytesize); page += pagesize) {
+      arena.ptr[page] = 1;
+      uint64_t physical = PhysicalAddress(pagemap_fd, arena.ptr + page);
+      if (physical == 0) {continue;}
+      int64_t in_page = (offset - static_cast<int64_t>(physical % stride) + stride) % stride;
+      if (in_page >= pagesize) {continue;}
+      Candidate c = {arena.ptr + page + in_page, page + in_page, physical + in_page, -1};
+      c.line[0] = 1;
+      pool.push_back(c);
+    }
+  }
+  std::mt19937_64 rng(seed);
+  std::shuffle(pool.begin(), pool.end(), rng);
+  return pool;
+}
+
+// Sorts the pool into conflict classes, see the top of the file. Returns the
+// number of classes and the eviction set sizes found.
+static int Classify(std::vector<Candidate>& pool, int ways, uint64_t threshold, std::vector<int>* set_sizes) {
+  std::vector<int> remaining;
+  for (size_t i = 0; i < pool.size(); ++i) {remaining.push_back(static_cast<int>(i));}
+  int classes = 0;
+  // Victims in a row that gave no eviction set; once every remaining line has
+  // failed, the rest cannot be classified
+  size_t failures = 0;
+  while (static_cast<int>(remaining.size()) > ways && failures < remaining.size()) {
+    int victim = remaining[0];
+    uint8_t* x = pool[victim].line;
+    std::vector<uint8_t*> rest;
+    for (size_t i = 1; i < remaining.size(); ++i) {rest.push_back(pool[remaining[i]].line);}
+
+    std::vector<uint8_t*> evset;
+    for (int attempt = 0; attempt < kRetries && evset.empty(); ++attempt) {
+      if (Evicts(rest, x, threshold)) {evset = Reduce(rest, x, ways, threshold);}
+    }
+    if (evset.empty()) {
+      // Too few lines of x's class are left to evict it, or noise: go on with
+      // the next victim
+      remaining.erase(remaining.begin());
+      remaining.push_back(victim);
+      ++failures;
+      continue;
+    }
+    failures = 0;
+
+    // The class: x, and every remaining line the minimal set evicts
+    std::vector<int> next;
+    int members = 0;
+    for (size_t i = 0; i < remaining.size(); ++i) {
+      Candidate& c = pool[remaining[i]];
+      bool in_set = std::find(evset.begin(), evset.end(), c.line) != evset.end();
+      if (remaining[i] == victim || in_set || Evicts(evset, c.line, threshold)) {
+        c.cls = classes;
+        ++members;
+      } else {
+        next.push_back(remaining[i]);
+      }
+    }
+    fprintf(stderr, "class %d: %d lines, minimal eviction set of %zu\n", classes, members, evset.size());
+    set_sizes->push_back(static_cast<int>(evset.size()));
+    remaining.swap(next);
+    ++classes;
+  }
+  return classes;
+}
+
+// Fits a linear slice hash to the classes: bit i of the slice is the parity of
+// address & mask[i]. Two lines of one class must hash alike, so every XOR of
+// two same-class addresses is in the kernel of the hash; the masks are a basis
+// of the vectors orthogonal to that kernel, over the address bits that vary
+// in the pool. Returns 0 and fills hash if the fit explains every class.
+static int FitSliceHash(const std::vector<Candidate>& pool, int classes, SliceHash* hash) {
+  // The kernel, kept fully reduced: rows[i] has pivot bit pivots[i], which no
+  // other row has set
+  std::vector<uint64_t> rows;
+  std::vector<int> pivots;
+  std::vector<int64_t> first(classes, -1);
+  uint64_t varying = 0;
+  for (size_t i = 0; i < pool.size(); ++i) {
+    if (pool[i].cls < 0) {continue;}
+    if (first[pool[i].cls] < 0) {
+      first[pool[i].cls] = static_cast<int64_t>(i);
+      continue;
+    }
+    uint64_t v = pool[i].address ^ pool[first[pool[i].cls]].address;
+    varying |= v;
+    for (size_t r = 0; r < rows.size(); ++r) {
+      if ((v >> pivots[r]) & 1) {v ^= rows[r];}
+    }
+    if (v == 0) {continue;}
+    int pivot = 63 - __builtin_clzll(v);
+    for (size_t r = 0; r < rows.size(); ++r) {
+      if ((rows[r] >> pivot) & 1) {rows[r] ^= v;}
+    }
+    rows.push_back(v);
+    pivots.push_back(pivot);
+  }
+  for (size_t i = 0; i < pool.size(); ++i) {
+    if (pool[i].cls >= 0) {varying |= pool[i].address ^ pool[first[0]].address;}
+  }
+
+  // One mask per varying bit that is not a pivot of the kernel
+  hash->bits = 0;
+  for (int bit = 0; bit < 64; ++bit) {
+    if (((varying >> bit) & 1) == 0) {continue;}
+    if (std::find(pivots.begin(), pivots.end(), bit) != pivots.end()) {continue;}
+    if (hash->bits == SLICE_MAX_BITS) {return -1;}
+    uint64_t mask = 1ull << bit;
+    for (size_t r = 0; r < rows.size(); ++r) {
+      if ((rows[r] >> bit) & 1) {mask |= 1ull << pivots[r];}
+    }
+    hash->mask[hash->bits++] = mask;
+  }
+  if ((1 << hash->bits) != classes) {return -1;}
+
+  // Every class must get its own slice number
+  std::vector<int> slice_of_class(classes, -1);
+  std::vector<bool> used(classes, false);
+  for (size_t i = 0; i < pool.size(); ++i) {
+    if (pool[i].cls < 0) {continue;}
+    int slice = SliceOf(hash, pool[i].address);
+    if (slice_of_class[pool[i].cls] < 0) {
+      if (used[slice]) {return -1;}
+      used[slice] = true;
+      slice_of_class[pool[i].cls] = slice;
+    } else if (slice_of_class[pool[i].cls] != slice) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  double pool_size_mb = 0.0;     // 0 means kPoolPerLlc times the LLC size
+  int64_t stride = 0;            // 0 means the L2 set stride from sysfs
+  int64_t offset = 0xfc0;
+  int ways = 0;                  // 0 means the LLC ways from sysfs
+  uint64_t threshold = 0;        // 0 means calibrate
+  uint64_t seed = 1;
+  bool ways_given = false;
+  int page_mode = PAGE_MODE_2M;
+  const char* hash_file = "slice_hash.txt";
+  MeasureEnv env;
+  InitMeasureEnv(&env);
+
+  for (int i = 1; i < argc; ++i) {
+    if (std::strncmp(argv[i], "--pool_size=", 12) == 0) {
+      pool_size_mb = std::atof(argv[i] + 12);
+    } else if (std::strncmp(argv[i], "--stride=", 9) == 0) {
+      stride = std::atoll(argv[i] + 9) * 1024;
+    } else if (std::strncmp(argv[i], "--offset=", 9) == 0) {
+      offset = std::strtoll(argv[i] + 9, NULL, 0);
+    } else if (std::strncmp(argv[i], "--ways=", 7) == 0) {
+      ways = std::atoi(argv[i] + 7);
+      ways_given = ways > 0;
+    } else if (std::strncmp(argv[i], "--threshold=", 12) == 0) {
+      threshold = std::strtoull(argv[i] + 12, NULL, 10);
+    } else if (std::strncmp(argv[i], "--seed=", 7) == 0) {
+      seed = std::strtoull(argv[i] + 7, NULL, 10);
+    } else if (std::strncmp(argv[i], "--hash_file=", 12) == 0) {
+      hash_file = argv[i] + 12;
+    } else if (std::strncmp(argv[i], "--page_mode=", 12) == 0) {
+      page_mode = ParsePageMode(argv[i] + 12);
+      if (page_mode < 0 || page_mode == PAGE_MODE_THP) {
+        fprintf(stderr, "Unknown --page_mode, use 4k, 2m or 1g\n");
+        return 1;
+      }
+    } else {
+      ParseMeasureEnvFlag(&env, argv[i]);
+    }
+  }
+  SetupMeasureEnv(&env);
+
+  // The LLC size and ways, and the L2 set stride: candidates one stride apart
+  // share their L2 set and, on every Intel part so far, their set within an
+  // LLC slice
+  CacheInfo caches[CACHE_MAX_LEVELS];
+  int cache_count = ReadCacheHints(caches, CACHE_MAX_LEVELS);
+  int64_t llc_bytes = kDefaultLlcBytes;
+  int l2_ways = 16;
+  if (cache_count > 0) {
+    llc_bytes = caches[cache_count - 1].bytesize;
+    if (ways == 0) {ways = caches[cache_count - 1].ways;}
+  }
+  for (int i = 0; i < cache_count; ++i) {
+    if (caches[i].level != 2 || caches[i].ways <= 0) {continue;}
+    l2_ways = caches[i].ways;
+    if (stride == 0) {stride = caches[i].bytesize / caches[i].ways;}
+  }
+  if (ways <= 0) {ways = kDefaultLlcWays;}
+  // A non-inclusive LLC keeps a line the L2 still holds out of its own ways,
+  // so an eviction set must overflow both
+  int inclusive = (cache_count > 0) ? caches[cache_count - 1].inclusive : -1;
+  if (inclusive == 0 && !ways_given) {ways += l2_ways;}
+  if (inclusive == 0) {
+    fprintf(stderr, "The LLC is not inclusive: eviction sets also fill the L2, whose victims the LLC does not always keep, so classes may merge\n");
+  }
+  if (stride <= 0 || (stride & (stride - 1)) != 0) {stride = kDefaultStride;}
+  offset = (offset % stride) & ~63ll;
+  size_t pool_bytes = (pool_size_mb > 0.0) ? static_cast<size_t>(pool_size_mb * 1024 * 1024)
+                                           : static_cast<size_t>(kPoolPerLlc * llc_bytes);
+
+  Arena arena;
+  if (AllocArena(&arena, pool_bytes, page_mode) != 0) {
+    fprintf(stderr, "Could not allocate %zu bytes\n", pool_bytes);
+    return 1;
+  }
+  int pagemap_fd = PagemapOpen();
+  arena.ptr[0] = 1;
+  if (PhysicalAddress(pagemap_fd, arena.ptr) != 0) {
+    gAddressKnown = 2;
+  } else if (arena.mode == PAGE_MODE_1G && pool_bytes <= (1ull << 30)) {
+    gAddressKnown = 1;
+  } else if (arena.mode == PAGE_MODE_4K) {
+    fprintf(stderr, "With 4k pages the physical addresses are needed: run as root, or reserve huge pages for --page_mode=2m\n");
+    FreeArena(&arena);
+    return 1;
+  }
+  if (arena.mode == PAGE_MODE_2M && stride > (1ll << 21)) {
+    fprintf(stderr, "A stride of %lld KB needs --page_mode=1g or pagemap\n", static_cast<long long>(stride >> 10));
+    FreeArena(&arena);
+    return 1;
+  }
+
+  std::vector<Candidate> pool = CollectCandidates(arena, stride, offset, pagemap_fd, seed);
+  fprintf(stderr, "%zu candidate lines, %lld KB apart, in a %zu MB %s arena; eviction sets of %d lines\n", pool.size(),
+          static_cast<long long>(stride >> 10), pool_bytes >> 20, PageModeName(arena.mode), ways);
+  if (static_cast<int>(pool.size()) <= 2 * ways) {
+    fprintf(stderr, "Too few candidates, use a bigger --pool_size\n");
+    FreeArena(&arena);
+    return 1;
+  }
+  uint64_t hit_time = 0, miss_time = 0;
+  uint64_t calibrated = CalibrateThreshold(pool, l2_ways, &hit_time, &miss_time);
+  if (threshold == 0) {threshold = calibrated;}
+  fprintf(stderr, "LLC hit %llu, memory %llu, threshold %llu ticks\n", static_cast<unsigned long long>(hit_time),
+          static_cast<unsigned long long>(miss_time), static_cast<unsigned long long>(threshold));
+
+  std::vector<int> set_sizes;
+  int classes = Classify(pool, ways, threshold, &set_sizes);
+
+  std::cout << "offset, physical_address, class" << std::endl;
+  int classified = 0;
+  for (size_t i = 0; i < pool.size(); ++i) {
+    char address[32] = "-";
+    if (gAddressKnown == 2) {snprintf(address, sizeof(address), "0x%llx", static_cast<unsigned long long>(pool[i].address));}
+    std::cout << pool[i].offset << ", " << address << ", " << pool[i].cls << std::endl;
+    if (pool[i].cls >= 0) {++classified;}
+  }
+  if (!set_sizes.empty()) {
+    std::sort(set_sizes.begin(), set_sizes.end());
+    fprintf(stderr, "%d classes, %d of %zu lines classified, median minimal eviction set %d lines\n", classes,
+            classified, pool.size(), set_sizes[set_sizes.size() / 2]);
+  } else {
+    fprintf(stderr, "No eviction set found, check the threshold\n");
+  }
+
+  if (classes > 1 && gAddressKnown == 0) {
+    fprintf(stderr, "No hash fit: the physical addresses are unknown, run as root or use --page_mode=1g\n");
+  } else if (classes > 1) {
+    SliceHash hash;
+    if (FitSliceHash(pool, classes, &hash) != 0) {
+      fprintf(stderr, "The classes do not follow a linear hash of the address bits, not a power of two slices?\n");
+    } else {
+      char comment[160];
+      snprintf(comment, sizeof(comment), "slice hash of the %s address bits from %lld up, lines compared must agree below",
+               (gAddressKnown == 2) ? "physical" : "1 GB page offset", static_cast<long long>(__builtin_ctzll(stride)));
+      WriteSliceHash(hash_file, &hash, comment);
+      for (int i = 0; i < hash.bits; ++i) {
+        fprintf(stderr, "slice bit %d: mask 0x%llx\n", i, static_cast<unsigned long long>(hash.mask[i]));
+      }
+      fprintf(stderr, "written to %s\n", hash_file);
+    }
+  }
+
+  PagemapClose(pagemap_fd);
+  FreeArena(&arena);
+  return 0;
+}
@@ -0,0 +1,411 @@
+/*
+ * Program related to address translation. It finds how many pages each level
+ * of the data TLB maps, how associative each level is, and what a load pays
+ * for a page walk, for 4 KB, 2 MB and 1 GB pages.
+ *
+ * The benchmark chases one line per page, see MakePageList() in
+ * common/pairlist.h, so every load needs a translation of its own:
+ *   1. Capacity sweep: cycles of 1 page up to --max_pages pages, 8 counts per
+ *      doubling, pages adjacent. The latency is flat while the cycle fits in
+ *      the L1 dTLB, climbs to a second plateau once it needs the STLB, and to
+ *      a third once it misses both and every load walks the page table. The
+ *      plateaus are split as the hierarchy sweep of the L3 size benchmark
+ *      splits cache levels, see common/plateaus.h; a level's entry count is
+ *      where the climb past it crosses the midpoint of the two latencies.
+ *      The first --tlb_levels plateaus (2, as on every current x86 core) are
+ *      TLB levels; the walk can step up again later, e.g. once the page table
+ *      entries outgrow a cache, or under nested paging in a VM, so every
+ *      plateau after them is a tier of the page walk.
+ *   2. Associativity sweep, for every TLB level found: cycles of 1, 2, 3, ...
+ *      pages, each the level's entry count rounded up to a power of two
+ *      pages apart, so they share one set of it if it is indexed by the low
+ *      page number bits. The latency crosses the same midpoint once there are
+ *      more pages than the level has ways. Some STLBs hash higher page number
+ *      bits into the index, so the pages still spread over a few sets and
+ *      the crossing comes at a multiple of the ways; the stride is doubled
+ *      for as long as that lowers the crossing.
+ * Lines one per page occupy as many data cache lines as the pages, and once
+ * those outgrow the L1D the data misses would look like TLB misses. Every
+ * point is therefore also timed on as many lines packed densely, a few pages
+ * in all, and the translation latency is the page chase minus that, plus the
+ * latency of an L1D hit.
+ *
+ * Output is csv on stdout, one row per sample, with a summary per page size
+ * on stderr.
+ *
+ * Copyright (c) 2024 Christ Lin
+ *
+ * Modifications were made by the Laboratory for Physical Science (LPS) team
+ * from the Applied Methods and Research Experience (AMRE) program, 2024.
+ *
+ * Note that due to the sensitivity of how caches work, it's better to close all other background programs to run the test.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "basetypes.h"
+#include "cacheinfo.h"
+#include "measureenv.h"
+#include "pagealloc.h"
+#include "pairlist.h"
+#include "perfcounters.h"
+#include "plateaus.h"
+#include "sampling.h"
+#include "timecounters.h"
+
+// Capacity sweep counts per doubling of the pages
+static const int kPointsPerOctave = 8;
+// TLB levels before the page walk, --tlb_levels=
+static const int kDefaultTlbLevels = 2;
+// Most pages of the capacity sweep per page mode, 4k, thp, 2m and 1g: 64 MB
+// of 4 KB pages is past any STLB, and the huge page modes stop at the free
+// huge pages anyway
+static const int64 kDefaultMaxPages[] = {16384, 4096, 4096, 64};
+// Most pages of an associativity sweep, and how often its stride is doubled
+static const int kMaxWays = 64;
+static const int kMaxStrideDoublings = 5;
+// Most address space an associativity sweep may reserve. Only the lines it
+// walks are touched, so this is address space, not memory.
+static const int64 kMaxSweepBytes = 1ll << 40;
+// Loads timed per sample, at least; a cycle of more pages is walked 8 times
+static const int64 kMinLoads = 1 << 17;
+// Lines of the L1D hit latency measurement
+static const int kL1Lines = 16;
+static const int kDefaultLineSize = 64;
+
+// Sampling of every point, see sampling.h: at least kMinSamples rows, at most
+// kMaxSamples, done once the median is known to within kCiTarget or after
+// kPointBudgetMs. --ci_target=, --time_budget= and --max_samples= change it.
+static const int kMinSamples = 5;
+static const int kMaxSamples = 11;
+static const double kCiTarget = 0.05;
+static const double kPointBudgetMs = 200.0;
+static SamplingPolicy gSampling;
+
+// Hardware counters around each timed page chase, see perfcounters.h
+static PerfGroup gPerf;
+
+// Seed of every list, --seed=
+static uint64 gListSeed = 1;
+
+// The end of every walk, so the compiler cannot drop the loads
+static const Pair* volatile gSink = NULL;
+
+// What the sweeps found at one plateau: a level of the TLB, or a tier of the
+// page walk
+struct TlbLevel {
+  double entries;   // pages it maps, 0 for the last plateau
+  double latency;   // translation latency of its plateau, in cycles per load
+  int ways;         // 0 if not measured
+  int ways_limit;   // the most pages its associativity sweep tried
+};
+
+// Walks warmup loads of the cycle from start untimed, then loads timed.
+// Returns cycles per load. With counted, the hardware counters cover the
+// timed loads.
+double ChaseCycles(const Pair* start, int64 warmup, int64 loads, bool counted) {
+  const Pair* pairptr = start;
+  for (int64 i = 0; i < warmup; ++i) {pairptr = pairptr->next;}
+  if (counted) {PerfGroupStart(&gPerf);}
+  int64 startcy = GetCycles();
+  for (int64 i = 0; i < loads; ++i) {pairptr = pairptr->next;}
+  int64 stopcy = GetCycles();
+  if (counted) {PerfGroupStop(&gPerf);}
+  gSink = pairptr;
+  return static_cast<double>(stopcy - startcy) / loads;
+}
+
+// Cycles of an L1D hit: a cycle of kL1Lines lines, sampled
+double L1HitCycles(const Arena* dense, int linesize) {
+  const Pair* lines = MakeRandomList(dense->ptr, kL1Lines * linesize, linesize, kListRandom, gListSeed);
+  Sampler sampler;
+  StartSampler(&sampler, &gSampling);
+  do {
+    AddSample(&sampler, ChaseCycles(lines, kL1Lines, kMinLoads, false));
+  } while (!SamplerDone(&sampler));
+  return SamplerMedian(&sampler);
+}
+
+// Free huge pages of the given size in bytes, from sysfs
+int64 FreeHugePages(int64 pagesize) {
+  char path[128];
+  char buf[64];
+  snprintf(path, sizeof(path), "/sys/kernel/mm/hugepages/hugepages-%lldkB/free_hugepages",
+           static_cast<long long>(pagesize >> 10));
+  return (ReadSysfsLine(path, buf, sizeof(buf)) == 0) ? atoll(buf) : 0;
+}
+
+// The pages an arena of the mode can have: the free huge pages for explicit
+// huge pages, otherwise as many as fit in limit bytes of address space
+int64 AvailablePages(int mode, int64 pagesize, int64 limit) {
+  if (mode == PAGE_MODE_2M || mode == PAGE_MODE_1G) {return FreeHugePages(pagesize);}
+  return limit / pagesize;
+}
+
+// One sweep point: count pages stride_pages apart, and count lines packed
+// densely. Prints a row per sample. Returns the median translation latency,
+// the page chase minus the dense chase plus l1_cycles.
+double SamplePoint(const char* mode_name, const char* sweep, const Arena* pages_arena, int64 pagesize,
+                   int64 stride_pages, int64 count, const Arena* dense, int linesize, double l1_cycles) {
+  const Pair* pages = MakePageList(pages_arena->ptr, count, stride_pages * pagesize, pagesize, linesize, gListSeed);
+  const Pair* lines = MakeRandomList(dense->ptr, count * linesize, linesize, kListPageLocal, gListSeed);
+  int64 loads = std::max(kMinLoads, 8 * count);
+  Sampler sampler;
+  StartSampler(&sampler, &gSampling);
+  do {
+    double page_cycles = ChaseCycles(pages, 2 * count, loads, true);
+    char perf[256];
+    PerfCsvValues(&gPerf, static_cast<double>(loads), ", ", perf, sizeof(perf));
+    double dense_cycles = ChaseCycles(lines, 2 * count, loads, false);
+    // Never below a cycle, so the plateau split can take its log
+    double translation = std::max(1.0, page_cycles - dense_cycles + l1_cycles);
+    printf("%s, %s, %lld, %lld, %.2f, %.2f, %.2f%s\n", mode_name, sweep, static_cast<long long>(count),
+           static_cast<long long>(stride_pages), page_cycles, dense_cycles, translation, perf);
+    AddSample(&sampler, translation);
+  } while (!SamplerDone(&sampler));
+  fflush(stdout);
+  return SamplerMedian(&sampler);
+}
+
+// Capacity sweep over 1 to max_pages adjacent pages. Fills levels with every
+// plateau.
+void CapacitySweep(const char* mode_name, const Arena* arena, int64 pagesize, int64 max_pages, const Arena* dense,
+                   int linesize, double l1_cycles, std::vector<TlbLevel>* levels) {
+  std::vector<double> sizes;
+  std::vector<double> latency;
+  for (int k = 0; ; ++k) {
+    int64 count = llround(pow(2.0, static_cast<double>(k) / kPointsPerOctave));
+    if (count > max_pages) {break;}
+    if (!sizes.empty() && count == static_cast<int64>(sizes.back())) {continue;}
+    sizes.push_back(count);
+    latency.push_back(SamplePoint(mode_name, "capacity", arena, pagesize, 1, count, dense, linesize, l1_cycles));
+  }
+
+  std::vector<Plateau> plateaus = FindPlateaus(latency, kPointsPerOctave);
+  // Below 16 pages there are fewer distinct counts than kPointsPerOctave per
+  // doubling, so a level of a few entries, such as the dTLB of 1 GB pages, is
+  // too short for a plateau. Whatever comes before the first plateau is one.
+  if (plateaus[0].first > 0) {
+    std::vector<double> values(latency.begin(), latency.begin() + plateaus[0].first);
+    std::sort(values.begin(), values.end());
+    Plateau first = {0, plateaus[0].first - 1, values[values.size() / 2]};
+    if (first.latency * (1.0 + kPlateauTolerance) < plateaus[0].latency) {
+      plateaus.insert(plateaus.begin(), first);
+    } else {
+      plateaus[0].first = 0;
+    }
+  }
+  for (size_t p = 0; p < plateaus.size(); ++p) {
+    double entries = (p + 1 < plateaus.size()) ? PlateauCapacity(latency, sizes, plateaus, p) : 0.0;
+    TlbLevel level = {entries, plateaus[p].latency, 0, 0};
+    levels->push_back(level);
+  }
+}
+
+// Associativity sweep of levels[p]: 1, 2, 3, ... pages that all share one set
+// of it, until two counts in a row are slower than the midpoint between its
+// latency and the next plateau's. The count before those is the ways at that
+// stride; the stride is doubled until the ways stop going down, at most
+// kMaxStrideDoublings times, and the level's ways are the fewest found. They
+// stay 0 if no stride found any.
+void WaysSweep(const char* mode_name, int mode, int64 pagesize, const Arena* dense, int linesize, double l1_cycles,
+               std::vector<TlbLevel>* levels, size_t p) {
+  TlbLevel* level = &(*levels)[p];
+  double midpoint = (level->latency + (*levels)[p + 1].latency) / 2.0;
+  int64 stride = 1;
+  while (stride < llround(level->entries)) {stride *= 2;}
+  for (int doubling = 0; doubling <= kMaxStrideDoublings; ++doubling, stride *= 2) {
+    int64 most = std::min(static_cast<int64>(kMaxWays), AvailablePages(mode, pagesize, kMaxSweepBytes) / stride);
+    if (most < 2) {
+      if (doubling == 0) {
+        fprintf(stderr, "%s: too few pages for the associativity of %lld entries, %lld pages apart\n", mode_name,
+                static_cast<long long>(llround(level->entries)), static_cast<long long>(stride));
+      }
+      return;
+    }
+    Arena arena;
+    if (AllocArena(&arena, most * stride * pagesize, mode) != 0 || arena.mode != mode) {
+      fprintf(stderr, "%s: could not map %lld pages for the associativity sweep\n", mode_name,
+              static_cast<long long>(most * stride));
+      if (arena.rawptr != NULL) {FreeArena(&arena);}
+      return;
+    }
+    if (level->ways == 0) {level->ways_limit = most;}
+    char sweep[32];
+    snprintf(sweep, sizeof(sweep), "ways%d", static_cast<int>(p) + 1);
+    int ways = 0;
+    int above = 0;
+    for (int64 count = 1; count <= most; ++count) {
+      double latency = SamplePoint(mode_name, sweep, &arena, pagesize, stride, count, dense, linesize, l1_cycles);
+      above = (latency > midpoint) ? above + 1 : 0;
+      if (above == 2) {
+        ways = count - 2;
+        break;
+      }
+    }
+    FreeArena(&arena);
+    if (level->ways > 0 && (ways == 0 || ways >= level->ways)) {return;}
+    if (ways > 0) {level->ways = ways;}
+  }
+}
+
+// Name of TLB level p, counting from 0
+std::string TlbLevelName(size_t p) {
+  if (p == 0) {return "dTLB";}
+  if (p == 1) {return "STLB";}
+  char name[32];
+  snprintf(name, sizeof(name), "L%d TLB", static_cast<int>(p) + 1);
+  return name;
+}
+
+// Runs both sweeps with the given page mode and prints what they found
+void MeasureMode(int mode, int64 max_pages, int tlb_levels, const Arena* dense, int linesize, double l1_cycles) {
+  const char* mode_name = PageModeName(mode);
+  int64 pagesize = (mode == PAGE_MODE_4K) ? kPageSize : (mode == PAGE_MODE_1G) ? (1ll << 30) : (1ll << 21);
+  if (max_pages <= 0) {max_pages = kDefaultMaxPages[mode];}
+  max_pages = std::min(max_pages, AvailablePages(mode, pagesize, max_pages * pagesize));
+  if (max_pages < 2) {
+    fprintf(stderr, "%s: skipped, no huge pages free; reserve them first, e.g. echo %d | sudo tee "
+            "/sys/kernel/mm/hugepages/hugepages-%lldkB/nr_hugepages\n", mode_name,
+            (mode == PAGE_MODE_1G) ? 8 : 1024, static_cast<long long>(pagesize >> 10));
+    return;
+  }
+
+  Arena arena;
+  if (AllocArena(&arena, max_pages * pagesize, mode) != 0) {
+    fprintf(stderr, "%s: could not allocate %lld pages\n", mode_name, static_cast<long long>(max_pages));
+    return;
+  }
+  if (arena.mode != mode) {
+    fprintf(stderr, "%s: skipped, the arena fell back to %s pages\n", mode_name, PageModeName(arena.mode));
+    FreeArena(&arena);
+    return;
+  }
+  std::vector<TlbLevel> levels;
+  CapacitySweep(mode_name, &arena, pagesize, max_pages, dense, linesize, l1_cycles, &levels);
+  FreeArena(&arena);
+  if (levels.size() < 2) {
+    fprintf(stderr, "%s: no TLB miss up to %lld pages (%lld MB), raise --max_pages\n", mode_name,
+            static_cast<long long>(max_pages), static_cast<long long>((max_pages * pagesize) >> 20));
+    return;
+  }
+
+  // The plateaus past the TLB levels are tiers of the page walk
+  size_t tlb_count = std::min(static_cast<size_t>(tlb_levels), levels.size() - 1);
+  for (size_t p = 0; p < tlb_count; ++p) {
+    WaysSweep(mode_name, mode, pagesize, dense, linesize, l1_cycles, &levels, p);
+  }
+
+  double hit = levels[0].latency;
+  for (size_t p = 0; p < tlb_count; ++p) {
+    int64 entries = llround(levels[p].entries);
+    fprintf(stderr, "%s: %s %lld entries (%lld KB), ", mode_name, TlbLevelName(p).c_str(),
+            static_cast<long long>(entries), static_cast<long long>((entries * pagesize) >> 10));
+    if (levels[p].ways >= entries) {
+      fprintf(stderr, "fully associative");
+    } else if (levels[p].ways > 0) {
+      fprintf(stderr, "%d-way", levels[p].ways);
+    } else if (levels[p].ways_limit >= 2) {
+      fprintf(stderr, "more than %d ways", levels[p].ways_limit);
+    } else {
+      fprintf(stderr, "ways not measured");
+    }
+    fprintf(stderr, ", %.1f cycles per load, +%.1f\n", levels[p].latency, levels[p].latency - hit);
+  }
+  for (size_t p = tlb_count; p < levels.size(); ++p) {
+    fprintf(stderr, "%s: page walk %.1f cycles per load, +%.1f, past %lld pages\n", mode_name, levels[p].latency,
+            levels[p].latency - hit, static_cast<long long>(llround(levels[p - 1].entries)));
+  }
+  if (tlb_count < static_cast<size_t>(tlb_levels)) {
+    fprintf(stderr, "%s: only %d of %d TLB levels within %lld pages, so the walk may be the next level; "
+            "raise --max_pages or reserve more huge pages\n", mode_name, static_cast<int>(tlb_count), tlb_levels,
+            static_cast<long long>(max_pages));
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const char* mode_list = "4k,2m,1g";
+  int64 max_pages = 0;      // 0 means kDefaultMaxPages of each mode
+  int tlb_levels = kDefaultTlbLevels;
+  int linesize = 0;         // 0 means from sysfs or CPUID
+  MeasureEnv env;
+  InitMeasureEnv(&env);
+  InitSamplingPolicy(&gSampling, kMinSamples, kMaxSamples, kCiTarget, kPointBudgetMs);
+  // A tenth of a cycle is finer than the steps between the plateaus
+  gSampling.resolution = 0.1;
+
+  for (int i = 1; i < argc; ++i) {
+    if (std::strncmp(argv[i], "--page_mode=", 12) == 0) {
+      mode_list = argv[i] + 12;
+    } else if (std::strncmp(argv[i], "--max_pages=", 12) == 0) {
+      max_pages = std::atoll(argv[i] + 12);
+    } else if (std::strncmp(argv[i], "--tlb_levels=", 13) == 0) {
+      tlb_levels = std::max(1, std::atoi(argv[i] + 13));
+    } else if (std::strncmp(argv[i], "--cache_line_size=", 18) == 0) {
+      linesize = std::atoi(argv[i] + 18);
+    } else if (std::strncmp(argv[i], "--seed=", 7) == 0) {
+      gListSeed = std::strtoull(argv[i] + 7, NULL, 10);
+    } else if (!ParseSamplingFlag(&gSampling, argv[i]) && !ParseMeasureEnvFlag(&env, argv[i])) {
+      fprintf(stderr, "Usage: tlb_benchmark [--page_mode=4k,thp,2m,1g] [--max_pages=<n>] [--tlb_levels=<n>] "
+              "[--cache_line_size=<bytes>] "
+              "[--seed=<n>] [--ci_target=<percent>] [--time_budget=<ms>] [--max_samples=<n>] "
+              "[--pin_cpu=<cpu>] [--fifo] [--mlock]\n");
+      return 1;
+    }
+  }
+
+  std::vector<int> modes;
+  std::string list = std::string(mode_list) + ",";
+  for (size_t start = 0, comma; (comma = list.find(',', start)) != std::string::npos; start = comma + 1) {
+    int mode = ParsePageMode(list.substr(start, comma - start).c_str());
+    if (mode < 0) {
+      fprintf(stderr, "Unknown --page_mode, use a list of 4k, thp, 2m and 1g\n");
+      return 1;
+    }
+    modes.push_back(mode);
+  }
+
+  if (linesize <= 0) {
+    CacheInfo caches[CACHE_MAX_LEVELS];
+    int cache_count = ReadCacheHints(caches, CACHE_MAX_LEVELS);
+    linesize = (cache_count > 0 && caches[0].line_size > 0) ? caches[0].line_size : kDefaultLineSize;
+  }
+
+  SetupMeasureEnv(&env);
+  if (PerfGroupOpen(&gPerf) == 0) {
+    fprintf(stderr, "Hardware counters not available, their columns will be -\n");
+  }
+
+  // The dense lines of the largest sweep point, on huge pages if the kernel
+  // has them so the dense chase itself hardly misses the TLB
+  int64 most_lines = kMaxWays;
+  for (size_t m = 0; m < modes.size(); ++m) {
+    most_lines = std::max(most_lines, (max_pages > 0) ? max_pages : kDefaultMaxPages[modes[m]]);
+  }
+  Arena dense;
+  if (AllocArena(&dense, most_lines * linesize, PAGE_MODE_THP) != 0) {
+    fprintf(stderr, "Could not allocate %lld bytes\n", static_cast<long long>(most_lines * linesize));
+    return 1;
+  }
+  double l1_cycles = L1HitCycles(&dense, linesize);
+  fprintf(stderr, "L1D hit: %.1f cycles per load\n", l1_cycles);
+
+  char perf_header[256];
+  PerfCsvHeader(", ", perf_header, sizeof(perf_header));
+  printf("page_mode, sweep, pages, stride_pages, cycles_per_load, dense_cycles_per_load, translation_cycles%s\n",
+         perf_header);
+  for (size_t m = 0; m < modes.size(); ++m) {
+    MeasureMode(modes[m], max_pages, tlb_levels, &dense, linesize, l1_cycles);
+  }
+
+  PerfGroupClose(&gPerf);
+  FreeArena(&dense);
+  return 0;
+}
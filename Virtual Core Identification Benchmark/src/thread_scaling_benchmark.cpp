@@ -0,0 +1,199 @@
+/*
+ * Program related to the processor cores. It measures how the throughput of
+ * four kinds of work grows with the number of threads, to find the number of
+ * virtual cores and what a second hardware thread on a core adds.
+ *
+ * One pool of worker threads is started once, each pinned to a CPU, one
+ * thread per physical core first and the SMT siblings after, see
+ * common/threadscaling.h. Every thread count of every workload then runs on
+ * the same pinned threads for the same interval:
+ *   int    integer ALU work
+ *   fp     vector double multiply-adds
+ *   l1     loads from an L1-resident array
+ *   dram   a random pointer chase over a per-thread cycle much larger than
+ *          the LLC's share of each thread
+ * Throughput rises while the threads find CPUs of their own and levels off
+ * beyond; the thread count where it bends is the virtual core count, and the
+ * throughput with every CPU busy over that with one thread per core is the
+ * SMT yield of that workload.
+ *
+ * Output is csv on stdout, one row per workload, repeat and thread count,
+ * with a summary per workload on stderr. threadcount.py runs this program
+ * and plots the rows.
+ *
+ * Copyright (c) 2024 Christ Lin
+ *
+ * Modifications were made by the Laboratory for Physical Science (LPS) team
+ * from the Applied Methods and Research Experience (AMRE) program, 2024.
+ *
+ * Note that due to the sensitivity of how caches work, it's better to close all other background programs to run the test.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "basetypes.h"
+#include "cacheinfo.h"
+#include "measureenv.h"
+#include "pagealloc.h"
+#include "threadscaling.h"
+
+// How long each point runs by default, in milliseconds
+static const int kDefaultDurationMillis = 200;
+// Bounds of the default dram cycle per thread: twice the thread's share of
+// the LLC, at least kMinDramBytes so a small share still misses, at most
+// kMaxDramBytes so many threads still fit in memory
+static const int64 kMinDramBytes = 16ll << 20;
+static const int64 kMaxDramBytes = 256ll << 20;
+static const int64 kDefaultLlcBytes = 32ll << 20;
+static const int kDefaultLineSize = 64;
+
+// Parses a comma-separated list of positive integers
+static std::vector<int> ParseIntList(const char* list) {
+  std::vector<int> values;
+  for (const char* p = list; p != NULL; p = strchr(p, ',')) {
+    if (*p == ',') {++p;}
+    int value = std::atoi(p);
+    if (value > 0) {values.push_back(value);}
+  }
+  return values;
+}
+
+int main(int argc, char* argv[]) {
+  const char* workload_list = "all";
+  std::vector<int> thread_counts;
+  int duration = kDefaultDurationMillis;
+  int repeats = 1;
+  double dram_size_mb = 0.0;      // 0 means from the LLC size
+  int page_mode = PAGE_MODE_4K;
+  MeasureEnv env;
+  InitMeasureEnv(&env);
+
+  for (int i = 1; i < argc; ++i) {
+    if (std::strncmp(argv[i], "--workload=", 11) == 0) {
+      workload_list = argv[i] + 11;
+    } else if (std::strncmp(argv[i], "--threads=", 10) == 0) {
+      thread_counts = ParseIntList(argv[i] + 10);
+    } else if (std::strncmp(argv[i], "--duration=", 11) == 0) {
+      duration = std::max(1, std::atoi(argv[i] + 11));
+    } else if (std::strncmp(argv[i], "--repeats=", 10) == 0) {
+      repeats = std::max(1, std::atoi(argv[i] + 10));
+    } else if (std::strncmp(argv[i], "--dram_size=", 12) == 0) {
+      dram_size_mb = std::atof(argv[i] + 12);
+    } else if (std::strncmp(argv[i], "--page_mode=", 12) == 0) {
+      page_mode = ParsePageMode(argv[i] + 12);
+      if (page_mode < 0) {
+        fprintf(stderr, "Unknown --page_mode, use 4k, thp, 2m or 1g\n");
+        return 1;
+      }
+    } else if (!ParseMeasureEnvFlag(&env, argv[i])) {
+      fprintf(stderr, "Usage: thread_scaling_benchmark [--workload=int,fp,l1,dram|all] [--threads=<list>] "
+              "[--duration=<ms>] [--repeats=<n>] [--dram_size=<MB>] [--page_mode=4k|thp|2m|1g] "
+              "[--pin_cpu=<cpulist>] [--mlock]\n");
+      return 1;
+    }
+  }
+
+  std::vector<int> workloads;
+  for (int w = 0; w < kWorkloadCount; ++w) {
+    std::string list = std::string(",") + workload_list + ",";
+    if (strcmp(workload_list, "all") == 0 || list.find(std::string(",") + kWorkloadNames[w] + ",") != std::string::npos) {
+      workloads.push_back(w);
+    }
+  }
+  if (workloads.empty()) {
+    fprintf(stderr, "Unknown --workload, use int, fp, l1, dram or all\n");
+    return 1;
+  }
+
+  SetupMeasureEnv(&env);
+  // More threads than CPUs is the point here, and a FIFO main thread would
+  // keep the workers sharing its CPU from ever starting
+  if (env.fifo) {
+    fprintf(stderr, "measureenv: --fifo is not used for thread scaling, the workers run at normal priority\n");
+    SetThreadFifo(0);
+    env.fifo = 0;
+  }
+
+  // The CPUs we may run on, one thread per core first, or those --pin_cpu
+  // lists in the order given
+  std::vector<int> cpus(env.cpus, env.cpus + env.cpu_count);
+#ifdef __linux__
+  cpu_set_t allowed;
+  if (cpus.empty() && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &allowed)) {cpus.push_back(cpu);}
+    }
+  }
+#endif
+  if (cpus.empty()) {
+    for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu) {cpus.push_back(cpu);}
+  }
+  int cpu_count = cpus.size();
+  std::vector<int> by_core = cpus;
+  int core_count = OrderCpusByCore(&by_core);
+  if (env.cpu_count == 0) {cpus = by_core;}
+  if (thread_counts.empty()) {thread_counts = DefaultThreadCounts(cpu_count);}
+  int max_threads = *std::max_element(thread_counts.begin(), thread_counts.end());
+
+  CacheInfo caches[CACHE_MAX_LEVELS];
+  int cache_count = ReadCacheInfo(caches, CACHE_MAX_LEVELS);
+  int64 llc_bytes = (cache_count > 0) ? caches[cache_count - 1].bytesize : kDefaultLlcBytes;
+  int linesize = (cache_count > 0 && caches[0].line_size > 0) ? caches[0].line_size : kDefaultLineSize;
+  int64 dram_bytes = static_cast<int64>(dram_size_mb * 1024 * 1024);
+  if (dram_bytes <= 0) {dram_bytes = std::min(std::max(2 * llc_bytes / cpu_count, kMinDramBytes), kMaxDramBytes);}
+  dram_bytes = RoundUp(dram_bytes, kPageSize);
+
+  // The dram cycles are only built if the dram workload runs
+  Arena arena;
+  memset(&arena, 0, sizeof(arena));
+  bool dram = std::find(workloads.begin(), workloads.end(), kWorkloadDram) != workloads.end();
+  if (dram && AllocArena(&arena, dram_bytes * max_threads, page_mode) != 0) {
+    fprintf(stderr, "Could not allocate %lld MB\n", static_cast<long long>((dram_bytes * max_threads) >> 20));
+    return 1;
+  }
+  fprintf(stderr, "%d CPUs, %d cores, %d workers, %d ms per point, %lld MB dram cycle per thread\n",
+          cpu_count, core_count, max_threads, duration, static_cast<long long>(dram_bytes >> 20));
+
+  ScalingPool pool;
+  StartScalingPool(&pool, max_threads, cpus, dram ? arena.ptr : NULL, dram_bytes, linesize);
+
+  printf("workload, repeat, threads, mops\n");
+  for (size_t w = 0; w < workloads.size(); ++w) {
+    std::vector<int> breaks;
+    std::vector<double> yields;
+    for (int r = 0; r < repeats; ++r) {
+      std::vector<double> x;
+      std::vector<double> y;
+      for (size_t i = 0; i < thread_counts.size(); ++i) {
+        double mops = RunScalingPoint(&pool, workloads[w], thread_counts[i], duration);
+        printf("%s, %d, %d, %.3f\n", kWorkloadNames[workloads[w]], r + 1, thread_counts[i], mops);
+        fflush(stdout);
+        x.push_back(thread_counts[i]);
+        y.push_back(mops);
+      }
+      breaks.push_back(FindScalingBreak(x, y));
+      yields.push_back(SmtYield(x, y, core_count, cpu_count));
+    }
+    // The median over the repeats
+    std::sort(breaks.begin(), breaks.end());
+    std::sort(yields.begin(), yields.end());
+    fprintf(stderr, "%s: %d virtual cores", kWorkloadNames[workloads[w]], breaks[breaks.size() / 2]);
+    if (yields[yields.size() / 2] > 0.0) {
+      fprintf(stderr, ", SMT yield %.2f\n", yields[yields.size() / 2]);
+    } else {
+      fprintf(stderr, ", SMT yield not measured, add %d and %d to --threads\n", core_count, cpu_count);
+    }
+  }
+
+  StopScalingPool(&pool);
+  if (dram) {FreeArena(&arena);}
+  return 0;
+}
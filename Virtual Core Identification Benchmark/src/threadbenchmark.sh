@@ -28,6 +28,13 @@ else
     exit 1
 fi
 
+# Build the native benchmark the script runs
+if ! make; then
+    echo "Could not build thread_scaling_benchmark, please check that g++ and make are installed."
+    deactivate
+    exit 1
+fi
+
 # Run the Python file thread.py
 if [ -f threadcount.py ]; then
     python threadcount.py
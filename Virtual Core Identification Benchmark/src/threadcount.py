@@ -1,3 +1,5 @@
+import io
+import os
 import subprocess
 import pandas as pd
 import matplotlib.pyplot as plt
@@ -16,20 +18,19 @@ config = toml.load("config.toml")
 # Extract the information
 max_time = config["max_time"]
 thread_counts = config["thread_counts"]
-prime_number = config["prime_numbers"]
+workload = config.get("workload", "int")
 iteration = config["iteration"]
 
-# initializing lists to store data
-data_iteration = []
-data_threads = []
-data_num_events = []
+# the native benchmark, built with make in this directory
+benchmark = os.path.join(os.path.dirname(os.path.abspath(__file__)), "thread_scaling_benchmark")
+
 datetime_stamp = datetime.datetime.now().strftime("%Y-%m-%d %Hh%Mm%Ss")
 
 
-# data is a panda DataFrame object, preferably with 3 columns num_prime, num_virtual cores, num_events
+# data is a panda DataFrame object, preferably with 3 columns num_iterations, num_threads, mops
 def piecewise_regression(data):
     x = data["num_threads"].values
-    y = data["num_events"].values
+    y = data["mops"].values
 
     # Create a piecewise linear fit object
     breakpoint = None
@@ -52,12 +53,12 @@ def piecewise_regression(data):
     return breakpoint
 
 
-# take full dataset generated by sysbench, preferably preferably with 3 columns num_prime, num_virtual cores, num_events
+# take full dataset generated by the benchmark, preferably with 3 columns num_iterations, num_threads, mops
 def determine_optimal_threads(data):
-    # store prediction of threads based on different prime number tests using piecewise regression
+    # store prediction of threads based on different iterations using piecewise regression
     frequency_dict = {key: 0 for key in thread_counts}
 
-    # split data to corresponding dataframe based on different max_primes
+    # split data to corresponding dataframe based on different iterations
     data_by_iterations_dict = {
         iterations: group for iterations, group in data.groupby("num_iterations")
     }
@@ -72,44 +73,23 @@ def determine_optimal_threads(data):
     )
 
 
-def sysbench_cpu(thread_count, iteration):
-    cmd = f"sysbench cpu --cpu-max-prime={prime_number} --max-time={max_time} --num-threads={thread_count} run"
-    output = subprocess.check_output(cmd, shell=True).decode()
-    for line in output.split("\n"):
-        if "total number of events:" in line:
-            data_iteration.append(iteration)
-            data_threads.append(thread_count)
-            data_num_events.append(int(line.split()[-1]))
-
-
-def progress_bar(current_step, total_steps):
-    percent_complete = (current_step / total_steps) * 100
-    bar_length = 50  # Length of the progress bar
-    filled_length = int(bar_length * percent_complete // 100)
-    bar = "#" * filled_length + "-" * (bar_length - filled_length)
-
-    # Clear the line and print the progress bar
-    sys.stdout.write(f'\r{" " * (bar_length + 20)}')
-    sys.stdout.write(f"\r|{bar}| {percent_complete:.2f}% Complete")
-    sys.stdout.flush()
-
-
+# runs every iteration and thread count in one process of the native benchmark,
+# on one pool of pinned threads, and returns its csv rows
 def run_benchmark():
-    total_iterations = iteration * len(thread_counts)
-    current_iteration = 0
-
-    for iteration_index in range(1, iteration + 1):
-        for threads in thread_counts:
-            sysbench_cpu(threads, iteration_index)
-            current_iteration += 1
-            progress_bar(current_iteration, total_iterations)
-
-    data_table = {
-        "num_iterations": data_iteration,
-        "num_threads": data_threads,
-        "num_events": data_num_events,
-    }
-    return pd.DataFrame(data_table)
+    if not os.path.exists(benchmark):
+        sys.exit(f"{benchmark} not found, run make in this directory first")
+    cmd = [
+        benchmark,
+        f"--workload={workload}",
+        "--threads=" + ",".join(str(t) for t in thread_counts),
+        f"--duration={int(max_time * 1000)}",
+        f"--repeats={iteration}",
+    ]
+    output = subprocess.run(cmd, check=True, capture_output=True, text=True).stdout
+    data = pd.read_csv(io.StringIO(output), skipinitialspace=True)
+    return data.rename(columns={"repeat": "num_iterations", "threads": "num_threads"})[
+        ["num_iterations", "num_threads", "mops"]
+    ]
 
 
 # creates a csv file of the dataframe
@@ -122,32 +102,30 @@ def create_graph_file(df):
     groups = df.groupby("num_iterations")
     plt.figure(figsize=(10, 6))
 
-    for max_prime, group in groups:
-        min_events = group["num_events"].min()
-        max_events = group["num_events"].max()
-        if max_events != min_events:  # Ensure no division by zero
-            normalized_events = (group["num_events"] - min_events) / (
-                max_events - min_events
-            )
+    for iteration_index, group in groups:
+        min_ops = group["mops"].min()
+        max_ops = group["mops"].max()
+        if max_ops != min_ops:  # Ensure no division by zero
+            normalized_ops = (group["mops"] - min_ops) / (max_ops - min_ops)
         else:
-            normalized_events = np.zeros_like(
-                group["num_events"]
+            normalized_ops = np.zeros_like(
+                group["mops"]
             )  # All values are the same, normalize to zero
         plt.plot(
             group["num_threads"],
-            normalized_events,
+            normalized_ops,
             marker="o",
             linestyle="-",
-            label=f"{max_prime}",
+            label=f"{iteration_index}",
         )
 
     # configure graph
     plt.title(
-        f"Performance of Sysbench CPU Benchmark with Time = {max_time}, Prime Number Limit = {prime_number}"
+        f"Thread Scaling of the {workload} Workload with Time = {max_time}"
     )
     plt.legend(title="Number of Iterations")
     plt.xlabel("Number of Threads")
-    plt.ylabel("Number of Events")
+    plt.ylabel("Normalized Throughput")
     plt.grid(True)
 
     # save graph as a png
@@ -0,0 +1,214 @@
+// cacheinfo.h
+//
+// The data and unified cache levels as the kernel describes them in
+// /sys/devices/system/cpu/cpu0/cache, or as CPUID does in its deterministic
+// cache parameters: leaf 4 on Intel, leaf 0x8000001D on AMD. Benchmarks use
+// this to label their sweeps by level, and as hints: where a sweep used to
+// cover every size a cache could have, it can verify a window around the
+// reported one, and say so when the measurement disagrees.
+//
+// Usable from both C and C++. C files must define _GNU_SOURCE before their
+// first #include, for cpu_set_t.
+
+#ifndef __CACHEINFO_H__
+#define __CACHEINFO_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "numabind.h"
+
+#define CACHE_MAX_LEVELS 8
+// A measured size within this fraction of the reported one agrees with it
+#define CACHE_HINT_WINDOW 0.25
+
+typedef struct {
+  int level;            // 1, 2, 3, ...
+  int64_t bytesize;     // total capacity
+  int line_size;        // coherency line size in bytes, 0 if unknown
+  int ways;             // associativity, 0 if unknown or fully associative
+  int sharers;          // CPUs sharing this cache, at least 1
+  int inclusive;        // 1 if inclusive of the levels below, 0 if not, -1 if unknown
+  const char* source;   // "sysfs" or "cpuid"
+} CacheInfo;
+
+// Reads one line of a sysfs file into buf. Returns 0 on success.
+static inline int ReadSysfsLine(const char* path, char* buf, int bufsize) {
+  FILE* f = fopen(path, "r");
+  if (f == NULL) {return -1;}
+  char* line = fgets(buf, bufsize, f);
+  fclose(f);
+  return (line == NULL) ? -1 : 0;
+}
+
+// Fills caches[] with the data and unified caches of CPU 0, smallest level
+// first, skipping instruction caches. Returns how many there are, 0 when
+// sysfs does not describe them.
+static inline int ReadCacheInfo(CacheInfo* caches, int max_caches) {
+  int count = 0;
+#ifdef __linux__
+  for (int index = 0; index < 32 && count < max_caches; ++index) {
+    char dir[96];
+    char path[128];
+    char buf[4096];
+    snprintf(dir, sizeof(dir), "/sys/devices/system/cpu/cpu0/cache/index%d", index);
+    snprintf(path, sizeof(path), "%s/type", dir);
+    if (ReadSysfsLine(path, buf, sizeof(buf)) != 0) {break;}
+    if (strncmp(buf, "Instruction", 11) == 0) {continue;}
+
+    CacheInfo info;
+    memset(&info, 0, sizeof(info));
+    info.sharers = 1;
+    info.inclusive = -1;
+    info.source = "sysfs";
+    snprintf(path, sizeof(path), "%s/level", dir);
+    if (ReadSysfsLine(path, buf, sizeof(buf)) != 0) {continue;}
+    info.level = atoi(buf);
+    // The size is "48K", "2048K", "32M", ...
+    snprintf(path, sizeof(path), "%s/size", dir);
+    if (ReadSysfsLine(path, buf, sizeof(buf)) != 0) {continue;}
+    char* suffix;
+    info.bytesize = strtoll(buf, &suffix, 10);
+    if (*suffix == 'K') {info.bytesize <<= 10;}
+    if (*suffix == 'M') {info.bytesize <<= 20;}
+    if (*suffix == 'G') {info.bytesize <<= 30;}
+    snprintf(path, sizeof(path), "%s/coherency_line_size", dir);
+    if (ReadSysfsLine(path, buf, sizeof(buf)) == 0) {info.line_size = atoi(buf);}
+    snprintf(path, sizeof(path), "%s/ways_of_associativity", dir);
+    if (ReadSysfsLine(path, buf, sizeof(buf)) == 0) {info.ways = atoi(buf);}
+    snprintf(path, sizeof(path), "%s/shared_cpu_list", dir);
+    if (ReadSysfsLine(path, buf, sizeof(buf)) == 0) {
+      cpu_set_t set;
+      int sharers = ParseCpuList(buf, &set);
+      if (sharers > 0) {info.sharers = sharers;}
+    }
+    if (info.bytesize <= 0) {continue;}
+
+    // Insertion sort by level; sysfs lists them in order on every machine
+    // seen so far, but nothing promises it
+    int i = count++;
+    while (i > 0 && caches[i - 1].level > info.level) {
+      caches[i] = caches[i - 1];
+      --i;
+    }
+    caches[i] = info;
+  }
+#else
+  (void)caches;
+  (void)max_caches;
+#endif
+  return count;
+}
+
+// Fills caches[] like ReadCacheInfo(), from the CPUID deterministic cache
+// parameters of the CPU this runs on. Returns 0 off x86, or when CPUID has no
+// such leaf.
+static inline int ReadCpuidCacheInfo(CacheInfo* caches, int max_caches) {
+  int count = 0;
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+  unsigned int leaf = 0;
+  if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx)) {return 0;}
+  if (eax >= 4) {leaf = 4;}
+  // AMD and Hygon describe their caches in an extended leaf, present with
+  // the topology extensions
+  if (ebx == 0x68747541 || ebx == 0x6f677948) {         // "Auth"enticAMD, "Hygo"nGenuine
+    leaf = 0;
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) && eax >= 0x8000001D &&
+        __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) && ((ecx >> 22) & 1)) {
+      leaf = 0x8000001D;
+    }
+  }
+  if (leaf == 0) {return 0;}
+  for (unsigned int index = 0; index < 32 && count < max_caches; ++index) {
+    __cpuid_count(leaf, index, eax, ebx, ecx, edx);
+    int type = eax & 31;                               // 1 data, 2 instruction, 3 unified
+    if (type == 0) {break;}
+    if (type == 2) {continue;}
+
+    CacheInfo info;
+    memset(&info, 0, sizeof(info));
+    info.level = (eax >> 5) & 7;
+    info.line_size = (ebx & 0xfff) + 1;
+    int partitions = ((ebx >> 12) & 0x3ff) + 1;
+    int ways = ((ebx >> 22) & 0x3ff) + 1;
+    int64_t sets = (int64_t)ecx + 1;
+    info.bytesize = (int64_t)ways * partitions * info.line_size * sets;
+    info.ways = ((eax >> 9) & 1) ? 0 : ways;           // fully associative
+    // The most logical CPUs that may share it, an upper bound of those that do
+    info.sharers = ((eax >> 14) & 0xfff) + 1;
+    info.inclusive = (edx >> 1) & 1;
+    info.source = "cpuid";
+
+    int i = count++;
+    while (i > 0 && caches[i - 1].level > info.level) {
+      caches[i] = caches[i - 1];
+      --i;
+    }
+    caches[i] = info;
+  }
+#else
+  (void)caches;
+  (void)max_caches;
+#endif
+  return count;
+}
+
+// The caches as sysfs reports them, else as CPUID does, for a benchmark to
+// take its default sizes from. Where both know a level, sysfs wins, CPUID adds
+// whether it is inclusive, and a size or associativity on which they differ,
+// e.g. in a VM whose hypervisor edits CPUID, is noted on stderr.
+static inline int ReadCacheHints(CacheInfo* caches, int max_caches) {
+  CacheInfo cpuid[CACHE_MAX_LEVELS];
+  int cpuid_count = ReadCpuidCacheInfo(cpuid, CACHE_MAX_LEVELS);
+  int count = ReadCacheInfo(caches, max_caches);
+  if (count == 0) {
+    for (int i = 0; i < cpuid_count && i < max_caches; ++i) {caches[count++] = cpuid[i];}
+    return count;
+  }
+  for (int i = 0; i < count; ++i) {
+    for (int j = 0; j < cpuid_count; ++j) {
+      if (cpuid[j].level != caches[i].level) {continue;}
+      caches[i].inclusive = cpuid[j].inclusive;
+      if (cpuid[j].bytesize != caches[i].bytesize || cpuid[j].ways != caches[i].ways) {
+        fprintf(stderr, "cacheinfo: sysfs reports L%d as %lld KB %d-way, CPUID as %lld KB %d-way\n", caches[i].level,
+                (long long)(caches[i].bytesize >> 10), caches[i].ways, (long long)(cpuid[j].bytesize >> 10), cpuid[j].ways);
+      }
+    }
+  }
+  return count;
+}
+
+// The reported cache of a level, or NULL
+static inline const CacheInfo* FindCacheLevel(const CacheInfo* caches, int count, int level) {
+  for (int i = 0; i < count; ++i) {
+    if (caches[i].level == level) {return &caches[i];}
+  }
+  return NULL;
+}
+
+// Notes on stderr when a measured size is not within CACHE_HINT_WINDOW of
+// the reported one. Returns 1 if they agree or nothing was reported, else 0.
+static inline int CheckCacheHint(const char* name, double measured_bytes, const CacheInfo* reported) {
+  if (reported == NULL || reported->bytesize <= 0) {return 1;}
+  double ratio = measured_bytes / reported->bytesize;
+  if (ratio >= 1.0 - CACHE_HINT_WINDOW && ratio <= 1.0 + CACHE_HINT_WINDOW) {return 1;}
+  fprintf(stderr, "cacheinfo: %s measured as %.0f KB, but %s reports %lld KB\n", name, measured_bytes / 1024,
+          reported->source, (long long)(reported->bytesize >> 10));
+  return 0;
+}
+
+// "L1d" for the level 1 data cache, "L2", "L3", ... for the others, and
+// "mem" for level 0, i.e. beyond the last level cache
+static inline const char* CacheLevelName(int level) {
+  static const char* const kNames[] = {"mem", "L1d", "L2", "L3", "L4", "L5", "L6", "L7"};
+  return (level >= 0 && level < 8) ? kNames[level] : "L?";
+}
+
+#endif	// __CACHEINFO_H__
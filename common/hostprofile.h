@@ -0,0 +1,282 @@
+// hostprofile.h
+//
+// A hardware profile of the host, kept on disk between runs: the results a
+// benchmark measured (see results.h), filed under a key that names the CPU.
+// Hosts with the same CPU model, stepping, microcode and topology have the
+// same caches and cores, so a later run on any of them can take the profile
+// instead of measuring everything again.
+//
+// The key is a hash of
+//   - the CPUID vendor and signature (family, model and stepping), or the
+//     same fields of /proc/cpuinfo off x86,
+//   - the microcode revision from /proc/cpuinfo,
+//   - the topology: online CPUs, cores, packages, and every cache level's
+//     size, ways and sharing from sysfs.
+// The kernel release is recorded too, but is not part of the key.
+//
+// A profile is one TOML file, <key>.toml, with a [host] table saying what
+// the key was made of and one [[result]] table per result:
+//
+//   [host]
+//   key = "3f0c5e9a1b7d2468"
+//   vendor = "GenuineIntel"
+//   ...
+//
+//   [[result]]
+//   stage = "cachesize"
+//   key = "l2_size"
+//   value = 2097152
+//   unit = "bytes"
+//   source = "measured"
+//   ci = 0.09
+//
+// ReadProfile() reads no more TOML than WriteProfile() writes.
+//
+// C++ only.
+
+#ifndef __HOSTPROFILE_H__
+#define __HOSTPROFILE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "cacheinfo.h"
+#include "results.h"
+
+struct HostIdentity {
+  std::string vendor;       // e.g. "GenuineIntel"
+  std::string signature;    // CPUID leaf 1 eax, e.g. "0x000806f8"
+  std::string model_name;   // for people reading the profile, not in the key
+  std::string microcode;    // e.g. "0x2b000461", "-" if unknown
+  std::string topology;     // e.g. "cpus=8 cores=4 packages=1 L1d=48K/12/2 ..."
+  std::string kernel;       // uname release, not in the key
+  std::string key;          // 16 hex digits
+};
+
+// The value of the first "name : value" line of /proc/cpuinfo, or "-"
+inline std::string CpuinfoField(const char* name) {
+  std::string value = "-";
+  FILE* f = fopen("/proc/cpuinfo", "r");
+  if (f == NULL) {return value;}
+  char line[512];
+  size_t len = strlen(name);
+  while (fgets(line, sizeof(line), f) != NULL) {
+    // "model" must not match "model name : ..."
+    if (strncmp(line, name, len) != 0) {continue;}
+    const char* rest = line + len + strspn(line + len, " \t");
+    if (*rest != ':') {continue;}
+    value = rest + 1;
+    value.erase(0, value.find_first_not_of(" \t"));
+    value.erase(value.find_last_not_of(" \t\n") + 1);
+    break;
+  }
+  fclose(f);
+  return value;
+}
+
+// Online CPUs, cores and packages, then vendor-independent cache geometry
+inline std::string TopologyFingerprint() {
+  std::vector<int> cores;
+  std::vector<int> packages;
+  int cpus = 0;
+  long configured = sysconf(_SC_NPROCESSORS_CONF);
+  for (int cpu = 0; cpu < configured; ++cpu) {
+    char path[128];
+    char buf[256];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+    // Offline CPUs have no topology directory
+    if (ReadSysfsLine(path, buf, sizeof(buf)) != 0) {continue;}
+    ++cpus;
+    int package = atoi(buf);
+    if (std::find(packages.begin(), packages.end(), package) == packages.end()) {packages.push_back(package);}
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+    int core = (ReadSysfsLine(path, buf, sizeof(buf)) == 0) ? atoi(buf) : cpu;
+    if (std::find(cores.begin(), cores.end(), core) == cores.end()) {cores.push_back(core);}
+  }
+  if (cpus == 0) {
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cores.assign(cpus, 0);
+    packages.assign(1, 0);
+  }
+
+  char text[512];
+  int pos = snprintf(text, sizeof(text), "cpus=%d cores=%d packages=%d", cpus, static_cast<int>(cores.size()),
+                     static_cast<int>(packages.size()));
+  CacheInfo caches[CACHE_MAX_LEVELS];
+  int count = ReadCacheInfo(caches, CACHE_MAX_LEVELS);
+  for (int i = 0; i < count && pos < static_cast<int>(sizeof(text)); ++i) {
+    pos += snprintf(text + pos, sizeof(text) - pos, " %s=%lldK/%d/%d", CacheLevelName(caches[i].level),
+                    static_cast<long long>(caches[i].bytesize >> 10), caches[i].ways, caches[i].sharers);
+  }
+  return text;
+}
+
+// 64-bit FNV-1a
+inline uint64_t HashText(const std::string& text) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < text.size(); ++i) {
+    hash ^= static_cast<unsigned char>(text[i]);
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+inline HostIdentity ReadHostIdentity() {
+  HostIdentity id;
+  char buf[64];
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax = 0;
+  unsigned int ebx = 0;
+  unsigned int ecx = 0;
+  unsigned int edx = 0;
+  __get_cpuid(0, &eax, &ebx, &ecx, &edx);
+  char vendor[13];
+  memcpy(vendor, &ebx, 4);
+  memcpy(vendor + 4, &edx, 4);
+  memcpy(vendor + 8, &ecx, 4);
+  vendor[12] = '\0';
+  id.vendor = vendor;
+  __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+  snprintf(buf, sizeof(buf), "0x%08x", eax);
+  id.signature = buf;
+#else
+  id.vendor = CpuinfoField("vendor_id");
+  id.signature = CpuinfoField("cpu family") + "/" + CpuinfoField("model") + "/" + CpuinfoField("stepping");
+#endif
+  id.model_name = CpuinfoField("model name");
+  id.microcode = CpuinfoField("microcode");
+  id.topology = TopologyFingerprint();
+  struct utsname name;
+  id.kernel = (uname(&name) == 0) ? name.release : "-";
+  snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(
+           HashText(id.vendor + "|" + id.signature + "|" + id.microcode + "|" + id.topology)));
+  id.key = buf;
+  return id;
+}
+
+// The profile directory: dir if given, else $XDG_CACHE_HOME/cha2sm or
+// $HOME/.cache/cha2sm. Made if it does not exist. Returns "" if none can be.
+inline std::string ProfileDir(const char* dir) {
+  std::string path;
+  if (dir != NULL && dir[0] != '\0') {
+    path = dir;
+  } else if (getenv("XDG_CACHE_HOME") != NULL && getenv("XDG_CACHE_HOME")[0] != '\0') {
+    path = std::string(getenv("XDG_CACHE_HOME")) + "/cha2sm";
+  } else if (getenv("HOME") != NULL) {
+    path = std::string(getenv("HOME")) + "/.cache/cha2sm";
+  } else {
+    return "";
+  }
+  // Each missing parent in turn
+  for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+    mkdir(path.substr(0, slash).c_str(), 0755);
+    if (slash == std::string::npos) {break;}
+  }
+  struct stat st;
+  return (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) ? path : "";
+}
+
+inline std::string ProfilePath(const std::string& dir, const HostIdentity& id) {
+  return dir + "/" + id.key + ".toml";
+}
+
+// A TOML basic string; the values written here never need more than dropping
+// quotes and backslashes
+inline std::string TomlString(const std::string& text) {
+  std::string quoted = "\"";
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (text[i] != '"' && text[i] != '\\') {quoted += text[i];}
+  }
+  return quoted + "\"";
+}
+
+// Writes results under id to path, through a temporary file so that a
+// concurrent reader never sees half a profile. Returns 0 on success.
+inline int WriteProfile(const std::string& path, const HostIdentity& id, const ResultSet* set) {
+  std::string temp = path + ".tmp";
+  FILE* f = fopen(temp.c_str(), "w");
+  if (f == NULL) {return -1;}
+  char written[32];
+  time_t now = time(NULL);
+  strftime(written, sizeof(written), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+  fprintf(f, "# Hardware profile written by cha2sm, see common/hostprofile.h\n\n[host]\n");
+  fprintf(f, "key = %s\nvendor = %s\nsignature = %s\nmodel_name = %s\nmicrocode = %s\ntopology = %s\nkernel = %s\n"
+          "written = %s\n", TomlString(id.key).c_str(), TomlString(id.vendor).c_str(), TomlString(id.signature).c_str(),
+          TomlString(id.model_name).c_str(), TomlString(id.microcode).c_str(), TomlString(id.topology).c_str(),
+          TomlString(id.kernel).c_str(), TomlString(written).c_str());
+  for (size_t i = 0; i < set->results.size(); ++i) {
+    const Result& r = set->results[i];
+    fprintf(f, "\n[[result]]\nstage = %s\nkey = %s\nvalue = %.10g\nunit = %s\nsource = %s\nci = %.6g\n",
+            TomlString(r.stage).c_str(), TomlString(r.key).c_str(), r.value, TomlString(r.unit).c_str(),
+            TomlString(r.source).c_str(), r.ci);
+  }
+  if (fclose(f) != 0) {
+    unlink(temp.c_str());
+    return -1;
+  }
+  return rename(temp.c_str(), path.c_str());
+}
+
+// Reads the results of the profile at path into set, replacing those with the
+// same keys. Returns the number read, or -1 if there is no profile or it was
+// written for another host.
+inline int ReadProfile(const std::string& path, const HostIdentity& id, ResultSet* set) {
+  FILE* f = fopen(path.c_str(), "r");
+  if (f == NULL) {return -1;}
+  std::vector<Result> results;
+  std::string table;
+  std::string key;
+  char line[1024];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    std::string text = line;
+    text.erase(text.find_last_not_of(" \t\r\n") + 1);
+    if (text.empty() || text[0] == '#') {continue;}
+    if (text[0] == '[') {
+      table = text;
+      if (table == "[[result]]") {
+        Result r = {"", "", 0.0, "", "", -1.0};
+        results.push_back(r);
+      }
+      continue;
+    }
+    size_t equals = text.find(" = ");
+    if (equals == std::string::npos) {continue;}
+    std::string name = text.substr(0, equals);
+    std::string value = text.substr(equals + 3);
+    if (value.size() >= 2 && value[0] == '"') {value = value.substr(1, value.size() - 2);}
+    if (table == "[host]" && name == "key") {
+      key = value;
+    } else if (table == "[[result]]") {
+      Result& r = results.back();
+      if (name == "stage") {r.stage = value;}
+      if (name == "key") {r.key = value;}
+      if (name == "value") {r.value = atof(value.c_str());}
+      if (name == "unit") {r.unit = value;}
+      if (name == "source") {r.source = value;}
+      if (name == "ci") {r.ci = atof(value.c_str());}
+    }
+  }
+  fclose(f);
+  if (key != id.key) {return -1;}
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    SetResult(set, r.stage.c_str(), r.key.c_str(), r.value, r.unit.c_str(), r.source.c_str(), r.ci);
+  }
+  return results.size();
+}
+
+#endif	// __HOSTPROFILE_H__
@@ -0,0 +1,195 @@
+// measureenv.h
+//
+// The measurement environment of a benchmark run: which CPUs the measuring
+// threads are pinned to, whether they run SCHED_FIFO, whether the process'
+// memory is locked, and the cpufreq governor and turbo state the run saw.
+//
+// Unpinned, the scheduler may migrate a sweep to another core halfway, with
+// cold private caches, or put two benchmark threads on SMT siblings. A normal
+// priority thread also shares its core with whatever else wakes up, and a
+// page reclaimed mid-run costs a fault in the timed region. Pinning,
+// SCHED_FIFO and mlockall() take those out of the measurement. The governor
+// and turbo state cannot be fixed from here without root and changing the
+// whole machine, so they are only checked and reported: a governor other than
+// "performance" or an enabled turbo lets the core clock drift away from the
+// constant-rate cycle counter during the run.
+//
+// The benchmarks take the same flags:
+//   --pin_cpu=<cpulist>   pin measuring thread k to the k-th CPU of the list,
+//                         e.g. --pin_cpu=2 or --pin_cpu=2,6
+//   --fifo                run the measuring threads SCHED_FIFO (needs root or
+//                         CAP_SYS_NICE)
+//   --mlock               lock the process' pages in memory as they fault in
+//
+// Usable from both C and C++. C files must define _GNU_SOURCE before their
+// first #include, for cpu_set_t and sched_setaffinity().
+
+#ifndef __MEASUREENV_H__
+#define __MEASUREENV_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "numabind.h"
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+#ifndef MCL_ONFAULT
+#define MCL_ONFAULT 4
+#endif
+
+#define MEASURE_MAX_CPUS 64
+
+typedef struct {
+  int cpus[MEASURE_MAX_CPUS];   // --pin_cpu list, in the order given
+  int cpu_count;                // 0 for unpinned
+  int fifo;                     // --fifo given, and later whether it worked
+  int mlock;                    // --mlock given, and later whether it worked
+  char governor[32];            // cpufreq governor of the first CPU, "-" if unknown
+  int turbo;                    // 1 turbo or boost on, 0 off, -1 unknown
+} MeasureEnv;
+
+static inline void InitMeasureEnv(MeasureEnv* env) {
+  memset(env, 0, sizeof(*env));
+  strcpy(env->governor, "-");
+  env->turbo = -1;
+}
+
+// Takes arg if it is one of the flags above. Returns 1 if it was, 0 if not.
+static inline int ParseMeasureEnvFlag(MeasureEnv* env, const char* arg) {
+  if (strncmp(arg, "--pin_cpu=", 10) == 0) {
+    // A plain list such as "2,6" keeps its order; ranges count up
+    const char* p = arg + 10;
+    env->cpu_count = 0;
+    while (*p != '\0' && env->cpu_count < MEASURE_MAX_CPUS) {
+      char* end;
+      long lo = strtol(p, &end, 10);
+      if (end == p) {break;}
+      long hi = lo;
+      p = end;
+      if (*p == '-') {
+        hi = strtol(p + 1, &end, 10);
+        p = end;
+      }
+      for (long cpu = lo; cpu <= hi && env->cpu_count < MEASURE_MAX_CPUS; ++cpu) {
+        env->cpus[env->cpu_count++] = (int)cpu;
+      }
+      if (*p == ',') {++p;}
+    }
+    return 1;
+  }
+  if (strcmp(arg, "--fifo") == 0) {
+    env->fifo = 1;
+    return 1;
+  }
+  if (strcmp(arg, "--mlock") == 0) {
+    env->mlock = 1;
+    return 1;
+  }
+  return 0;
+}
+
+// Makes the calling thread SCHED_FIFO, or back to normal priority if fifo is
+// 0. Any FIFO priority runs ahead of every normal thread; the lowest leaves
+// the kernel's own real-time threads ahead of us. Returns 0 on success.
+static inline int SetThreadFifo(int fifo) {
+#ifdef __linux__
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = fifo ? sched_get_priority_min(SCHED_FIFO) : 0;
+  return sched_setscheduler(0, fifo ? SCHED_FIFO : SCHED_OTHER, &param);
+#else
+  return fifo ? -1 : 0;
+#endif
+}
+
+// Pins the calling thread, measuring thread k of the run, to the k-th CPU of
+// the --pin_cpu list, wrapping around a short list, and makes it SCHED_FIFO
+// if --fifo worked for the main thread. Does nothing for an unpinned, normal
+// priority run. Returns 0 on success.
+static inline int PinMeasuringThread(const MeasureEnv* env, int k) {
+  int status = 0;
+  if (env->cpu_count > 0) {status |= PinThreadToCpu(env->cpus[k % env->cpu_count]);}
+  if (env->fifo) {status |= SetThreadFifo(1);}
+  return status;
+}
+
+// Reads the governor and turbo state of the first --pin_cpu CPU, or CPU 0
+static inline void ReadFrequencyState(MeasureEnv* env) {
+  char path[128];
+  // As long as the governor field, so a name copied into it always fits
+  char buf[sizeof(env->governor)];
+  int cpu = (env->cpu_count > 0) ? env->cpus[0] : 0;
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", cpu);
+  FILE* f = fopen(path, "r");
+  if (f != NULL) {
+    if (fgets(buf, sizeof(buf), f) != NULL) {
+      buf[strcspn(buf, "\n")] = '\0';
+      snprintf(env->governor, sizeof(env->governor), "%s", buf);
+    }
+    fclose(f);
+  }
+  // intel_pstate says whether turbo is off, acpi-cpufreq whether boost is on
+  env->turbo = -1;
+  f = fopen("/sys/devices/system/cpu/intel_pstate/no_turbo", "r");
+  if (f != NULL) {
+    if (fgets(buf, sizeof(buf), f) != NULL) {env->turbo = (atoi(buf) == 0);}
+    fclose(f);
+    return;
+  }
+  f = fopen("/sys/devices/system/cpu/cpufreq/boost", "r");
+  if (f != NULL) {
+    if (fgets(buf, sizeof(buf), f) != NULL) {env->turbo = (atoi(buf) != 0);}
+    fclose(f);
+  }
+}
+
+// Sets up the run as the flags asked: pins the calling thread as measuring
+// thread 0, makes it SCHED_FIFO, locks memory, then reads the frequency state
+// and describes it all on stderr. A step that fails is reported, cleared in
+// env and the run goes on without it. Call it before the benchmark arena is
+// allocated, so --mlock covers the arena too. MCL_ONFAULT locks pages only as
+// they are touched, so a sparse arena does not get backed in full.
+static inline void SetupMeasureEnv(MeasureEnv* env) {
+  if (env->cpu_count > 0 && PinThreadToCpu(env->cpus[0]) != 0) {
+    fprintf(stderr, "measureenv: could not pin to CPU %d, running unpinned\n", env->cpus[0]);
+    env->cpu_count = 0;
+  }
+  if (env->fifo && SetThreadFifo(1) != 0) {
+    fprintf(stderr, "measureenv: SCHED_FIFO needs root or CAP_SYS_NICE, running at normal priority\n");
+    env->fifo = 0;
+  }
+#ifdef __linux__
+  if (env->mlock && mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) != 0) {
+    fprintf(stderr, "measureenv: mlockall failed, raise ulimit -l or run as root; memory not locked\n");
+    env->mlock = 0;
+  }
+#else
+  env->mlock = 0;
+#endif
+  ReadFrequencyState(env);
+
+  char cpus[64] = "unpinned";
+  if (env->cpu_count > 0) {
+    int n = snprintf(cpus, sizeof(cpus), "pinned to cpu %d", env->cpus[0]);
+    for (int i = 1; i < env->cpu_count && n < (int)sizeof(cpus) - 8; ++i) {
+      n += snprintf(cpus + n, sizeof(cpus) - n, ",%d", env->cpus[i]);
+    }
+  }
+  fprintf(stderr, "measureenv: %s, %s, %s, governor %s, turbo %s\n", cpus,
+          env->fifo ? "SCHED_FIFO" : "normal priority", env->mlock ? "memory locked" : "memory not locked",
+          env->governor, (env->turbo < 0) ? "unknown" : (env->turbo ? "on" : "off"));
+  if (strcmp(env->governor, "-") != 0 && strcmp(env->governor, "performance") != 0) {
+    fprintf(stderr, "measureenv: the %s governor may change the clock during the run, "
+            "consider cpupower frequency-set -g performance\n", env->governor);
+  }
+  if (env->turbo == 1) {
+    fprintf(stderr, "measureenv: turbo is on, cycle counts follow the constant-rate TSC, not the core clock\n");
+  }
+}
+
+#endif	// __MEASUREENV_H__
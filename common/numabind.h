@@ -0,0 +1,130 @@
+// numabind.h
+//
+// Placing benchmark memory and threads on NUMA nodes, on Linux, through the
+// mbind() system call and the node cpulists in sysfs. No libnuma needed.
+//
+// Usable from both C and C++. C files must define _GNU_SOURCE before their
+// first #include, for cpu_set_t and sched_setaffinity().
+
+#ifndef __NUMABIND_H__
+#define __NUMABIND_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+#define NUMA_MAX_NODES 1024
+
+// Returns the number of NUMA nodes, counting up to the highest online one,
+// or 1 if the system does not say
+static inline int NumaNodeCount(void) {
+  int count = 1;
+#ifdef __linux__
+  char buf[256] = {0};
+  FILE* f = fopen("/sys/devices/system/node/online", "r");
+  if (f == NULL) {return 1;}
+  if (fgets(buf, sizeof(buf), f) != NULL) {
+    // A list such as "0" or "0-1" or "0,2-3"; the last number is the highest
+    char* last = buf;
+    for (char* p = buf; *p != '\0'; ++p) {
+      if (*p == ',' || *p == '-') {last = p + 1;}
+    }
+    count = atoi(last) + 1;
+  }
+  fclose(f);
+#endif
+  return count;
+}
+
+#ifdef __linux__
+// Parse a kernel cpulist such as "0-3,8-11" into set. Returns the number of
+// CPUs in it.
+static inline int ParseCpuList(const char* list, cpu_set_t* set) {
+  CPU_ZERO(set);
+  const char* p = list;
+  while (*p != '\0' && *p != '\n') {
+    char* end;
+    long lo = strtol(p, &end, 10);
+    if (end == p) {break;}
+    long hi = lo;
+    p = end;
+    if (*p == '-') {
+      hi = strtol(p + 1, &end, 10);
+      p = end;
+    }
+    for (long cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; ++cpu) {CPU_SET(cpu, set);}
+    if (*p == ',') {++p;}
+  }
+  return CPU_COUNT(set);
+}
+
+// The CPUs of a NUMA node. Returns how many there are, 0 if the node is
+// unknown or has no CPUs.
+static inline int NumaNodeCpus(int node, cpu_set_t* set) {
+  char path[128];
+  char buf[4096] = {0};
+  CPU_ZERO(set);
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+  FILE* f = fopen(path, "r");
+  if (f == NULL) {return 0;}
+  char* line = fgets(buf, sizeof(buf), f);
+  fclose(f);
+  return (line == NULL) ? 0 : ParseCpuList(buf, set);
+}
+#endif
+
+// Pin the calling thread to the CPUs of a NUMA node. Returns 0 on success.
+static inline int PinThreadToNode(int node) {
+#ifdef __linux__
+  cpu_set_t set;
+  if (NumaNodeCpus(node, &set) == 0) {return -1;}
+  return sched_setaffinity(0, sizeof(set), &set);
+#else
+  (void)node;
+  return -1;
+#endif
+}
+
+// Pin the calling thread to a single CPU. Returns 0 on success.
+static inline int PinThreadToCpu(int cpu) {
+#ifdef __linux__
+  cpu_set_t set;
+  if (cpu < 0 || cpu >= CPU_SETSIZE) {return -1;}
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set);
+#else
+  (void)cpu;
+  return -1;
+#endif
+}
+
+// Bind the pages of [ptr, ptr + bytesize) to a NUMA node with MPOL_BIND.
+// ptr must be page aligned. Call before the memory is first touched, so each
+// page is allocated on the node as it faults in. Returns 0 on success.
+static inline int BindMemoryToNode(void* ptr, size_t bytesize, int node) {
+#ifdef __linux__
+  unsigned long nodemask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+  if (node < 0 || node >= NUMA_MAX_NODES) {return -1;}
+  memset(nodemask, 0, sizeof(nodemask));
+  nodemask[node / (8 * sizeof(unsigned long))] = 1ul << (node % (8 * sizeof(unsigned long)));
+  size_t len = (bytesize + 4095) & ~(size_t)4095;
+  return (int)syscall(SYS_mbind, ptr, len, MPOL_BIND, nodemask, (unsigned long)NUMA_MAX_NODES,
+                      MPOL_MF_STRICT | MPOL_MF_MOVE);
+#else
+  (void)ptr;
+  (void)bytesize;
+  (void)node;
+  return -1;
+#endif
+}
+
+#endif	// __NUMABIND_H__
@@ -0,0 +1,152 @@
+// pagealloc.h
+//
+// Page-aligned benchmark arenas, backed by ordinary 4KB pages, transparent
+// huge pages (THP) or explicit hugetlbfs pages of 2MB or 1GB.
+//
+// Once a working set is bigger than what the dTLB can map with 4KB pages,
+// every pointer-chasing load also pays for TLB misses and page walks, which
+// smears the cache knees. Backing the arena with huge pages keeps the TLB out
+// of the measurement.
+//
+// Usable from both C and C++.
+
+#ifndef __PAGEALLOC_H__
+#define __PAGEALLOC_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+#endif
+
+// Page modes, in the order of the --page_mode= names below
+#define PAGE_MODE_4K  0   // 4KB pages, THP explicitly disabled
+#define PAGE_MODE_THP 1   // transparent huge pages through madvise()
+#define PAGE_MODE_2M  2   // explicit MAP_HUGETLB 2MB pages
+#define PAGE_MODE_1G  3   // explicit MAP_HUGETLB 1GB pages
+
+static const char* const kPageModeNames[] = {"4k", "thp", "2m", "1g"};
+
+typedef struct {
+  uint8_t* ptr;       // page-aligned start of the usable bytes
+  size_t bytesize;    // usable bytes
+  void* rawptr;       // what was actually mapped or malloc'd
+  size_t rawsize;
+  int mode;           // the page mode actually obtained, PAGE_MODE_*
+} Arena;
+
+// Returns the PAGE_MODE_* for a name such as "thp", or -1 if unknown
+static inline int ParsePageMode(const char* name) {
+  for (int i = 0; i < 4; ++i) {
+    if (strcmp(name, kPageModeNames[i]) == 0) {return i;}
+  }
+  return -1;
+}
+
+static inline const char* PageModeName(int mode) {
+  return kPageModeNames[mode];
+}
+
+static inline size_t RoundUp(size_t x, size_t align) {
+  return (x + align - 1) & ~(align - 1);
+}
+
+#ifdef __linux__
+// Returns 1 unless THP is disabled system-wide
+static inline int ThpAvailable() {
+  char buf[64] = {0};
+  FILE* f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+  if (f == NULL) {return 0;}
+  size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+  buf[n] = '\0';
+  return strstr(buf, "[never]") == NULL;
+}
+#endif
+
+// Allocate an arena of at least bytesize bytes with the requested page mode.
+// If the kernel cannot provide huge pages (none reserved in
+// /proc/sys/vm/nr_hugepages, THP disabled, not Linux), falls back to 4KB pages
+// with a note on stderr. Check arena->mode for the mode actually used.
+// Returns 0 on success, -1 if no memory could be allocated at all.
+static inline int AllocArena(Arena* arena, size_t bytesize, int mode) {
+  memset(arena, 0, sizeof(*arena));
+  arena->bytesize = bytesize;
+#ifdef __linux__
+  int prot = PROT_READ | PROT_WRITE;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+  if (mode == PAGE_MODE_2M || mode == PAGE_MODE_1G) {
+    size_t hugesize = (mode == PAGE_MODE_2M) ? ((size_t)1 << 21) : ((size_t)1 << 30);
+    int hugeflag = (mode == PAGE_MODE_2M) ? MAP_HUGE_2MB : MAP_HUGE_1GB;
+    size_t mapsize = RoundUp(bytesize, hugesize);
+    void* p = mmap(NULL, mapsize, prot, flags | MAP_HUGETLB | hugeflag, -1, 0);
+    if (p != MAP_FAILED) {
+      arena->rawptr = p;
+      arena->rawsize = mapsize;
+      arena->ptr = (uint8_t*)p;
+      arena->mode = mode;
+      return 0;
+    }
+    fprintf(stderr, "pagealloc: no %s hugetlb pages available, falling back to 4k pages\n",
+            PageModeName(mode));
+    mode = PAGE_MODE_4K;
+  }
+
+  if (mode == PAGE_MODE_THP && !ThpAvailable()) {
+    fprintf(stderr, "pagealloc: transparent huge pages are disabled, falling back to 4k pages\n");
+    mode = PAGE_MODE_4K;
+  }
+
+  // Over-allocate by 2MB so the THP arena can start on a huge page boundary.
+  // Pages are only backed once touched, and MAP_NORESERVE skips the commit
+  // accounting, so an arena far bigger than what gets touched still works on
+  // a small-memory machine.
+  size_t align = (size_t)1 << 21;
+  size_t mapsize = RoundUp(bytesize, 4096) + align;
+  void* p = mmap(NULL, mapsize, prot, flags | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED) {return -1;}
+  arena->rawptr = p;
+  arena->rawsize = mapsize;
+  arena->ptr = (uint8_t*)RoundUp((uintptr_t)p, align);
+  arena->mode = mode;
+  madvise(arena->ptr, RoundUp(bytesize, 4096),
+          (mode == PAGE_MODE_THP) ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+  return 0;
+#else
+  if (mode != PAGE_MODE_4K) {
+    fprintf(stderr, "pagealloc: huge pages need Linux, falling back to 4k pages\n");
+  }
+  size_t mapsize = bytesize + 4095;
+  arena->rawptr = malloc(mapsize);
+  if (arena->rawptr == NULL) {return -1;}
+  arena->rawsize = mapsize;
+  arena->ptr = (uint8_t*)RoundUp((uintptr_t)arena->rawptr, 4096);
+  arena->mode = PAGE_MODE_4K;
+  return 0;
+#endif
+}
+
+static inline void FreeArena(Arena* arena) {
+  if (arena->rawptr == NULL) {return;}
+#ifdef __linux__
+  munmap(arena->rawptr, arena->rawsize);
+#else
+  free(arena->rawptr);
+#endif
+  arena->rawptr = NULL;
+}
+
+#endif	// __PAGEALLOC_H__
@@ -0,0 +1,332 @@
+// Linked lists of Pairs for pointer-chasing benchmarks
+// Copyright 2021 Richard L. Sites
+//
+// MakeLongList() is from the mystery2.cc example in the book "Understanding
+// Software Dynamics"; the cyclic, random and page list builders were added by
+// the LPS/AMRE team and are shared by cachesize_estimated, cachesize_maximum
+// and the TLB benchmark.
+
+#ifndef __PAIRLIST_H__
+#define __PAIRLIST_H__
+
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+
+#include "basetypes.h"
+#include "polynomial.h"
+
+// We use a couple of fast pseudo-random generators that are based on standard 
+// cyclic reduncy check arithmetic. Look in Wikipedia for more information on 
+// CRC calculations.
+//
+// The particular CRC style we use is a left shift by one bit, followed by an 
+// XOR of a specific CRC bit pattern if the bit shifted out is 1. This mimics
+// long-used hardware that feeds back the top bit to XOR taps at specific 
+// places in a shift register. Our use here is just to get a bunch of non-zero 
+// bit patterns that have poor correlation from one to the next.
+//
+// Rather than the simple 
+//  if (highbit is 1)
+//    x = (x << 1) ^ bit_pattern
+//  else
+//    x = (x << 1)
+//
+// we make this calculation branch-free and therefore fast by ANDing the bit
+// pattern against either 00000... or 11111..., depending on the value of the
+// high bit. This is accomplished by an arithmetic right shift that sign-
+// extends the input value. The entire expansion is four inline instrucitons:
+// shift, shift, and, xor.
+// 
+
+// x must be of type uint8
+// #define POLY8 (0x1d)   // From CRC-8-SAE J1850
+// #define POLYSHIFT8(x) ( ((x) << 1) ^ ((static_cast<int8>((x)) >> 7) & POLY8) )
+// #define POLYINIT8 (0xffu)
+
+// POLY8 is a crc-based calculation that cycles through 255 byte values,
+// excluding zero so long as the initial value is non-zero. If the initial
+// value is zero, it cycles at zero every time.
+//
+// Here are the values if started at POLYINIT8 = 0xff
+//   ff e3 db ab 4b 96 31 62 c4 95 37 6e dc a5 57 ae 
+//   41 82 19 32 64 c8 8d 07 0e 1c 38 70 e0 dd a7 53 
+//   a6 51 a2 59 b2 79 f2 f9 ef c3 9b 2b 56 ac 45 8a 
+//   09 12 24 48 90 3d 7a f4 f5 f7 f3 fb eb cb 8b 0b 
+//   16 2c 58 b0 7d fa e9 cf 83 1b 36 6c d8 ad 47 8e 
+//   01 02 04 08 10 20 40 80 1d 3a 74 e8 cd 87 13 26 
+//   4c 98 2d 5a b4 75 ea c9 8f 03 06 0c 18 30 60 c0 
+//   9d 27 4e 9c 25 4a 94 35 6a d4 b5 77 ee c1 9f 23 
+//   46 8c 05 0a 14 28 50 a0 5d ba 69 d2 b9 6f de a1 
+//   5f be 61 c2 99 2f 5e bc 65 ca 89 0f 1e 3c 78 f0 
+//   fd e7 d3 bb 6b d6 b1 7f fe e1 df a3 5b b6 71 e2 
+//   d9 af 43 86 11 22 44 88 0d 1a 34 68 d0 bd 67 ce 
+//   81 1f 3e 7c f8 ed c7 93 3b 76 ec c5 97 33 66 cc 
+//   85 17 2e 5c b8 6d da a9 4f 9e 21 42 84 15 2a 54 
+//   a8 4d 9a 29 52 a4 55 aa 49 92 39 72 e4 d5 b7 73 
+//   e6 d1 bf 63 c6 91 3f 7e fc e5 d7 b3 7b f6 f1 ff 
+
+static const int kPageSize = 4096;
+static const int kPageSizeMask = kPageSize - 1;
+
+// We will read and write these pairs, allocated at different strides
+struct Pair {
+  Pair* next;
+  int64 data;
+};
+
+// Orders a list can be built in, see MakeSweepList() in the benchmarks
+enum ListOrder {
+  kListPoly8 = 0,     // MakeLongList(), POLY8 scramble within groups of 256
+  kListRandom,        // one random cycle over all elements
+  kListPageLocal,     // random cycle through each page, pages in random order
+  kListCrossPage,     // random cycle where every step lands on another page
+};
+
+static const char* const kListOrderNames[] = {"poly8", "random", "pagelocal", "crosspage"};
+
+// Returns the ListOrder for a name such as "random", or -1 if unknown
+inline int ParseListOrder(const char* name) {
+  for (int i = 0; i < 4; ++i) {
+    if (strcmp(name, kListOrderNames[i]) == 0) {return i;}
+  }
+  return -1;
+}
+
+// In a byte array, create a linked list of Pairs, spaced by the given stride. 
+// Pairs are generally allocated near the front of the array first and near 
+// the end of the array last. The list will have floor(bytesize / bytestride) 
+// elements. The last element's next field is NULL and all the data fields are 
+// zero. 
+//
+// ptr must be aligned on a multiple of sizeof(void*), i.e. 8 for a 64-bit CPU
+// bytestride must be a multiple of sizeof(void*), and  must be at least 16
+//
+// If makelinear is true, the list elements are at offsets 0, 1, 2, ... times
+// stride. If makelinear is false, the list elements are in a scrambled order 
+// that is intended to defeat any cache prefetching hardware. See the POLY8 
+// discussion above.
+//
+// This routine is not intended to be particularly fast; it is called just once
+//
+// Returns a pointer to the first element of the list
+inline Pair* MakeLongList(uint8* ptr, int64 bytesize, int bytestride, bool makelinear) {
+  // Make an array of 256 mixed-up offsets
+  // 0, ff, e3, db, ... 7b, f6, f1
+  int mixedup[256];
+  // First element
+  mixedup[0] = 0;
+  // 255 more elements
+  uint8 x = POLYINIT8;
+  for (int i = 1; i < 256; ++i) {
+    mixedup[i] = x;
+    x = POLYSHIFT8(x);
+  }
+
+  Pair* pairptr = reinterpret_cast<Pair*>(ptr);
+  int64 element_count = bytesize / bytestride;
+  // Make sure next element is in different DRAM row than current element
+  int64 extrabit = makelinear ? 0 : (1 << 14);
+  // Fill in N-1 elements, each pointing to the next one
+  for (int64 i = 1; i < element_count; ++i) {
+    // If not linear, there are mixed-up groups of 256 elements chained together
+    int64 nextelement = makelinear ? i : (i & ~0xff) | mixedup[i & 0xff];
+    Pair* nextptr = reinterpret_cast<Pair*>(ptr + ((nextelement * bytestride) ^ extrabit));
+    pairptr->next = nextptr;
+    pairptr->data = 0;
+    pairptr = nextptr;
+  }
+  // Fill in Nth element
+  pairptr->next = NULL;
+  pairptr->data = 0;
+
+  return reinterpret_cast<Pair*>(ptr);
+}
+
+// Like MakeLongList(), but the list is a cycle over exactly
+// floor(bytesize / bytestride) elements, all inside [ptr, ptr + bytesize): the
+// last element points back to the first. The order is the same POLY8 scramble
+// within groups of 256 elements, without the extra bit, and an incomplete
+// last group keeps only the offsets that fit. Walking the cycle over and over
+// keeps exactly bytesize bytes in use, however small.
+//
+// Returns a pointer to the first element of the cycle
+inline Pair* MakeCyclicList(uint8* ptr, int64 bytesize, int bytestride) {
+  int mixedup[256];
+  mixedup[0] = 0;
+  uint8 x = POLYINIT8;
+  for (int i = 1; i < 256; ++i) {
+    mixedup[i] = x;
+    x = POLYSHIFT8(x);
+  }
+
+  Pair* first = reinterpret_cast<Pair*>(ptr);
+  Pair* pairptr = first;
+  int64 element_count = bytesize / bytestride;
+  for (int64 group = 0; group < element_count; group += 256) {
+    for (int i = 0; i < 256; ++i) {
+      int64 nextelement = group | mixedup[i];
+      if (nextelement == 0 || nextelement >= element_count) {continue;}
+      Pair* nextptr = reinterpret_cast<Pair*>(ptr + nextelement * bytestride);
+      pairptr->next = nextptr;
+      pairptr->data = 0;
+      pairptr = nextptr;
+    }
+  }
+  pairptr->next = first;
+  pairptr->data = 0;
+
+  return first;
+}
+
+// Fisher-Yates shuffle of an index array
+inline void ShuffleIndices(std::vector<uint32>* indices, uint64* state) {
+  for (int64 i = static_cast<int64>(indices->size()) - 1; i > 0; --i) {
+    int64 j = RandomBelow(state, i + 1);
+    uint32 temp = (*indices)[i];
+    (*indices)[i] = (*indices)[j];
+    (*indices)[j] = temp;
+  }
+}
+
+// In a byte array, create a single random cycle through all
+// floor(bytesize / bytestride) Pairs, seeded by seed so runs are repeatable.
+// Unlike MakeLongList(), whose POLY8 order repeats in every group of 256
+// elements, there is no pattern here for a stream or spatial prefetcher to
+// latch onto. All the data fields are zero.
+//
+//   kListRandom     Sattolo's algorithm over all elements. Consecutive
+//                   elements are almost always on different pages.
+//   kListPageLocal  All the elements of a page in random order, then on to
+//                   the next page, pages in random order. Stresses the caches
+//                   with one TLB miss per page rather than per load.
+//   kListCrossPage  Every step lands on a different page: one element from
+//                   each page in random page order, then the next slot of
+//                   every page, and so on. Worst case for the TLB.
+//
+// Page-local and cross-page fall back to kListRandom when bytestride is a
+// page or more.
+//
+// Sattolo's algorithm runs in place on the next fields, so a 1GB list needs
+// no extra memory and builds in a second or two; the page orders need one
+// index per page.
+//
+// Returns a pointer to the first element of the cycle
+inline Pair* MakeRandomList(uint8* ptr, int64 bytesize, int bytestride, int order, uint64 seed) {
+  int64 element_count = bytesize / bytestride;
+  uint64 state = seed;
+
+  if (order == kListRandom || bytestride >= kPageSize) {
+    // Start with every element pointing to itself. Swapping each element's
+    // successor with that of a random *earlier* element leaves exactly one
+    // cycle through all of them.
+    for (int64 i = 0; i < element_count; ++i) {
+      Pair* pairptr = reinterpret_cast<Pair*>(ptr + static_cast<size_t>(i) * bytestride);
+      pairptr->next = pairptr;
+      pairptr->data = 0;
+    }
+    for (int64 i = element_count - 1; i > 0; --i) {
+      int64 j = RandomBelow(&state, i);
+      Pair* pairi = reinterpret_cast<Pair*>(ptr + static_cast<size_t>(i) * bytestride);
+      Pair* pairj = reinterpret_cast<Pair*>(ptr + static_cast<size_t>(j) * bytestride);
+      Pair* temp = pairi->next;
+      pairi->next = pairj->next;
+      pairj->next = temp;
+    }
+    return reinterpret_cast<Pair*>(ptr);
+  }
+
+  int per_page = kPageSize / bytestride;
+  int64 page_count = (element_count + per_page - 1) / per_page;
+  std::vector<uint32> pages(page_count);
+  std::vector<uint32> slots(per_page);
+  for (int64 p = 0; p < page_count; ++p) {pages[p] = p;}
+  for (int s = 0; s < per_page; ++s) {slots[s] = s;}
+
+  Pair* first = NULL;
+  Pair* pairptr = NULL;
+  int64 outer_count = (order == kListPageLocal) ? page_count : per_page;
+  int64 inner_count = (order == kListPageLocal) ? per_page : page_count;
+  if (order == kListPageLocal) {ShuffleIndices(&pages, &state);}
+  if (order == kListCrossPage) {ShuffleIndices(&slots, &state);}
+  for (int64 outer = 0; outer < outer_count; ++outer) {
+    // Page-local: a fresh slot order for each page. Cross-page: a fresh page
+    // order for each slot, not starting on the page we just left.
+    if (order == kListPageLocal) {
+      ShuffleIndices(&slots, &state);
+    } else {
+      uint32 last_page = pages[page_count - 1];
+      ShuffleIndices(&pages, &state);
+      if (outer > 0 && page_count > 1 && pages[0] == last_page) {
+        pages[0] = pages[page_count - 1];
+        pages[page_count - 1] = last_page;
+      }
+    }
+    for (int64 inner = 0; inner < inner_count; ++inner) {
+      uint32 page = (order == kListPageLocal) ? pages[outer] : pages[inner];
+      uint32 slot = (order == kListPageLocal) ? slots[inner] : slots[outer];
+      size_t element = static_cast<size_t>(page) * per_page + slot;
+      if (element >= static_cast<size_t>(element_count)) {continue;}
+      Pair* nextptr = reinterpret_cast<Pair*>(ptr + element * bytestride);
+      nextptr->data = 0;
+      if (first == NULL) {
+        first = nextptr;
+      } else {
+        pairptr->next = nextptr;
+      }
+      pairptr = nextptr;
+    }
+  }
+  pairptr->next = first;
+
+  return first;
+}
+
+// In a byte array, create a random cycle through count Pairs, one per
+// bytestride, for walking one line per page: with bytestride the page size,
+// every load of the cycle needs a translation of its own. Element i sits at
+// i * bytestride plus (i * linesize) % pagesize, so the lines spread over
+// every cache set instead of all sharing the set of offset 0, as
+// MakeLongList() with a page stride would; the data caches then hold count
+// lines as easily as count contiguous ones. The order is Sattolo's algorithm
+// seeded by seed, so neither the stream prefetchers nor a TLB prefetcher see
+// a pattern. All the data fields are zero.
+//
+// ptr must be aligned on a multiple of pagesize, and the array must hold
+// count * bytestride bytes
+//
+// Returns a pointer to the first element of the cycle
+inline Pair* MakePageList(uint8* ptr, int64 count, int64 bytestride, int64 pagesize, int linesize, uint64 seed) {
+  std::vector<Pair*> elements(count);
+  for (int64 i = 0; i < count; ++i) {
+    elements[i] = reinterpret_cast<Pair*>(ptr + i * bytestride + (i * linesize) % pagesize);
+    elements[i]->next = elements[i];
+    elements[i]->data = 0;
+  }
+  uint64 state = seed;
+  for (int64 i = count - 1; i > 0; --i) {
+    int64 j = RandomBelow(&state, i);
+    Pair* temp = elements[i]->next;
+    elements[i]->next = elements[j]->next;
+    elements[j]->next = temp;
+  }
+  return elements[0];
+}
+
+// Cut a cycle of count elements starting at first into k disjoint cycles,
+// each a run of about count / k consecutive elements of the original. The
+// runs keep the original order, so every chain is as hard to prefetch as the
+// whole cycle was. Stores the head of each chain in heads[0..k-1].
+inline void SplitCycle(Pair* first, int64 count, int k, Pair** heads) {
+  Pair* pairptr = first;
+  for (int c = 0; c < k; ++c) {
+    int64 length = (count * (c + 1)) / k - (count * c) / k;
+    heads[c] = pairptr;
+    for (int64 i = 1; i < length; ++i) {pairptr = pairptr->next;}
+    Pair* nextptr = pairptr->next;
+    pairptr->next = heads[c];
+    pairptr = nextptr;
+  }
+}
+
+#endif	// __PAIRLIST_H__
@@ -0,0 +1,175 @@
+// perfcounters.h
+//
+// A group of hardware performance counters around a timed region, through
+// the Linux perf_event_open() system call: core cycles, instructions
+// retired, L1D read misses, LLC read misses and dTLB read misses.
+//
+// A slow sweep point can come from cache misses, TLB misses, or simply a
+// lower clock; GetCycles() alone cannot tell these apart. Core cycles next to
+// the TSC show frequency dips, and the miss counts show which level missed.
+//
+// The counters count user space only, so they work with the default
+// perf_event_paranoid setting of 2. When the kernel refuses a counter (no
+// PMU in a VM, stricter paranoid setting, not Linux) it is marked missing and
+// prints as "-"; the benchmarks run the same either way.
+//
+// Usable from both C and C++.
+
+#ifndef __PERFCOUNTERS_H__
+#define __PERFCOUNTERS_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+// Counters of a group, in the order of the csv columns
+#define PERF_CYCLES       0
+#define PERF_INSTRUCTIONS 1
+#define PERF_L1D_MISSES   2
+#define PERF_LLC_MISSES   3
+#define PERF_DTLB_MISSES  4
+#define PERF_COUNTERS     5
+
+static const char* const kPerfCounterNames[PERF_COUNTERS] = {
+  "cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses"
+};
+
+typedef struct {
+  int fd[PERF_COUNTERS];            // -1 where the counter is missing or closed
+  int present[PERF_COUNTERS];       // 1 where the kernel gave us the counter,
+                                    // still set after PerfGroupClose()
+  int leader;                       // fd of the group leader, -1 if none opened
+  uint64_t value[PERF_COUNTERS];    // counts of the last PerfGroupStop()
+} PerfGroup;
+
+#ifdef __linux__
+// Sets the perf_event_attr type and config of each counter
+static inline void PerfCounterEvent(int counter, struct perf_event_attr* attr) {
+  uint64_t read_miss = PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+  switch (counter) {
+    case PERF_CYCLES:
+      attr->type = PERF_TYPE_HARDWARE;
+      attr->config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case PERF_INSTRUCTIONS:
+      attr->type = PERF_TYPE_HARDWARE;
+      attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case PERF_L1D_MISSES:
+      attr->type = PERF_TYPE_HW_CACHE;
+      attr->config = PERF_COUNT_HW_CACHE_L1D | read_miss;
+      break;
+    case PERF_LLC_MISSES:
+      attr->type = PERF_TYPE_HW_CACHE;
+      attr->config = PERF_COUNT_HW_CACHE_LL | read_miss;
+      break;
+    default:
+      attr->type = PERF_TYPE_HW_CACHE;
+      attr->config = PERF_COUNT_HW_CACHE_DTLB | read_miss;
+      break;
+  }
+}
+#endif
+
+// Open the counters for the calling thread, stopped. Counters the kernel
+// refuses are left out. Returns how many counters are available, 0 when none.
+static inline int PerfGroupOpen(PerfGroup* group) {
+  int available = 0;
+  memset(group, 0, sizeof(*group));
+  group->leader = -1;
+  for (int i = 0; i < PERF_COUNTERS; ++i) {group->fd[i] = -1;}
+#ifdef __linux__
+  for (int i = 0; i < PERF_COUNTERS; ++i) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    PerfCounterEvent(i, &attr);
+    attr.disabled = (group->leader < 0);   // the leader starts the whole group
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, group->leader, 0);
+    if (fd < 0) {continue;}
+    if (group->leader < 0) {group->leader = fd;}
+    group->fd[i] = fd;
+    group->present[i] = 1;
+    ++available;
+  }
+#endif
+  return available;
+}
+
+// Zero and start all counters of the group at once
+static inline void PerfGroupStart(PerfGroup* group) {
+#ifdef __linux__
+  if (group->leader < 0) {return;}
+  ioctl(group->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(group->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+  (void)group;
+#endif
+}
+
+// Stop all counters of the group and read them into group->value
+static inline void PerfGroupStop(PerfGroup* group) {
+#ifdef __linux__
+  if (group->leader < 0) {return;}
+  ioctl(group->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  // PERF_FORMAT_GROUP: the number of counters, then their values in the
+  // order they joined the group
+  uint64_t buf[1 + PERF_COUNTERS];
+  if (read(group->leader, buf, sizeof(buf)) < (ssize_t)sizeof(uint64_t)) {return;}
+  int next = 0;
+  for (int i = 0; i < PERF_COUNTERS; ++i) {
+    if (group->fd[i] < 0) {continue;}
+    group->value[i] = (next < (int)buf[0]) ? buf[1 + next] : 0;
+    ++next;
+  }
+#else
+  (void)group;
+#endif
+}
+
+static inline void PerfGroupClose(PerfGroup* group) {
+#ifdef __linux__
+  for (int i = 0; i < PERF_COUNTERS; ++i) {
+    if (group->fd[i] >= 0) {close(group->fd[i]);}
+    group->fd[i] = -1;
+  }
+#endif
+  group->leader = -1;
+}
+
+// The csv column names, each preceded by sep, e.g. ", cycles, instructions,
+// ..." for sep ", "
+static inline void PerfCsvHeader(const char* sep, char* buf, size_t bufsize) {
+  size_t used = 0;
+  buf[0] = '\0';
+  for (int i = 0; i < PERF_COUNTERS && used < bufsize; ++i) {
+    used += snprintf(buf + used, bufsize - used, "%s%s", sep, kPerfCounterNames[i]);
+  }
+}
+
+// The last counts divided by per, e.g. the number of loads in the region,
+// each preceded by sep; "-" for missing counters
+static inline void PerfCsvValues(const PerfGroup* group, double per, const char* sep,
+                                 char* buf, size_t bufsize) {
+  size_t used = 0;
+  buf[0] = '\0';
+  for (int i = 0; i < PERF_COUNTERS && used < bufsize; ++i) {
+    if (!group->present[i]) {
+      used += snprintf(buf + used, bufsize - used, "%s-", sep);
+    } else {
+      used += snprintf(buf + used, bufsize - used, "%s%.3f", sep, group->value[i] / per);
+    }
+  }
+}
+
+#endif	// __PERFCOUNTERS_H__
@@ -0,0 +1,71 @@
+// physaddr.h
+//
+// Physical addresses of the calling process' memory, through
+// /proc/self/pagemap.
+//
+// L2 and L3 caches are physically indexed. With 4KB pages only the low 12
+// bits of a virtual address survive translation, so lines picked by their
+// virtual index land in effectively random sets of any cache with more than
+// 64 sets. Knowing the page frame numbers lets a benchmark choose lines by
+// their physical set index instead.
+//
+// Since Linux 4.0 the kernel only shows page frame numbers to processes with
+// CAP_SYS_ADMIN; to everyone else they read as 0, which PhysicalAddress()
+// reports as unknown.
+//
+// Usable from both C and C++.
+
+#ifndef __PHYSADDR_H__
+#define __PHYSADDR_H__
+
+#include <stdint.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define PAGEMAP_PRESENT  ((uint64_t)1 << 63)
+#define PAGEMAP_PFN_MASK (((uint64_t)1 << 55) - 1)
+
+// Returns a file descriptor for /proc/self/pagemap, -1 if there is none
+static inline int PagemapOpen(void) {
+#ifdef __linux__
+  return open("/proc/self/pagemap", O_RDONLY);
+#else
+  return -1;
+#endif
+}
+
+static inline void PagemapClose(int fd) {
+#ifdef __linux__
+  if (fd >= 0) {close(fd);}
+#else
+  (void)fd;
+#endif
+}
+
+// Returns the physical address of p, 0 when it is unknown: the page was never
+// touched or is swapped out, or the kernel hides page frame numbers
+static inline uint64_t PhysicalAddress(int fd, const void* p) {
+#ifdef __linux__
+  if (fd < 0) {return 0;}
+  uint64_t pagesize = (uint64_t)sysconf(_SC_PAGESIZE);
+  uint64_t vaddr = (uint64_t)(uintptr_t)p;
+  uint64_t entry = 0;
+  // One 64-bit entry per virtual page
+  if (pread(fd, &entry, sizeof(entry), (off_t)(vaddr / pagesize * sizeof(entry))) != sizeof(entry)) {
+    return 0;
+  }
+  if ((entry & PAGEMAP_PRESENT) == 0) {return 0;}
+  uint64_t pfn = entry & PAGEMAP_PFN_MASK;
+  if (pfn == 0) {return 0;}
+  return pfn * pagesize + vaddr % pagesize;
+#else
+  (void)fd;
+  (void)p;
+  return 0;
+#endif
+}
+
+#endif	// __PHYSADDR_H__
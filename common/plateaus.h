@@ -0,0 +1,107 @@
+// plateaus.h
+//
+// Splitting a latency-versus-working-set curve into cache levels, as the
+// hierarchy sweeps of cachesize_estimated and cha2sm measure it: the sweep
+// points go from small to large working sets, a fixed number per doubling,
+// and each point holds the steady-state cycles per load of that working set.
+//
+// C++ only.
+
+#ifndef __PLATEAUS_H__
+#define __PLATEAUS_H__
+
+#include <math.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// Cost of one more segment when splitting log(latency) into plateaus
+static const double kSegmentPenalty = 0.2;
+// Neighbouring plateaus within this fraction of each other are one level
+static const double kPlateauTolerance = 0.25;
+
+// A run of neighbouring sweep points with about the same latency
+struct Plateau {
+  int first;        // index of the first sweep point on the plateau
+  int last;         // index of the last, i.e. largest, sweep point on it
+  double latency;   // median cycles per load over the plateau
+};
+
+// Split a latency-versus-size curve into cache levels.
+//
+// First an exact segmentation: dynamic programming picks the piecewise-
+// constant fit of log(latency) that minimizes squared error plus
+// kSegmentPenalty per segment. Segments spanning at least points_per_octave
+// points are plateaus; shorter ones are the climbs between plateaus. The last
+// segment is kept however short, since the sweep may stop soon after the
+// final climb. Neighbouring plateaus within kPlateauTolerance of each other
+// are merged.
+inline std::vector<Plateau> FindPlateaus(const std::vector<double>& latency, int points_per_octave) {
+  int n = latency.size();
+  std::vector<double> sum(n + 1, 0.0);
+  std::vector<double> sumsq(n + 1, 0.0);
+  for (int i = 0; i < n; ++i) {
+    double y = log(latency[i]);
+    sum[i + 1] = sum[i] + y;
+    sumsq[i + 1] = sumsq[i] + y * y;
+  }
+
+  // best[j] is the cost of the best segmentation of points [0, j), whose
+  // last segment starts at start[j]
+  std::vector<double> best(n + 1, 0.0);
+  std::vector<int> start(n + 1, 0);
+  for (int j = 1; j <= n; ++j) {
+    best[j] = -1.0;
+    for (int i = 0; i < j; ++i) {
+      double s = sum[j] - sum[i];
+      double cost = best[i] + (sumsq[j] - sumsq[i]) - s * s / (j - i) + kSegmentPenalty;
+      if (best[j] < 0.0 || cost < best[j]) {
+        best[j] = cost;
+        start[j] = i;
+      }
+    }
+  }
+
+  std::vector<std::pair<int, int> > segments;
+  for (int j = n; j > 0; j = start[j]) {
+    segments.push_back(std::make_pair(start[j], j));
+  }
+  std::reverse(segments.begin(), segments.end());
+
+  std::vector<Plateau> plateaus;
+  for (size_t k = 0; k < segments.size(); ++k) {
+    int first = segments[k].first;
+    int end = segments[k].second;
+    if (end - first < points_per_octave && end != n) {continue;}
+    std::vector<double> values(latency.begin() + first, latency.begin() + end);
+    std::sort(values.begin(), values.end());
+    double median = values[values.size() / 2];
+    if (!plateaus.empty() && median <= plateaus.back().latency * (1.0 + kPlateauTolerance)) {
+      plateaus.back().last = end - 1;
+    } else {
+      Plateau plateau = {first, end - 1, median};
+      plateaus.push_back(plateau);
+    }
+  }
+  return plateaus;
+}
+
+// Capacity of the level of plateaus[p], in the units of sizes[], the working
+// set of each sweep point. It is where the climb to the next plateau crosses
+// the midpoint of the two latencies, interpolated on the log size axis. The
+// climb starts before the level is full, so its last plateau point would
+// underestimate the capacity. p must not be the last plateau.
+inline double PlateauCapacity(const std::vector<double>& latency, const std::vector<double>& sizes,
+                              const std::vector<Plateau>& plateaus, int p) {
+  double midpoint = (plateaus[p].latency + plateaus[p + 1].latency) / 2.0;
+  int k = plateaus[p].last + 1;
+  while (k < plateaus[p + 1].first && latency[k] < midpoint) {++k;}
+  double fraction = (midpoint - latency[k - 1]) / (latency[k] - latency[k - 1]);
+  fraction = std::min(1.0, std::max(0.0, fraction));
+  double log_size = log2(sizes[k - 1]) + fraction * (log2(sizes[k]) - log2(sizes[k - 1]));
+  return pow(2.0, log_size);
+}
+
+#endif	// __PLATEAUS_H__
@@ -21,6 +21,20 @@
 #define POLYSHIFT64(x) ( ((x) << 1) ^ static_cast<uint64>((static_cast<int64>((x)) >> 63) & POLY64) )
 #define POLYINIT64 (0xfffffffffffffffflu)
 
+// splitmix64: full-period 64-bit generator with well-mixed output, for when
+// the CRC sequences above are too regular. state may start at any value.
+inline uint64 NextRandom(uint64* state) {
+  uint64 z = (*state += CLU(0x9e3779b97f4a7c15));
+  z = (z ^ (z >> 30)) * CLU(0xbf58476d1ce4e5b9);
+  z = (z ^ (z >> 27)) * CLU(0x94d049bb133111eb);
+  return z ^ (z >> 31);
+}
+
+// Uniform pseudo-random value in [0, n), by multiplying into the high half
+inline uint64 RandomBelow(uint64* state, uint64 n) {
+  return static_cast<uint64>((static_cast<unsigned __int128>(NextRandom(state)) * n) >> 64);
+}
+
 #endif	// __POLYNOMIAL_H__
 
 
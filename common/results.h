@@ -0,0 +1,79 @@
+// results.h
+//
+// A results sink: the named parameters a benchmark stage finds, such as the
+// line size or the L2 size, kept in one place so later stages can read them
+// and all of them can be printed together at the end.
+//
+// Every result records where it came from: "measured" by a stage, read from
+// "sysfs", set by command line "flags", or a built-in "default" used when
+// nothing else worked. A later stage can then tell a measured value from a
+// guess. A result may also say how precise it is: ci is the width of its 95%
+// confidence interval as a fraction of the value, 0 for a value that is exact
+// such as a count from sysfs, or -1 when nobody knows.
+//
+// C++ only.
+
+#ifndef __RESULTS_H__
+#define __RESULTS_H__
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+struct Result {
+  std::string stage;    // the stage that set it, e.g. "linesize"
+  std::string key;      // e.g. "line_size", "l2_size", "l2_ways"
+  double value;
+  std::string unit;     // e.g. "bytes", "cycles", "" for plain counts
+  std::string source;   // "measured", "sysfs", "flags" or "default"
+  double ci;            // 95% confidence interval over value, -1 if unknown
+};
+
+struct ResultSet {
+  std::vector<Result> results;
+};
+
+// Sets key to value, replacing any earlier value of key
+inline void SetResult(ResultSet* set, const char* stage, const char* key, double value,
+                      const char* unit, const char* source, double ci = -1.0) {
+  Result result = {stage, key, value, unit, source, ci};
+  for (size_t i = 0; i < set->results.size(); ++i) {
+    if (set->results[i].key == key) {
+      set->results[i] = result;
+      return;
+    }
+  }
+  set->results.push_back(result);
+}
+
+// Returns the result for key, or NULL if no stage has set it
+inline const Result* FindResult(const ResultSet* set, const char* key) {
+  for (size_t i = 0; i < set->results.size(); ++i) {
+    if (set->results[i].key == key) {return &set->results[i];}
+  }
+  return NULL;
+}
+
+// Returns the value of key, or fallback if no stage has set it
+inline double GetResult(const ResultSet* set, const char* key, double fallback) {
+  const Result* result = FindResult(set, key);
+  return (result == NULL) ? fallback : result->value;
+}
+
+// Writes every result as a csv row, in the order they were first set, with
+// - for an unknown ci
+inline void WriteResults(const ResultSet* set, FILE* f) {
+  fprintf(f, "stage, key, value, unit, source, ci\n");
+  for (size_t i = 0; i < set->results.size(); ++i) {
+    const Result& r = set->results[i];
+    fprintf(f, "%s, %s, %.10g, %s, %s, ", r.stage.c_str(), r.key.c_str(), r.value, r.unit.c_str(), r.source.c_str());
+    if (r.ci < 0.0) {
+      fprintf(f, "-\n");
+    } else {
+      fprintf(f, "%.3g\n", r.ci);
+    }
+  }
+}
+
+#endif	// __RESULTS_H__
@@ -0,0 +1,144 @@
+// sampling.h
+//
+// How many times to measure one point of a sweep. Instead of a fixed repeat
+// count, a Sampler collects measurements of a point until the 95% confidence
+// interval of their median is narrower than a target fraction of the median,
+// or than a fixed resolution such as one cycle, or the point's time budget or
+// most samples run out. A stable point is done
+// after the first few samples; a noisy one, typically where the curve steps
+// from one cache level to the next, gets the extra samples.
+//
+// The interval comes from the order statistics of the samples, so it needs no
+// assumption about their distribution: with n samples sorted, the median lies
+// between the j-th and k-th with 95% confidence for j = (n - 1.96 sqrt(n)) / 2
+// rounded down and k = (n + 1.96 sqrt(n)) / 2 + 1 rounded up. With 5 samples
+// that is their whole range, with 20 the 5th to the 16th.
+//
+// The benchmarks take the same flags:
+//   --ci_target=<percent>  width of the interval, as a percentage of the
+//                          median, below which a point is done
+//   --time_budget=<ms>     time after which a point is done anyway
+//   --max_samples=<n>      samples after which a point is done anyway
+//
+// Usable from both C and C++.
+
+#ifndef __SAMPLING_H__
+#define __SAMPLING_H__
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SAMPLER_MAX_SAMPLES 1024
+
+typedef struct {
+  int min_samples;              // never done before this many
+  int max_samples;              // always done after this many
+  double target;                // interval width over the median that is good enough
+  double resolution;            // interval width that is always good enough, e.g. one
+                                // cycle for readings in whole cycles
+  double budget_ms;             // time per point, 0 for none
+} SamplingPolicy;
+
+typedef struct {
+  SamplingPolicy policy;
+  double samples[SAMPLER_MAX_SAMPLES];
+  int count;
+  double start_ms;
+} Sampler;
+
+static inline void InitSamplingPolicy(SamplingPolicy* policy, int min_samples, int max_samples, double target,
+                                      double budget_ms) {
+  policy->min_samples = (min_samples < 1) ? 1 : min_samples;
+  policy->max_samples = (max_samples > SAMPLER_MAX_SAMPLES) ? SAMPLER_MAX_SAMPLES : max_samples;
+  if (policy->max_samples < policy->min_samples) {policy->max_samples = policy->min_samples;}
+  policy->target = target;
+  policy->resolution = 0.0;
+  policy->budget_ms = budget_ms;
+}
+
+// Takes arg if it is one of the flags above. Returns 1 if it was, 0 if not.
+static inline int ParseSamplingFlag(SamplingPolicy* policy, const char* arg) {
+  if (strncmp(arg, "--ci_target=", 12) == 0) {
+    policy->target = atof(arg + 12) / 100.0;
+    return 1;
+  }
+  if (strncmp(arg, "--time_budget=", 14) == 0) {
+    policy->budget_ms = atof(arg + 14);
+    return 1;
+  }
+  if (strncmp(arg, "--max_samples=", 14) == 0) {
+    double resolution = policy->resolution;
+    InitSamplingPolicy(policy, policy->min_samples, atoi(arg + 14), policy->target, policy->budget_ms);
+    policy->resolution = resolution;
+    return 1;
+  }
+  return 0;
+}
+
+static inline double SamplerNowMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Starts a new point
+static inline void StartSampler(Sampler* sampler, const SamplingPolicy* policy) {
+  sampler->policy = *policy;
+  sampler->count = 0;
+  sampler->start_ms = SamplerNowMs();
+}
+
+static inline void AddSample(Sampler* sampler, double value) {
+  if (sampler->count < SAMPLER_MAX_SAMPLES) {sampler->samples[sampler->count++] = value;}
+}
+
+static inline int CompareSamples(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+// Sorts a copy of the samples into sorted, which holds SAMPLER_MAX_SAMPLES
+static inline void SortedSamples(const Sampler* sampler, double* sorted) {
+  memcpy(sorted, sampler->samples, sampler->count * sizeof(double));
+  qsort(sorted, sampler->count, sizeof(double), CompareSamples);
+}
+
+static inline double SamplerMedian(const Sampler* sampler) {
+  double sorted[SAMPLER_MAX_SAMPLES];
+  int n = sampler->count;
+  if (n == 0) {return 0.0;}
+  SortedSamples(sampler, sorted);
+  return (n % 2 == 1) ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2.0;
+}
+
+// Width of the 95% confidence interval of the median. Returns a huge value for
+// fewer than two samples.
+static inline double SamplerCiWidth(const Sampler* sampler) {
+  double sorted[SAMPLER_MAX_SAMPLES];
+  int n = sampler->count;
+  if (n < 2) {return 1e300;}
+  SortedSamples(sampler, sorted);
+  double half = 1.96 * sqrt((double)n) / 2.0;
+  int j = (int)floor(n / 2.0 - half);            // 1-based ranks
+  int k = (int)ceil(n / 2.0 + half) + 1;
+  if (j < 1) {j = 1;}
+  if (k > n) {k = n;}
+  return sorted[k - 1] - sorted[j - 1];
+}
+
+// Returns 1 once the point has enough samples: the interval is within target
+// of the median, or within resolution, after min_samples, or max_samples or
+// the time budget ran out
+static inline int SamplerDone(const Sampler* sampler) {
+  if (sampler->count >= sampler->policy.max_samples) {return 1;}
+  if (sampler->count < sampler->policy.min_samples) {return 0;}
+  if (sampler->policy.budget_ms > 0.0 && SamplerNowMs() - sampler->start_ms >= sampler->policy.budget_ms) {return 1;}
+  double width = SamplerCiWidth(sampler);
+  return width <= sampler->policy.target * fabs(SamplerMedian(sampler)) || width <= sampler->policy.resolution;
+}
+
+#endif	// __SAMPLING_H__
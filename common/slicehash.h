@@ -0,0 +1,70 @@
+// slicehash.h
+//
+// The last level cache slice of a physical address, given the slice hash as
+// a list of address masks, and the text file the slice hash benchmark
+// exports it in.
+//
+// Intel splits the LLC into slices, one per core or tile, and picks the slice
+// of a line by an undocumented hash of its physical address. For a power of
+// two number of slices the hash is linear: bit i of the slice number is the
+// parity of the address ANDed with mask i. The masks only describe the hash up
+// to a renumbering of the slices, which is all a benchmark needs to tell
+// whether two lines share a slice.
+//
+// The file has one mask per line, in hex, slice bit 0 first; lines starting
+// with # are comments.
+//
+// Usable from both C and C++.
+
+#ifndef __SLICEHASH_H__
+#define __SLICEHASH_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SLICE_MAX_BITS 8
+
+typedef struct {
+  int bits;                         // number of slice bits, 2^bits slices
+  uint64_t mask[SLICE_MAX_BITS];    // physical address bits XORed into slice bit i
+} SliceHash;
+
+// Returns the slice of a physical address, from 0 to 2^bits - 1
+static inline int SliceOf(const SliceHash* hash, uint64_t address) {
+  int slice = 0;
+  for (int i = 0; i < hash->bits; ++i) {
+    slice |= __builtin_parityll(address & hash->mask[i]) << i;
+  }
+  return slice;
+}
+
+// Reads a slice hash file. Returns 0 on success, -1 if it cannot be read or
+// holds no masks.
+static inline int ReadSliceHash(const char* path, SliceHash* hash) {
+  FILE* f = fopen(path, "r");
+  if (f == NULL) {return -1;}
+  char line[256];
+  hash->bits = 0;
+  while (fgets(line, sizeof(line), f) != NULL && hash->bits < SLICE_MAX_BITS) {
+    if (line[0] == '#' || line[0] == '\n') {continue;}
+    hash->mask[hash->bits++] = strtoull(line, NULL, 16);
+  }
+  fclose(f);
+  return (hash->bits > 0) ? 0 : -1;
+}
+
+// Writes a slice hash file, with comment as its first line. Returns 0 on
+// success.
+static inline int WriteSliceHash(const char* path, const SliceHash* hash, const char* comment) {
+  FILE* f = fopen(path, "w");
+  if (f == NULL) {return -1;}
+  fprintf(f, "# %s\n", comment);
+  for (int i = 0; i < hash->bits; ++i) {
+    fprintf(f, "0x%llx\n", (unsigned long long)hash->mask[i]);
+  }
+  fclose(f);
+  return 0;
+}
+
+#endif	// __SLICEHASH_H__
@@ -0,0 +1,381 @@
+// threadscaling.h
+//
+// Throughput of 1, 2, ... threads running the same workload, from one
+// persistent pool of pinned worker threads, and the fits that turn the
+// throughput curve into a virtual core count and an SMT yield.
+//
+// The pool is started once. Worker k is pinned to the k-th CPU of the order
+// below, wrapping around when there are more workers than CPUs, so every
+// thread count lands on the same CPUs every time and oversubscription is two
+// threads per CPU, not whatever the scheduler does. Idle workers sleep on a
+// condition variable; a point wakes the first n, waits until all of them are
+// running, and times a fixed interval from there, so neither thread start-up
+// nor the ramp of the first and last thread is in the measurement.
+//
+// Four workload classes, each counting its own kind of operation:
+//   int    xorshift steps, four independent chains      (integer ALU)
+//   fp     double multiply-adds on 4-wide vectors        (FP / SIMD)
+//   l1     8-byte loads summed over a 16KB array         (L1-resident loads)
+//   dram   loads of a random pointer chase over a large  (memory latency)
+//          per-thread cycle
+// Compute-bound classes show the SMT yield of the execution units, the load
+// classes that of the load ports and of the memory-level parallelism.
+//
+// C++ only.
+
+#ifndef __THREADSCALING_H__
+#define __THREADSCALING_H__
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "basetypes.h"
+#include "numabind.h"
+#include "pairlist.h"
+
+enum Workload {
+  kWorkloadInt = 0,
+  kWorkloadFp,
+  kWorkloadL1,
+  kWorkloadDram,
+  kWorkloadCount
+};
+
+static const char* const kWorkloadNames[kWorkloadCount] = {"int", "fp", "l1", "dram"};
+
+// Bytes of the array the l1 workload sums, well inside any L1d
+static const int kL1WorkloadBytes = 16 << 10;
+
+// Returns the Workload for a name such as "fp", or -1 if unknown
+inline int ParseWorkload(const char* name) {
+  for (int i = 0; i < kWorkloadCount; ++i) {
+    if (strcmp(name, kWorkloadNames[i]) == 0) {return i;}
+  }
+  return -1;
+}
+
+typedef double ScalingVector __attribute__((vector_size(32)));
+
+struct ScalingPool {
+  std::vector<int> cpus;            // CPU of worker k is cpus[k % cpus.size()]
+  std::vector<std::thread> workers;
+  uint8* memory;                    // dram workload memory, split between the workers
+  int64 bytes_per_worker;
+  int linesize;
+
+  // One point: which workload, how many workers take part, and the
+  // generation that tells the sleeping workers there is a new point
+  std::mutex mutex;
+  std::condition_variable wake;
+  uint64 generation;
+  int workload;
+  int threads;
+  bool quit;
+
+  std::atomic<int> started;         // workers of this point running
+  std::atomic<int> finished;        // workers of this point done
+  std::atomic<bool> go;             // all started, count from now
+  std::atomic<bool> stop;           // interval over
+  std::vector<uint64> ops;          // per worker, kOpsStride apart
+  std::vector<int> ready;           // per worker, its memory is set up
+};
+
+// Per-worker counters are this many uint64 apart, a line each
+static const int kOpsStride = 8;
+
+// Runs one workload until pool->stop, in chunks of a few microseconds.
+// Returns the operations done. head is this worker's dram chase, l1 its
+// array; sink keeps the results live.
+inline uint64 RunWorkload(ScalingPool* pool, int workload, const Pair* head, const uint64* l1, uint64 seed,
+                          volatile uint64* sink) {
+  uint64 ops = 0;
+  if (workload == kWorkloadInt) {
+    uint64 x0 = seed + 1, x1 = seed + 2, x2 = seed + 3, x3 = seed + 4;
+    while (!pool->stop.load(std::memory_order_relaxed)) {
+      for (int i = 0; i < 1024; ++i) {
+        x0 ^= x0 << 13; x0 ^= x0 >> 7; x0 ^= x0 << 17;
+        x1 ^= x1 << 13; x1 ^= x1 >> 7; x1 ^= x1 << 17;
+        x2 ^= x2 << 13; x2 ^= x2 >> 7; x2 ^= x2 << 17;
+        x3 ^= x3 << 13; x3 ^= x3 >> 7; x3 ^= x3 << 17;
+      }
+      ops += 4 * 1024;
+    }
+    *sink = x0 ^ x1 ^ x2 ^ x3;
+  } else if (workload == kWorkloadFp) {
+    // Eight independent accumulators cover the multiply-add latency. The
+    // values converge to 1.0 and stay finite however long it runs.
+    ScalingVector acc[8];
+    ScalingVector m = {0.999999, 0.999998, 0.999997, 0.999996};
+    ScalingVector a = {1e-6, 2e-6, 3e-6, 4e-6};
+    for (int k = 0; k < 8; ++k) {acc[k] = m * static_cast<double>(seed + k);}
+    while (!pool->stop.load(std::memory_order_relaxed)) {
+      for (int i = 0; i < 256; ++i) {
+#pragma GCC unroll 8
+        for (int k = 0; k < 8; ++k) {acc[k] = acc[k] * m + a;}
+      }
+      ops += 256 * 8 * 4 * 2;
+    }
+    double sum = 0.0;
+    for (int k = 0; k < 8; ++k) {sum += acc[k][0] + acc[k][1] + acc[k][2] + acc[k][3];}
+    *sink = static_cast<uint64>(sum);
+  } else if (workload == kWorkloadL1) {
+    int count = kL1WorkloadBytes / sizeof(uint64);
+    uint64 s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    while (!pool->stop.load(std::memory_order_relaxed)) {
+      for (int i = 0; i < count; i += 4) {
+        s0 += l1[i];
+        s1 += l1[i + 1];
+        s2 += l1[i + 2];
+        s3 += l1[i + 3];
+      }
+      ops += count;
+    }
+    *sink = s0 + s1 + s2 + s3;
+  } else {
+    const Pair* pairptr = head;
+    while (!pool->stop.load(std::memory_order_relaxed)) {
+      for (int i = 0; i < 256; ++i) {pairptr = pairptr->next;}
+      ops += 256;
+    }
+    *sink = reinterpret_cast<uintptr_t>(pairptr);
+  }
+  return ops;
+}
+
+// Worker id of the pool: pins itself, builds its dram chase in its own slice
+// of the memory (first touched here, so it is local to the worker's node),
+// then runs points until the pool quits
+inline void ScalingWorker(ScalingPool* pool, int id) {
+  PinThreadToCpu(pool->cpus[id % pool->cpus.size()]);
+  std::vector<uint64> l1(kL1WorkloadBytes / sizeof(uint64), 1);
+  const Pair* head = NULL;
+  if (pool->bytes_per_worker > 0) {
+    head = MakeRandomList(pool->memory + id * pool->bytes_per_worker, pool->bytes_per_worker,
+                          pool->linesize, kListRandom, id + 1);
+  }
+  uint64 sink = 0;
+  uint64 seen = 0;
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->ready[id] = 1;
+  }
+  pool->wake.notify_all();
+
+  for (;;) {
+    int workload;
+    bool active;
+    {
+      std::unique_lock<std::mutex> lock(pool->mutex);
+      pool->wake.wait(lock, [pool, seen]() {return pool->quit || pool->generation != seen;});
+      if (pool->quit) {return;}
+      seen = pool->generation;
+      workload = pool->workload;
+      active = id < pool->threads;
+    }
+    if (!active) {continue;}
+    if (workload == kWorkloadDram && head == NULL) {workload = kWorkloadL1;}
+    pool->started.fetch_add(1);
+    while (!pool->go.load()) {std::this_thread::yield();}
+    pool->ops[id * kOpsStride] = RunWorkload(pool, workload, head, l1.data(), id, &sink);
+    pool->finished.fetch_add(1);
+  }
+}
+
+// Starts workers workers on cpus, in that order. memory holds the dram
+// workload's chases, bytes_per_worker each; with no memory the dram workload
+// falls back to l1. Returns once every worker has set up its memory.
+inline void StartScalingPool(ScalingPool* pool, int workers, const std::vector<int>& cpus, uint8* memory,
+                             int64 bytes_per_worker, int linesize) {
+  pool->cpus = cpus;
+  if (pool->cpus.empty()) {pool->cpus.push_back(0);}
+  pool->memory = memory;
+  pool->bytes_per_worker = (memory == NULL) ? 0 : bytes_per_worker;
+  pool->linesize = linesize;
+  pool->generation = 0;
+  pool->workload = kWorkloadInt;
+  pool->threads = 0;
+  pool->quit = false;
+  pool->ops.assign(workers * kOpsStride, 0);
+  pool->ready.assign(workers, 0);
+  for (int id = 0; id < workers; ++id) {pool->workers.push_back(std::thread(ScalingWorker, pool, id));}
+  std::unique_lock<std::mutex> lock(pool->mutex);
+  pool->wake.wait(lock, [pool]() {
+    return std::count(pool->ready.begin(), pool->ready.end(), 1) == static_cast<long>(pool->ready.size());
+  });
+}
+
+inline void StopScalingPool(ScalingPool* pool) {
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->quit = true;
+  }
+  pool->wake.notify_all();
+  for (size_t i = 0; i < pool->workers.size(); ++i) {pool->workers[i].join();}
+  pool->workers.clear();
+}
+
+// Throughput of the first threads workers running workload for millis
+// milliseconds, in millions of operations per second
+inline double RunScalingPoint(ScalingPool* pool, int workload, int threads, int millis) {
+  pool->started.store(0);
+  pool->finished.store(0);
+  pool->go.store(false);
+  pool->stop.store(false);
+  {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->workload = workload;
+    pool->threads = threads;
+    ++pool->generation;
+  }
+  pool->wake.notify_all();
+  while (pool->started.load() < threads) {std::this_thread::yield();}
+
+  auto start = std::chrono::steady_clock::now();
+  pool->go.store(true);
+  std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+  pool->stop.store(true);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  while (pool->finished.load() < threads) {std::this_thread::yield();}
+
+  uint64 total = 0;
+  for (int id = 0; id < threads; ++id) {total += pool->ops[id * kOpsStride];}
+  return total / elapsed.count() / 1e6;
+}
+
+// Orders cpus so the first thread of every core comes before any second
+// thread, using the sibling lists in sysfs, so n threads on the first n CPUs
+// use as many cores as they can. Returns the number of cores among cpus.
+inline int OrderCpusByCore(std::vector<int>* cpus) {
+  // A core is known by the first CPU of its sibling list, which need not be
+  // among cpus itself
+  std::vector<int> core_ids;
+  std::vector<std::vector<int> > siblings;    // per core, its CPUs among cpus
+  for (size_t i = 0; i < cpus->size(); ++i) {
+    int cpu = (*cpus)[i];
+    int first = cpu;
+#ifdef __linux__
+    char path[128];
+    char buf[256];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+    FILE* f = fopen(path, "r");
+    if (f != NULL) {
+      if (fgets(buf, sizeof(buf), f) != NULL) {first = atoi(buf);}
+      fclose(f);
+    }
+#endif
+    size_t core = std::find(core_ids.begin(), core_ids.end(), first) - core_ids.begin();
+    if (core == core_ids.size()) {
+      core_ids.push_back(first);
+      siblings.push_back(std::vector<int>());
+    }
+    siblings[core].push_back(cpu);
+  }
+  cpus->clear();
+  for (size_t rank = 0; ; ++rank) {
+    bool any = false;
+    for (size_t core = 0; core < siblings.size(); ++core) {
+      if (rank < siblings[core].size()) {
+        cpus->push_back(siblings[core][rank]);
+        any = true;
+      }
+    }
+    if (!any) {break;}
+  }
+  return siblings.size();
+}
+
+// Default thread counts for ncpu CPUs: every count up to ncpu, or about 32
+// evenly spaced ones on a bigger machine, then a few oversubscribed ones up
+// to twice ncpu, so the curve is seen to level off
+inline std::vector<int> DefaultThreadCounts(int ncpu) {
+  std::vector<int> counts;
+  int step = std::max(1, ncpu / 32);
+  for (int t = 1; t < ncpu; t += (t == 1 && step > 1) ? step - 1 : step) {counts.push_back(t);}
+  counts.push_back(ncpu);
+  int extra[] = {ncpu + std::max(1, ncpu / 4), ncpu + std::max(1, ncpu / 2), 2 * ncpu};
+  for (int i = 0; i < 3; ++i) {
+    if (extra[i] > counts.back()) {counts.push_back(extra[i]);}
+  }
+  return counts;
+}
+
+// Sum of squared residuals of the continuous two-segment least squares fit
+// of y over x that bends at x = b: y = c0 + c1 * x + c2 * max(0, x - b)
+inline double BrokenLineError(const std::vector<double>& x, const std::vector<double>& y, double b) {
+  double a[3][4] = {{0}};
+  for (size_t i = 0; i < x.size(); ++i) {
+    double basis[3] = {1.0, x[i], std::max(0.0, x[i] - b)};
+    for (int r = 0; r < 3; ++r) {
+      for (int c = 0; c < 3; ++c) {a[r][c] += basis[r] * basis[c];}
+      a[r][3] += basis[r] * y[i];
+    }
+  }
+  // Gauss-Jordan on the 3x3 normal equations
+  for (int p = 0; p < 3; ++p) {
+    int pivot = p;
+    for (int r = p + 1; r < 3; ++r) {
+      if (fabs(a[r][p]) > fabs(a[pivot][p])) {pivot = r;}
+    }
+    if (fabs(a[pivot][p]) < 1e-12) {return 1e300;}
+    for (int c = 0; c < 4; ++c) {std::swap(a[p][c], a[pivot][c]);}
+    for (int r = 0; r < 3; ++r) {
+      if (r == p) {continue;}
+      double f = a[r][p] / a[p][p];
+      for (int c = p; c < 4; ++c) {a[r][c] -= f * a[p][c];}
+    }
+  }
+  double coef[3] = {a[0][3] / a[0][0], a[1][3] / a[1][1], a[2][3] / a[2][2]};
+  double error = 0.0;
+  for (size_t i = 0; i < x.size(); ++i) {
+    double r = y[i] - (coef[0] + coef[1] * x[i] + coef[2] * std::max(0.0, x[i] - b));
+    error += r * r;
+  }
+  return error;
+}
+
+// The least gain in throughput over one thread that counts as scaling at all
+static const double kScalingGain = 1.2;
+
+// The thread count where the throughput curve bends, the virtual core count,
+// as the python script finds it with pwlf: the interior x whose continuous
+// two-segment fit has the least squared error. A curve that never gains
+// kScalingGain over its first point is flat from the start, one core. Returns
+// the last x when there are fewer than three points.
+inline int FindScalingBreak(const std::vector<double>& x, const std::vector<double>& y) {
+  if (*std::max_element(y.begin(), y.end()) < kScalingGain * y[0]) {return static_cast<int>(x[0]);}
+  if (x.size() < 3) {return static_cast<int>(x.back());}
+  int best = static_cast<int>(x.back());
+  double best_error = -1.0;
+  for (size_t i = 1; i + 1 < x.size(); ++i) {
+    double error = BrokenLineError(x, y, x[i]);
+    if (best_error < 0.0 || error < best_error) {
+      best_error = error;
+      best = static_cast<int>(x[i]);
+    }
+  }
+  return best;
+}
+
+// SMT yield: throughput with every CPU busy over that with one thread per
+// core, 1.0 with no SMT or none to gain from it, up to 2.0 for two threads
+// per core that never compete. Returns 0.0 if x has neither count.
+inline double SmtYield(const std::vector<double>& x, const std::vector<double>& y, int cores, int cpus) {
+  double per_core = 0.0, all = 0.0;
+  for (size_t i = 0; i < x.size(); ++i) {
+    if (static_cast<int>(x[i]) == cores) {per_core = y[i];}
+    if (static_cast<int>(x[i]) == cpus) {all = y[i];}
+  }
+  return (per_core > 0.0 && all > 0.0) ? all / per_core : 0.0;
+}
+
+#endif	// __THREADSCALING_H__